@@ -25,7 +25,6 @@
 #include <getopt.h>
 #include <string.h>
 #include <stdio.h>
-#include <time.h>
 #include <cad_array.h>
 
 #include "exp.h"
@@ -34,6 +33,7 @@
 #include "exp_input.h"
 #include "exp_output.h"
 #include "exp_entry_factory.h"
+#include "exp_follow.h"
 
 static level_t   verbose         = warn;
 static expmode_t mode            = mode_undefined;
@@ -72,6 +72,15 @@ static options_t options = {
      .year = 0,
      .exp_mode = false,
      .color = false,
+     .stream = false,
+     .jobs = 1,
+     .cache = false,
+     .state = NULL,
+     .follow = false,
+     .interval = 5,
+     .stats = false,
+     .mixed = false,
+     .limits = { 0, 0, limit_skip },
 };
 
 /**
@@ -85,7 +94,8 @@ static void usage(const char *cmd) {
              "\n"
              "Options:\n"
              "  -h, --help             Show this help message and exit\n"
-             "  -v, --verbose          Show verbose output (may be specified twice)\n"
+             "  -v, --verbose          Show verbose output (may be specified twice); also\n"
+             "                         show the time spent in each pattern on exit\n"
              "  -V, --version          Show verbose output\n"
              "\n"
              "  Exactly one mode (either Hash or Graph) must be specified.\n"
@@ -126,6 +136,26 @@ static void usage(const char *cmd) {
              "  --fingerprintdir=DIR   Add a directory to scan for fingerprint files\n"
              "  --factorydir=DIR       Add a directory to scan for factory files\n"
              "  --color                Use some color\n"
+             "  --stream               Aggregate entries while reading, without keeping\n"
+             "                         them in memory\n"
+             "  --jobs=N               Parse with up to N threads\n"
+             "  --cache                Cache parsed files in ~/.cache/exp\n"
+             "  --state=FILE           Only read what was appended to the files since\n"
+             "                         the previous run with the same state file\n"
+             "  -f, --follow           Keep reading what is appended to the files and\n"
+             "                         display the report again when it changes\n"
+             "  --interval=SECONDS     Time between two reports when following files\n"
+             "                         (default 5)\n"
+             "  --stats                Show statistics about the parsed files on stderr\n"
+             "  --mixed                Select the entry factory of each line instead of\n"
+             "                         each file, for files that mix several formats\n"
+             "  --matchlimit=N         Give up matching a line with a factory pattern or\n"
+             "                         a stopword after N steps (default PCRE's)\n"
+             "  --depthlimit=N         Give up matching a line when backtracking deeper\n"
+             "                         than N (default PCRE's)\n"
+             "  --limitaction=ACTION   What to do with a line when a pattern gives up:\n"
+             "                         skip the pattern (skip, default) or keep the line\n"
+             "                         raw (raw)\n"
              "\n"
              "If no file is provided, data is read from stdin.\n"
              "\n",
@@ -174,6 +204,17 @@ static struct option long_options[] = {
      {"dev1",           no_argument,       NULL, 12 },
      {"dev2",           no_argument,       NULL, 13 },
      {"color",          no_argument,       NULL, 14 },
+     {"stream",         no_argument,       NULL, 15 },
+     {"jobs",           required_argument, NULL, 16 },
+     {"cache",          no_argument,       NULL, 17 },
+     {"state",          required_argument, NULL, 18 },
+     {"follow",         no_argument,       NULL, 'f'},
+     {"interval",       required_argument, NULL, 19 },
+     {"stats",          no_argument,       NULL, 23 },
+     {"mixed",          no_argument,       NULL, 24 },
+     {"matchlimit",     required_argument, NULL, 25 },
+     {"depthlimit",     required_argument, NULL, 26 },
+     {"limitaction",    required_argument, NULL, 27 },
 
      {"filterdir",      required_argument, NULL, 20 },
      {"fingerprintdir", required_argument, NULL, 21 },
@@ -202,7 +243,7 @@ static void parse_options(int argc, char * const argv[]) {
      char *dir;
 
      while (!done) {
-          c = getopt_long(argc, argv, "vt:VxwDHsmhdMy", long_options, &option_index);
+          c = getopt_long(argc, argv, "vt:VxwDHsmhdMyf", long_options, &option_index);
           switch(c) {
           case 0:
                /* flag was set */
@@ -299,6 +340,73 @@ static void parse_options(int argc, char * const argv[]) {
                options_set.color = true;
                break;
 
+          case 15:
+               options.stream = true;
+               options_set.stream = true;
+               break;
+
+          case 16:
+               options.jobs = atoi(optarg);
+               options_set.jobs = true;
+               break;
+
+          case 17:
+               options.cache = true;
+               options_set.cache = true;
+               break;
+
+          case 18:
+               /* the state holds the data aggregated while streaming */
+               options.state = optarg;
+               options_set.state = true;
+               options.stream = true;
+               options_set.stream = true;
+               break;
+
+          case 'f':
+               options.follow = true;
+               options_set.follow = true;
+               options.stream = true;
+               options_set.stream = true;
+               break;
+
+          case 19:
+               options.interval = atoi(optarg);
+               options_set.interval = true;
+               break;
+
+          case 23:
+               options.stats = true;
+               options_set.stats = true;
+               break;
+
+          case 24:
+               options.mixed = true;
+               options_set.mixed = true;
+               break;
+
+          case 25:
+               options.limits.match = strtoul(optarg, NULL, 10);
+               options_set.limits = true;
+               break;
+
+          case 26:
+               options.limits.depth = strtoul(optarg, NULL, 10);
+               options_set.limits = true;
+               break;
+
+          case 27:
+               if (!strcmp(optarg, "skip")) {
+                    options.limits.action = limit_skip;
+               } else if (!strcmp(optarg, "raw")) {
+                    options.limits.action = limit_raw;
+               } else {
+                    usage(argv[0]);
+                    exit(2);
+               }
+               options_set.limits = true;
+               break;
+
           case 20:
                if (filterdirs == NULL) {
                     filterdirs = cad_new_array(stdlib_memory, sizeof(char*));
@@ -361,6 +469,15 @@ static void check_options_set(logger_t log, options_set_t allowed_input_options,
      check_option(factory_extradirs);
      check_option(year);
      check_option(dev);
+     check_option(stream);
+     check_option(jobs);
+     check_option(cache);
+     check_option(state);
+     check_option(follow);
+     check_option(interval);
+     check_option(stats);
+     check_option(mixed);
+     check_option(limits);
 }
 
 /**
@@ -373,13 +490,14 @@ int main(int argc, char * const argv[]) {
      logger_t log;
      input_t *input;
      output_t *output;
-     int lastoptind;
+     state_t *state = NULL;
      bool_t has_data = false;
 
-     srand(time(NULL));
-
      parse_options(argc, argv);
      log = new_logger(verbose);
+     if (verbose > warn) {
+          start_regexp_stats();
+     }
      input = new_input(log);
 
      switch(mode) {
@@ -431,29 +549,44 @@ int main(int argc, char * const argv[]) {
      options.factory_extradirs = array_to_dirs(factorydirs);
      input->set_options(input, options);
      output->set_options(output, options);
+     if (options.stream) {
+          input->set_listener(input, (input_listener_fn)output->stream, output);
+     }
+     if (options.state != NULL) {
+          state = new_state(log, options.state, entry_factories_signature(options.mixed));
+          state->load(state, argc - optind, (const char * const*)argv + optind, (state_reader_fn)output->load_state, output);
+          input->set_state(input, state);
+     }
 
      if (optind == argc) {
           log(debug, "Input: stdin\n");
           if (input->parse(input, "-") != NULL) {
                has_data = true;
           }
-     } else{
-          lastoptind = optind;
-          while (optind < argc) {
-               log(debug, "Input %d/%d: %s\n", optind - lastoptind + 1, argc - lastoptind, argv[optind]);
-               if (input->parse(input, argv[optind++]) != NULL) {
-                    has_data = true;
-               }
-          }
+     } else if (input->parse_all(input, argc - optind, (const char * const*)argv + optind) > 0) {
+          has_data = true;
      }
      if (has_data) {
           input->sort_files(input);
           log(debug, "Input done\n");
-          output->prepare(output);
-          output->display(output);
+          if (options.stats) {
+               input->print_stats(input, stderr);
+          }
+          if (options.follow) {
+               follow(log, input, output, state, options.interval);
+          } else {
+               if (state != NULL) {
+                    state->save(state, (state_writer_fn)output->save_state, output);
+               }
+               output->prepare(output);
+               output->display(output);
+          }
      } else {
           fputs("No data found\n", stdout);
      }
+     if (verbose > warn) {
+          log_regexp_stats(log, info);
+     }
 
      return 0;
 }
@@ -22,6 +22,8 @@
  * The main header for the ExP application.
  */
 
+#include <stdint.h>
+
 #include "cad_shared.h"
 
 #define EXP_GRAND_VERSION 0
@@ -50,6 +52,22 @@ typedef enum {
  */
 int month_of(const char *month);
 
+/**
+ * The initial value of a [hash](@ref hash_bytes).
+ */
+#define HASH_INIT 14695981039346656037ULL
+
+/**
+ * Hash some bytes (FNV-1a), carrying on from a previous hash.
+ *
+ * @param[in] hash the previous hash, or `HASH_INIT`
+ * @param[in] data the bytes to hash
+ * @param[in] length the number of bytes
+ *
+ * @return the new hash
+ */
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t length);
+
 /**
  * @}
  */
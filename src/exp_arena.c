@@ -0,0 +1,197 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @ingroup exp
+ * @file
+ *
+ * This file contains the implementation of memory arenas.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "exp_arena.h"
+
+#define CHUNK_SIZE (1024 * 1024)
+#define ALIGNMENT 16
+#define ALIGN(size) (((size) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+typedef struct chunk_s chunk_t;
+
+struct chunk_s {
+     chunk_t *next;
+     size_t size;
+     size_t used;
+     char data[0] __attribute__((aligned(ALIGNMENT)));
+};
+
+typedef struct {
+     arena_t fn;
+     chunk_t *chunks;
+} arena_impl_t;
+
+static chunk_t *new_chunk(size_t size, chunk_t *next) {
+     chunk_t *result = malloc(sizeof(chunk_t) + size);
+     result->next = next;
+     result->size = size;
+     result->used = 0;
+     return result;
+}
+
+static void *impl_malloc(arena_impl_t *this, size_t size) {
+     chunk_t *chunk = this->chunks;
+     void *result;
+     size = ALIGN(size);
+     if (size > CHUNK_SIZE / 4) {
+          /* big objects get their own chunk, behind the current one */
+          chunk->next = new_chunk(size, chunk->next);
+          chunk = chunk->next;
+     } else if (chunk->used + size > chunk->size) {
+          chunk = this->chunks = new_chunk(CHUNK_SIZE, chunk);
+     }
+     result = chunk->data + chunk->used;
+     chunk->used += size;
+     return result;
+}
+
+static void impl_merge(arena_impl_t *this, arena_impl_t *other) {
+     chunk_t *last = other->chunks;
+     while (last->next != NULL) {
+          last = last->next;
+     }
+     /* the current chunk stays first */
+     last->next = this->chunks->next;
+     this->chunks->next = other->chunks;
+     free(other);
+}
+
+static void impl_free(arena_impl_t *this) {
+     chunk_t *chunk = this->chunks, *next;
+     while (chunk != NULL) {
+          next = chunk->next;
+          free(chunk);
+          chunk = next;
+     }
+     free(this);
+}
+
+static arena_t arena_impl_fn = {
+     .malloc = (arena_malloc_fn)impl_malloc,
+     .merge = (arena_merge_fn)impl_merge,
+     .free = (arena_free_fn)impl_free,
+};
+
+arena_t *new_arena(void) {
+     arena_impl_t *result = malloc(sizeof(arena_impl_t));
+     result->fn = arena_impl_fn;
+     result->chunks = new_chunk(CHUNK_SIZE, NULL);
+     return &(result->fn);
+}
+
+/*
+ * libcad memory managers carry no context, hence the thread-local
+ * current arena. Each block is prefixed with its size, so that realloc
+ * knows how much to copy, and with its origin: realloc and free follow
+ * where the block comes from, not the arena current at call time.
+ */
+
+typedef struct {
+     size_t size;
+     bool_t in_arena;
+} block_t;
+
+static __thread arena_t *current_arena = NULL;
+
+arena_t *use_arena(arena_t *arena) {
+     arena_t *result = current_arena;
+     current_arena = arena;
+     return result;
+}
+
+cad_memory_t *current_memory(void) {
+     return current_arena == NULL ? &stdlib_memory : &arena_memory;
+}
+
+/* the last block of the current chunk can be resized without copying */
+static bool_t resize_last(arena_impl_t *this, char *block, size_t old_size, size_t new_size) {
+     chunk_t *chunk = this->chunks;
+     old_size = ALIGN(old_size);
+     new_size = ALIGN(new_size);
+     if (block + old_size != chunk->data + chunk->used || chunk->used - old_size + new_size > chunk->size) {
+          return false;
+     }
+     chunk->used = chunk->used - old_size + new_size;
+     return true;
+}
+
+static void *arena_memory_malloc(size_t size) {
+     block_t *result;
+     if (current_arena == NULL) {
+          result = malloc(ALIGNMENT + size);
+          result->in_arena = false;
+     } else {
+          result = current_arena->malloc(current_arena, ALIGNMENT + size);
+          result->in_arena = true;
+     }
+     result->size = size;
+     return (char*)result + ALIGNMENT;
+}
+
+static void *arena_memory_realloc(void *ptr, size_t size) {
+     block_t *block;
+     void *result;
+     if (ptr == NULL) {
+          return arena_memory_malloc(size);
+     }
+     block = (block_t*)((char*)ptr - ALIGNMENT);
+     if (!block->in_arena) {
+          block = realloc(block, ALIGNMENT + size);
+          block->size = size;
+          return (char*)block + ALIGNMENT;
+     }
+     if (size <= block->size || (current_arena != NULL && resize_last((arena_impl_t*)current_arena, (char*)block, ALIGNMENT + block->size, ALIGNMENT + size))) {
+          block->size = size;
+          return ptr;
+     }
+     result = arena_memory_malloc(size);
+     memcpy(result, ptr, block->size);
+     return result;
+}
+
+static void arena_memory_free(void *ptr) {
+     block_t *block;
+     if (ptr != NULL) {
+          block = (block_t*)((char*)ptr - ALIGNMENT);
+          if (!block->in_arena) {
+               free(block);
+          }
+          /* arena blocks are released with the arena */
+     }
+}
+
+cad_memory_t arena_memory = {
+     .malloc = arena_memory_malloc,
+     .realloc = arena_memory_realloc,
+     .free = arena_memory_free,
+};
+
+char *memory_strndup(cad_memory_t *memory, const char *string, size_t length) {
+     char *result = memory->malloc(length + 1);
+     memcpy(result, string, length);
+     result[length] = '\0';
+     return result;
+}
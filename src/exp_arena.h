@@ -0,0 +1,134 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EXP_ARENA_H__
+#define __EXP_ARENA_H__
+
+/**
+ * @file
+ * The header for memory arenas.
+ */
+
+#include "exp.h"
+
+/**
+ * @addtogroup exp
+ * @{
+ */
+
+/**
+ * The arena interface.
+ *
+ * An arena bump-allocates memory in big chunks. Objects allocated in
+ * an arena are never freed individually: the whole arena is released
+ * at once.
+ */
+typedef struct arena_s arena_t;
+
+/**
+ * Allocate memory in the arena.
+ *
+ * @param[in] this the target arena
+ * @param[in] size the size to allocate
+ *
+ * @return the allocated memory, suitably aligned for any object
+ */
+typedef void *(*arena_malloc_fn)(arena_t *this, size_t size);
+
+/**
+ * Move all the memory of another arena into this one; the other arena
+ * is freed, and what was allocated in it is then released with this
+ * arena.
+ *
+ * @param[in] this the target arena
+ * @param[in] other the arena to merge into the target
+ */
+typedef void (*arena_merge_fn)(arena_t *this, arena_t *other);
+
+/**
+ * Release all the memory of the arena, and the arena itself.
+ *
+ * @param[in] this the target arena
+ */
+typedef void (*arena_free_fn)(arena_t *this);
+
+struct arena_s {
+     /**
+      * @see arena_malloc_fn
+      */
+     arena_malloc_fn malloc;
+     /**
+      * @see arena_merge_fn
+      */
+     arena_merge_fn merge;
+     /**
+      * @see arena_free_fn
+      */
+     arena_free_fn free;
+};
+
+/**
+ * Create a new arena.
+ *
+ * @return the new arena
+ */
+arena_t *new_arena(void);
+
+/**
+ * A libcad memory manager that allocates in the current arena of the
+ * calling thread (see [use_arena](@ref use_arena)), or with the
+ * standard library if there is none. Each block remembers where it
+ * comes from: `free` releases standard library blocks but never arena
+ * blocks, which live as long as their arena. Prefer
+ * [current_memory](@ref current_memory).
+ */
+extern cad_memory_t arena_memory;
+
+/**
+ * Set the current arena of the calling thread.
+ *
+ * @param[in] arena the new current arena, `null` to allocate with the
+ * standard library again
+ *
+ * @return the previous current arena
+ */
+arena_t *use_arena(arena_t *arena);
+
+/**
+ * Get the memory manager to use for objects that live as long as the
+ * current arena: [arena_memory](@ref arena_memory) if the calling
+ * thread uses an arena, `stdlib_memory` otherwise.
+ *
+ * @return the memory manager
+ */
+cad_memory_t *current_memory(void);
+
+/**
+ * Duplicate a string using the given memory manager.
+ *
+ * @param[in] memory the memory manager
+ * @param[in] string the string to duplicate
+ * @param[in] length the length of the string
+ *
+ * @return the `\0`-terminated copy
+ */
+char *memory_strndup(cad_memory_t *memory, const char *string, size_t length);
+
+/**
+ * @}
+ */
+
+#endif /* __EXP_ARENA_H__ */
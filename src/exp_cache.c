@@ -0,0 +1,474 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @ingroup exp_input
+ * @file
+ *
+ * This file contains the implementation of the parsed files cache.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cad_hash.h>
+
+#include "exp_cache.h"
+
+#define CACHE_MAGIC "ExPcache"
+#define CACHE_VERSION 2
+#define NO_STRING ((uint64_t)-1)
+#define FACTORY_NAME_SIZE 64
+
+/*
+ * Cache file layout: the header, then one record per entry, then the
+ * (deduplicated) strings block the records point into. The name of a
+ * record is only set if its entry was not created by the factory of
+ * the file (mixed files).
+ */
+
+typedef struct {
+     char magic[8];
+     uint32_t version;
+     uint32_t record_size;
+     uint64_t dev;
+     uint64_t ino;
+     uint64_t size;
+     uint64_t mtime_sec;
+     uint64_t mtime_nsec;
+     uint64_t signature;
+     uint64_t length;
+     uint64_t file_size;
+     uint64_t strings_size;
+     char factory[FACTORY_NAME_SIZE];
+} cache_header_t;
+
+typedef struct {
+     uint64_t name;
+     uint64_t host;
+     uint64_t daemon;
+     uint64_t logline;
+     int32_t year;
+     int32_t month;
+     int32_t day;
+     int32_t hour;
+     int32_t minute;
+     int32_t second;
+} cache_record_t;
+
+/*
+ * Cached entries
+ */
+
+typedef struct {
+     entry_t fn;
+     const cache_record_t *record;
+     const char *strings;
+     const char *name;
+} cached_entry_t;
+
+static const char *cached_entry_get_name(cached_entry_t *this) {
+     return this->name;
+}
+
+static int cached_entry_year(cached_entry_t *this) {
+     return this->record->year;
+}
+
+static int cached_entry_month(cached_entry_t *this) {
+     return this->record->month;
+}
+
+static int cached_entry_day(cached_entry_t *this) {
+     return this->record->day;
+}
+
+static int cached_entry_hour(cached_entry_t *this) {
+     return this->record->hour;
+}
+
+static int cached_entry_minute(cached_entry_t *this) {
+     return this->record->minute;
+}
+
+static int cached_entry_second(cached_entry_t *this) {
+     return this->record->second;
+}
+
+static const char *cached_string(cached_entry_t *this, uint64_t offset) {
+     return offset == NO_STRING ? NULL : this->strings + offset;
+}
+
+static const char *cached_entry_host(cached_entry_t *this) {
+     return cached_string(this, this->record->host);
+}
+
+static const char *cached_entry_daemon(cached_entry_t *this) {
+     return cached_string(this, this->record->daemon);
+}
+
+static const char *cached_entry_logline(cached_entry_t *this) {
+     return cached_string(this, this->record->logline);
+}
+
+static void cached_entry_free(cached_entry_t *this) {
+     /* owned by the cached file */
+}
+
+static const entry_ops_t cached_entry_ops = {
+     .get_name = (entry_get_name_fn)cached_entry_get_name,
+     .year     = (entry_year_fn    )cached_entry_year    ,
+     .month    = (entry_month_fn   )cached_entry_month   ,
+     .day      = (entry_day_fn     )cached_entry_day     ,
+     .hour     = (entry_hour_fn    )cached_entry_hour    ,
+     .minute   = (entry_minute_fn  )cached_entry_minute  ,
+     .second   = (entry_second_fn  )cached_entry_second  ,
+     .host     = (entry_host_fn    )cached_entry_host    ,
+     .daemon   = (entry_daemon_fn  )cached_entry_daemon  ,
+     .logline  = (entry_logline_fn )cached_entry_logline ,
+     .free     = (entry_free_fn    )cached_entry_free    ,
+};
+
+/*
+ * Cached files
+ */
+
+typedef struct {
+     cached_file_t fn;
+     void *map;
+     size_t map_length;
+     const cache_header_t *header;
+     cached_entry_t *entries;
+} cached_file_impl_t;
+
+static const char *cached_file_factory(cached_file_impl_t *this) {
+     return this->header->factory;
+}
+
+static size_t cached_file_entries_length(cached_file_impl_t *this) {
+     return this->header->length;
+}
+
+static size_t cached_file_size(cached_file_impl_t *this) {
+     return this->header->file_size;
+}
+
+static entry_t *cached_file_entry(cached_file_impl_t *this, int index) {
+     return &(this->entries[index].fn);
+}
+
+static void cached_file_free(cached_file_impl_t *this) {
+     free(this->entries);
+     munmap(this->map, this->map_length);
+     free(this);
+}
+
+static cached_file_t cached_file_impl_fn = {
+     .factory = (cached_file_factory_fn)cached_file_factory,
+     .entries_length = (cached_file_entries_length_fn)cached_file_entries_length,
+     .size = (cached_file_size_fn)cached_file_size,
+     .entry = (cached_file_entry_fn)cached_file_entry,
+     .free = (cached_file_free_fn)cached_file_free,
+};
+
+/*
+ * The cache
+ */
+
+typedef struct {
+     cache_t fn;
+     logger_t log;
+     uint64_t signature;
+     char dir[0];
+} cache_impl_t;
+
+static bool_t make_key(cache_impl_t *this, const char *filename, cache_key_t *key) {
+     struct stat st;
+     key->valid = strcmp("-", filename) && stat(filename, &st) == 0 && S_ISREG(st.st_mode);
+     if (key->valid) {
+          key->dev = st.st_dev;
+          key->ino = st.st_ino;
+          key->size = st.st_size;
+          key->mtime_sec = st.st_mtim.tv_sec;
+          key->mtime_nsec = st.st_mtim.tv_nsec;
+     }
+     return key->valid;
+}
+
+static char *cache_path(cache_impl_t *this, cache_key_t *key) {
+     char *result = malloc(strlen(this->dir) + 32);
+     uint64_t hash = hash_bytes(HASH_INIT, &(this->signature), sizeof(uint64_t));
+     hash = hash_bytes(hash, &(key->dev), sizeof(uint64_t));
+     hash = hash_bytes(hash, &(key->ino), sizeof(uint64_t));
+     hash = hash_bytes(hash, &(key->size), sizeof(uint64_t));
+     hash = hash_bytes(hash, &(key->mtime_sec), sizeof(uint64_t));
+     hash = hash_bytes(hash, &(key->mtime_nsec), sizeof(uint64_t));
+     sprintf(result, "%s/%016llx.cache", this->dir, (unsigned long long)hash);
+     return result;
+}
+
+static bool_t check_header(cache_impl_t *this, cache_key_t *key, const cache_header_t *header, size_t length) {
+     return length >= sizeof(cache_header_t)
+          && !memcmp(header->magic, CACHE_MAGIC, 8)
+          && header->version == CACHE_VERSION
+          && header->record_size == sizeof(cache_record_t)
+          && header->dev == key->dev
+          && header->ino == key->ino
+          && header->size == key->size
+          && header->mtime_sec == key->mtime_sec
+          && header->mtime_nsec == key->mtime_nsec
+          && header->signature == this->signature
+          && header->factory[FACTORY_NAME_SIZE - 1] == '\0'
+          && length == sizeof(cache_header_t) + header->length * sizeof(cache_record_t) + header->strings_size
+          && (header->strings_size == 0 || ((const char*)header)[length - 1] == '\0');
+}
+
+static bool_t check_offset(const cache_header_t *header, uint64_t offset) {
+     return offset == NO_STRING || offset < header->strings_size;
+}
+
+static cached_file_t *cache_load(cache_impl_t *this, const char *filename, cache_key_t *key) {
+     cached_file_impl_t *result;
+     const cache_header_t *header;
+     const cache_record_t *records;
+     const char *strings;
+     struct stat st;
+     char *path;
+     void *map = MAP_FAILED;
+     size_t i, n;
+     int fd;
+
+     if (!make_key(this, filename, key)) {
+          return NULL;
+     }
+
+     path = cache_path(this, key);
+     fd = open(path, O_RDONLY);
+     if (fd >= 0) {
+          if (fstat(fd, &st) == 0 && st.st_size > 0) {
+               map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          }
+          close(fd);
+     }
+     if (map == MAP_FAILED) {
+          this->log(debug, "Cache miss for %s: %s\n", filename, path);
+          free(path);
+          return NULL;
+     }
+
+     header = map;
+     if (!check_header(this, key, header, st.st_size)) {
+          this->log(info, "Ignoring stale cache for %s: %s\n", filename, path);
+          munmap(map, st.st_size);
+          free(path);
+          return NULL;
+     }
+
+     n = header->length;
+     records = (const cache_record_t *)(header + 1);
+     strings = (const char *)(records + n);
+     for (i = 0; i < n; i++) {
+          if (!check_offset(header, records[i].name) || !check_offset(header, records[i].host) || !check_offset(header, records[i].daemon) || !check_offset(header, records[i].logline)) {
+               this->log(info, "Ignoring corrupt cache for %s: %s\n", filename, path);
+               munmap(map, st.st_size);
+               free(path);
+               return NULL;
+          }
+     }
+
+     result = malloc(sizeof(cached_file_impl_t));
+     result->fn = cached_file_impl_fn;
+     result->map = map;
+     result->map_length = st.st_size;
+     result->header = header;
+     result->entries = malloc(n * sizeof(cached_entry_t));
+     for (i = 0; i < n; i++) {
+          result->entries[i].fn.ops = &cached_entry_ops;
+          result->entries[i].record = records + i;
+          result->entries[i].strings = strings;
+          result->entries[i].name = records[i].name == NO_STRING ? header->factory : strings + records[i].name;
+     }
+
+     this->log(info, "Using cache for %s: %s\n", filename, path);
+     free(path);
+     return &(result->fn);
+}
+
+typedef struct {
+     cad_hash_t *offsets;
+     char *buffer;
+     size_t size;
+     size_t capacity;
+} strings_t;
+
+static uint64_t intern(strings_t *strings, const char *string) {
+     uint64_t result;
+     size_t length;
+     void *offset;
+     if (string == NULL) {
+          return NO_STRING;
+     }
+     offset = strings->offsets->get(strings->offsets, string);
+     if (offset != NULL) {
+          return (uint64_t)(uintptr_t)offset - 1;
+     }
+     length = strlen(string) + 1;
+     if (strings->size + length > strings->capacity) {
+          strings->capacity = (strings->size + length) * 2;
+          strings->buffer = realloc(strings->buffer, strings->capacity);
+     }
+     result = strings->size;
+     memcpy(strings->buffer + result, string, length);
+     strings->size += length;
+     strings->offsets->set(strings->offsets, string, (void*)(uintptr_t)(result + 1));
+     return result;
+}
+
+static void cache_save(cache_impl_t *this, cache_key_t *key, const char *factory, size_t size, size_t length, entry_t **entries) {
+     cache_header_t header;
+     cache_record_t *records;
+     strings_t strings = { cad_new_hash(stdlib_memory, cad_hash_strings), NULL, 0, 0 };
+     entry_t *entry;
+     FILE *out;
+     char *path, *tmp;
+     bool_t ok;
+     size_t i;
+     int fd;
+
+     if (!key->valid || strlen(factory) >= FACTORY_NAME_SIZE) {
+          return;
+     }
+
+     memset(&header, 0, sizeof(cache_header_t));
+     memcpy(header.magic, CACHE_MAGIC, 8);
+     header.version = CACHE_VERSION;
+     header.record_size = sizeof(cache_record_t);
+     header.dev = key->dev;
+     header.ino = key->ino;
+     header.size = key->size;
+     header.mtime_sec = key->mtime_sec;
+     header.mtime_nsec = key->mtime_nsec;
+     header.signature = this->signature;
+     header.length = length;
+     header.file_size = size;
+     strcpy(header.factory, factory);
+
+     records = malloc(length * sizeof(cache_record_t) + 1);
+     for (i = 0; i < length; i++) {
+          entry = entries[i];
+          records[i].name    = strcmp(entry->ops->get_name(entry), factory) ? intern(&strings, entry->ops->get_name(entry)) : NO_STRING;
+          records[i].host    = intern(&strings, entry->ops->host(entry));
+          records[i].daemon  = intern(&strings, entry->ops->daemon(entry));
+          records[i].logline = intern(&strings, entry->ops->logline(entry));
+          records[i].year    = entry->ops->year(entry);
+          records[i].month   = entry->ops->month(entry);
+          records[i].day     = entry->ops->day(entry);
+          records[i].hour    = entry->ops->hour(entry);
+          records[i].minute  = entry->ops->minute(entry);
+          records[i].second  = entry->ops->second(entry);
+     }
+     header.strings_size = strings.size;
+
+     /* written aside then renamed, so that readers never see a partial file */
+     path = cache_path(this, key);
+     tmp = malloc(strlen(path) + 8);
+     sprintf(tmp, "%s.XXXXXX", path);
+     fd = mkstemp(tmp);
+     if (fd < 0) {
+          this->log(warn, "Could not write cache %s: %s\n", tmp, strerror(errno));
+     } else {
+          out = fdopen(fd, "w");
+          ok = fwrite(&header, sizeof(cache_header_t), 1, out) == 1
+               && fwrite(records, sizeof(cache_record_t), length, out) == length
+               && fwrite(strings.buffer, 1, strings.size, out) == strings.size;
+          ok = fclose(out) == 0 && ok;
+          if (ok && rename(tmp, path) == 0) {
+               this->log(info, "Cached %lu entries: %s\n", (unsigned long)length, path);
+          } else {
+               this->log(warn, "Could not write cache %s: %s\n", path, strerror(errno));
+               unlink(tmp);
+          }
+     }
+
+     strings.offsets->free(strings.offsets);
+     free(strings.buffer);
+     free(records);
+     free(tmp);
+     free(path);
+}
+
+static void cache_free(cache_impl_t *this) {
+     free(this);
+}
+
+static cache_t cache_impl_fn = {
+     .load = (cache_load_fn)cache_load,
+     .save = (cache_save_fn)cache_save,
+     .free = (cache_free_fn)cache_free,
+};
+
+static bool_t make_dir(logger_t log, const char *dir) {
+     if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+          log(warn, "Could not create cache directory %s: %s\n", dir, strerror(errno));
+          return false;
+     }
+     return true;
+}
+
+cache_t *new_cache(logger_t log, uint64_t signature) {
+     cache_impl_t *result;
+     const char *xdg = getenv("XDG_CACHE_HOME");
+     const char *home = getenv("HOME");
+     char *dir;
+
+     if (xdg != NULL && xdg[0] == '/') {
+          dir = malloc(strlen(xdg) + 5);
+          sprintf(dir, "%s/exp", xdg);
+          if (!make_dir(log, xdg)) {
+               free(dir);
+               return NULL;
+          }
+     } else if (home != NULL && home[0] != '\0') {
+          dir = malloc(strlen(home) + 12);
+          sprintf(dir, "%s/.cache", home);
+          if (!make_dir(log, dir)) {
+               free(dir);
+               return NULL;
+          }
+          strcat(dir, "/exp");
+     } else {
+          log(warn, "No cache directory\n");
+          return NULL;
+     }
+     if (!make_dir(log, dir)) {
+          free(dir);
+          return NULL;
+     }
+
+     result = malloc(sizeof(cache_impl_t) + strlen(dir) + 1);
+     result->fn = cache_impl_fn;
+     result->log = log;
+     result->signature = signature;
+     strcpy(result->dir, dir);
+     free(dir);
+     log(debug, "Cache directory: %s\n", result->dir);
+     return &(result->fn);
+}
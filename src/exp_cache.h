@@ -0,0 +1,207 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EXP_CACHE_H__
+#define __EXP_CACHE_H__
+
+/**
+ * @file
+ * The header for the parsed files cache.
+ */
+
+#include "exp.h"
+#include "exp_log.h"
+#include "exp_entry.h"
+
+/**
+ * @addtogroup exp_input
+ * @{
+ */
+
+/**
+ * The identity of a file, as known when it was looked up in the
+ * cache.
+ */
+typedef struct {
+     /**
+      * `true` if the file can be cached (i.e. it is a regular file)
+      */
+     bool_t valid;
+     /**
+      * The device of the file
+      */
+     uint64_t dev;
+     /**
+      * The inode of the file
+      */
+     uint64_t ino;
+     /**
+      * The size of the file
+      */
+     uint64_t size;
+     /**
+      * The modification time of the file (seconds)
+      */
+     uint64_t mtime_sec;
+     /**
+      * The modification time of the file (nanoseconds)
+      */
+     uint64_t mtime_nsec;
+} cache_key_t;
+
+/**
+ * The interface of a file found in the cache.
+ */
+typedef struct cached_file_s cached_file_t;
+
+/**
+ * Get the name of the factory the cached entries were created by.
+ *
+ * @param[in] this the target cached file
+ *
+ * @return the name of the factory
+ */
+typedef const char *(*cached_file_factory_fn)(cached_file_t *this);
+
+/**
+ * Get the number of cached entries.
+ *
+ * @param[in] this the target cached file
+ *
+ * @return the number of entries
+ */
+typedef size_t (*cached_file_entries_length_fn)(cached_file_t *this);
+
+/**
+ * Get the size of the file the entries were parsed from.
+ *
+ * @param[in] this the target cached file
+ *
+ * @return the size
+ */
+typedef size_t (*cached_file_size_fn)(cached_file_t *this);
+
+/**
+ * Get a cached entry. The entry belongs to the cached file: freeing
+ * it does nothing.
+ *
+ * @param[in] this the target cached file
+ * @param[in] index the index of the entry
+ *
+ * @return the `index`-th entry
+ */
+typedef entry_t *(*cached_file_entry_fn)(cached_file_t *this, int index);
+
+/**
+ * Free the cached file and all its entries.
+ *
+ * @param[in] this the target cached file
+ */
+typedef void (*cached_file_free_fn)(cached_file_t *this);
+
+struct cached_file_s {
+     /**
+      * @see cached_file_factory_fn
+      */
+     cached_file_factory_fn factory;
+     /**
+      * @see cached_file_entries_length_fn
+      */
+     cached_file_entries_length_fn entries_length;
+     /**
+      * @see cached_file_size_fn
+      */
+     cached_file_size_fn size;
+     /**
+      * @see cached_file_entry_fn
+      */
+     cached_file_entry_fn entry;
+     /**
+      * @see cached_file_free_fn
+      */
+     cached_file_free_fn free;
+};
+
+/**
+ * The cache interface.
+ *
+ * Parsed files are stored in the cache directory (`$XDG_CACHE_HOME/exp`
+ * or `~/.cache/exp`), keyed by the file identity (device, inode, size,
+ * modification time) and the signature of the entry factories, which
+ * covers their regexp limits. Cached files are memory-mapped.
+ */
+typedef struct cache_s cache_t;
+
+/**
+ * Look a file up in the cache.
+ *
+ * @param[in] this the target cache
+ * @param[in] filename the name of the file
+ * @param[out] key the identity of the file, to [save](@ref cache_save_fn) it after parsing on a miss
+ *
+ * @return the cached file, or `null` if the file is not in the cache
+ */
+typedef cached_file_t *(*cache_load_fn)(cache_t *this, const char *filename, cache_key_t *key);
+
+/**
+ * Store parsed entries in the cache.
+ *
+ * @param[in] this the target cache
+ * @param[in] key the identity of the file, as given by [load](@ref cache_load_fn)
+ * @param[in] factory the name of the factory that created the entries
+ * @param[in] size the size of the parsed file
+ * @param[in] length the number of entries
+ * @param[in] entries the entries
+ */
+typedef void (*cache_save_fn)(cache_t *this, cache_key_t *key, const char *factory, size_t size, size_t length, entry_t **entries);
+
+/**
+ * Free the cache.
+ *
+ * @param[in] this the target cache
+ */
+typedef void (*cache_free_fn)(cache_t *this);
+
+struct cache_s {
+     /**
+      * @see cache_load_fn
+      */
+     cache_load_fn load;
+     /**
+      * @see cache_save_fn
+      */
+     cache_save_fn save;
+     /**
+      * @see cache_free_fn
+      */
+     cache_free_fn free;
+};
+
+/**
+ * Create a new cache.
+ *
+ * @param[in] log the logger
+ * @param[in] signature the signature of the entry factories
+ *
+ * @return the new cache, or `null` if there is no usable cache directory
+ */
+cache_t *new_cache(logger_t log, uint64_t signature);
+
+/**
+ * @}
+ */
+
+#endif /* __EXP_CACHE_H__ */
@@ -0,0 +1,413 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @ingroup exp_input
+ * @file
+ *
+ * This file contains the implementation of decompressors.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZLIB
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "exp_decompress.h"
+
+#define CHUNK_SIZE 65536
+#define MAX_MAGIC_LENGTH 10
+
+typedef struct decompressor_impl_s decompressor_impl_t;
+
+/**
+ * Inflate the whole input into the pipe.
+ */
+typedef bool_t (*inflate_fn)(decompressor_impl_t *this);
+
+/**
+ * Check the bytes that follow the magic prefix, for formats whose
+ * prefix alone is too weak.
+ */
+typedef bool_t (*magic_check_fn)(const char *magic, size_t length);
+
+typedef struct {
+     const char *name;
+     size_t magic_length;
+     const char *magic;
+     magic_check_fn check;
+     inflate_fn inflate;
+} format_t;
+
+struct decompressor_impl_s {
+     decompressor_t fn;
+     logger_t log;
+     const format_t *format;
+     int fd;
+     int out;
+     FILE *stream;
+     pthread_t thread;
+     bool_t status;
+     unsigned char in[CHUNK_SIZE];
+     unsigned char buffer[CHUNK_SIZE];
+     char path[0];
+};
+
+#if defined(HAVE_ZLIB) || defined(HAVE_BZLIB) || defined(HAVE_LZMA) || defined(HAVE_ZSTD)
+
+static ssize_t read_chunk(decompressor_impl_t *this) {
+     ssize_t result;
+     do {
+          result = read(this->fd, this->in, CHUNK_SIZE);
+     } while (result < 0 && errno == EINTR);
+     if (result < 0) {
+          this->log(warn, "%s: %s\n", this->path, strerror(errno));
+     }
+     return result;
+}
+
+static bool_t write_all(decompressor_impl_t *this, const unsigned char *data, size_t length) {
+     ssize_t n;
+     while (length > 0) {
+          n = write(this->out, data, length);
+          if (n < 0) {
+               if (errno != EINTR) {
+                    this->log(warn, "%s: %s\n", this->path, strerror(errno));
+                    return false;
+               }
+          } else {
+               data += n;
+               length -= n;
+          }
+     }
+     return true;
+}
+
+#endif
+
+#ifdef HAVE_ZLIB
+static bool_t inflate_gzip(decompressor_impl_t *this) {
+     bool_t result = true, more;
+     z_stream z;
+     int status = Z_OK;
+     ssize_t n;
+
+     memset(&z, 0, sizeof(z_stream));
+     if (inflateInit2(&z, 15 + 32) != Z_OK) { /* 32: gzip header detection */
+          this->log(warn, "%s: gzip error: %s\n", this->path, z.msg == NULL ? "init failed" : z.msg);
+          return false;
+     }
+
+     while (result && (n = read_chunk(this)) > 0) {
+          z.next_in = this->in;
+          z.avail_in = n;
+          for (more = true; result && more; ) {
+               if (status == Z_STREAM_END) {
+                    if (z.avail_in == 0) {
+                         break;
+                    }
+                    inflateReset(&z); /* concatenated gzip members */
+               }
+               z.next_out = this->buffer;
+               z.avail_out = CHUNK_SIZE;
+               status = inflate(&z, Z_NO_FLUSH);
+               switch (status) {
+               case Z_OK:
+               case Z_STREAM_END:
+               case Z_BUF_ERROR:
+                    result = write_all(this, this->buffer, CHUNK_SIZE - z.avail_out);
+                    break;
+               default:
+                    this->log(warn, "%s: gzip error: %s\n", this->path, z.msg == NULL ? "corrupt data" : z.msg);
+                    result = false;
+               }
+               more = z.avail_out == 0 || (status == Z_STREAM_END && z.avail_in > 0);
+          }
+     }
+
+     if (result && status != Z_STREAM_END) {
+          this->log(warn, "%s: truncated gzip data\n", this->path);
+          result = false;
+     }
+     inflateEnd(&z);
+     return result && n == 0;
+}
+#else
+#define inflate_gzip NULL
+#endif
+
+#ifdef HAVE_BZLIB
+static bool_t inflate_bzip2(decompressor_impl_t *this) {
+     bool_t result = true, more;
+     bz_stream bz;
+     int status = BZ_OK;
+     ssize_t n;
+
+     memset(&bz, 0, sizeof(bz_stream));
+     if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK) {
+          this->log(warn, "%s: bzip2 init failed\n", this->path);
+          return false;
+     }
+
+     while (result && (n = read_chunk(this)) > 0) {
+          bz.next_in = (char*)this->in;
+          bz.avail_in = n;
+          for (more = true; result && more; ) {
+               if (status == BZ_STREAM_END) {
+                    if (bz.avail_in == 0) {
+                         break;
+                    }
+                    /* concatenated bzip2 streams */
+                    BZ2_bzDecompressEnd(&bz);
+                    n = bz.avail_in;
+                    memmove(this->in, bz.next_in, n);
+                    memset(&bz, 0, sizeof(bz_stream));
+                    BZ2_bzDecompressInit(&bz, 0, 0);
+                    bz.next_in = (char*)this->in;
+                    bz.avail_in = n;
+               }
+               bz.next_out = (char*)this->buffer;
+               bz.avail_out = CHUNK_SIZE;
+               status = BZ2_bzDecompress(&bz);
+               if (status == BZ_OK || status == BZ_STREAM_END) {
+                    result = write_all(this, this->buffer, CHUNK_SIZE - bz.avail_out);
+               } else {
+                    this->log(warn, "%s: bzip2 error %d\n", this->path, status);
+                    result = false;
+               }
+               more = bz.avail_out == 0 || (status == BZ_STREAM_END && bz.avail_in > 0);
+          }
+     }
+
+     if (result && status != BZ_STREAM_END) {
+          this->log(warn, "%s: truncated bzip2 data\n", this->path);
+          result = false;
+     }
+     BZ2_bzDecompressEnd(&bz);
+     return result && n == 0;
+}
+#else
+#define inflate_bzip2 NULL
+#endif
+
+#ifdef HAVE_LZMA
+static bool_t inflate_xz(decompressor_impl_t *this) {
+     bool_t result = true;
+     lzma_stream xz = LZMA_STREAM_INIT;
+     lzma_action action = LZMA_RUN;
+     lzma_ret status = LZMA_OK;
+     ssize_t n;
+
+     if (lzma_stream_decoder(&xz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+          this->log(warn, "%s: xz init failed\n", this->path);
+          return false;
+     }
+
+     while (result && status != LZMA_STREAM_END) {
+          if (xz.avail_in == 0 && action == LZMA_RUN) {
+               n = read_chunk(this);
+               if (n < 0) {
+                    result = false;
+                    break;
+               } else if (n == 0) {
+                    action = LZMA_FINISH;
+               }
+               xz.next_in = this->in;
+               xz.avail_in = n;
+          }
+          xz.next_out = this->buffer;
+          xz.avail_out = CHUNK_SIZE;
+          status = lzma_code(&xz, action);
+          if (status == LZMA_OK || status == LZMA_STREAM_END) {
+               result = write_all(this, this->buffer, CHUNK_SIZE - xz.avail_out);
+          } else {
+               this->log(warn, "%s: xz error %d\n", this->path, (int)status);
+               result = false;
+          }
+     }
+
+     lzma_end(&xz);
+     return result;
+}
+#else
+#define inflate_xz NULL
+#endif
+
+#ifdef HAVE_ZSTD
+static bool_t inflate_zstd(decompressor_impl_t *this) {
+     bool_t result = true;
+     ZSTD_DStream *zs = ZSTD_createDStream();
+     ZSTD_inBuffer input;
+     ZSTD_outBuffer output;
+     size_t status = 0;
+     ssize_t n;
+
+     ZSTD_initDStream(zs);
+     while (result && (n = read_chunk(this)) > 0) {
+          input.src = this->in;
+          input.size = n;
+          input.pos = 0;
+          do {
+               output.dst = this->buffer;
+               output.size = CHUNK_SIZE;
+               output.pos = 0;
+               status = ZSTD_decompressStream(zs, &output, &input);
+               if (ZSTD_isError(status)) {
+                    this->log(warn, "%s: zstd error: %s\n", this->path, ZSTD_getErrorName(status));
+                    result = false;
+               } else {
+                    result = write_all(this, this->buffer, output.pos);
+               }
+          } while (result && (input.pos < input.size || output.pos == output.size));
+     }
+
+     if (result && status != 0) {
+          this->log(warn, "%s: truncated zstd data\n", this->path);
+          result = false;
+     }
+     ZSTD_freeDStream(zs);
+     return result && n == 0;
+}
+#else
+#define inflate_zstd NULL
+#endif
+
+static bool_t check_bzip2(const char *magic, size_t length) {
+     /* "BZh" may well start a text line: also check the block size and the first block (or empty stream) magic */
+     return length >= 10 && magic[3] >= '1' && magic[3] <= '9'
+          && (!memcmp(magic + 4, "1AY&SY", 6) || !memcmp(magic + 4, "\x17\x72\x45\x38\x50\x90", 6));
+}
+
+static const format_t formats[] = {
+     { "gzip",  2, "\x1f\x8b",                 NULL,        inflate_gzip  },
+     { "bzip2", 3, "BZh",                      check_bzip2, inflate_bzip2 },
+     { "xz",    6, "\xfd" "7zXZ\0",            NULL,        inflate_xz    },
+     { "zstd",  4, "\x28\xb5\x2f\xfd",         NULL,        inflate_zstd  },
+     { NULL,    0, NULL,                       NULL,        NULL          },
+};
+
+static bool_t inflate_unsupported(decompressor_impl_t *this) {
+     this->log(warn, "%s: %s compression is not supported\n", this->path, this->format->name);
+     return false;
+}
+
+static void *decompress_thread(decompressor_impl_t *this) {
+     sigset_t sigpipe;
+     /* a reader that stops early makes write() fail instead of killing the process */
+     sigemptyset(&sigpipe);
+     sigaddset(&sigpipe, SIGPIPE);
+     pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+     if (this->format->inflate == NULL) {
+          this->status = inflate_unsupported(this);
+     } else {
+          this->status = this->format->inflate(this);
+     }
+     close(this->out);
+     close(this->fd);
+     return NULL;
+}
+
+static FILE *impl_stream(decompressor_impl_t *this) {
+     return this->stream;
+}
+
+static bool_t impl_free(decompressor_impl_t *this) {
+     bool_t result;
+     fclose(this->stream);
+     pthread_join(this->thread, NULL);
+     result = this->status;
+     free(this);
+     return result;
+}
+
+static decompressor_t decompressor_impl_fn = {
+     .stream = (decompressor_stream_fn)impl_stream,
+     .free = (decompressor_free_fn)impl_free,
+};
+
+static const format_t *find_format(int fd) {
+     const format_t *format;
+     char magic[MAX_MAGIC_LENGTH];
+     ssize_t n = pread(fd, magic, MAX_MAGIC_LENGTH, 0);
+
+     if (n <= 0) {
+          return NULL;
+     }
+     for (format = formats; format->name != NULL; format++) {
+          if (n >= format->magic_length && !memcmp(magic, format->magic, format->magic_length)
+              && (format->check == NULL || format->check(magic, n))) {
+               return format;
+          }
+     }
+     return NULL;
+}
+
+bool_t is_compressed(int fd) {
+     return find_format(fd) != NULL;
+}
+
+decompressor_t *new_decompressor(logger_t log, int fd, const char *path) {
+     decompressor_impl_t *result;
+     const format_t *format = find_format(fd);
+     int fds[2];
+
+     if (format == NULL) {
+          return NULL;
+     }
+
+     log(info, "Decompressing %s file: %s\n", format->name, path);
+     if (pipe(fds) != 0) {
+          log(warn, "%s: %s\n", path, strerror(errno));
+          return NULL;
+     }
+
+     result = malloc(sizeof(decompressor_impl_t) + strlen(path) + 1);
+     result->fn = decompressor_impl_fn;
+     result->log = log;
+     result->format = format;
+     result->fd = fd;
+     result->out = fds[1];
+     result->stream = fdopen(fds[0], "r");
+     result->status = false;
+     strcpy(result->path, path);
+
+     if (pthread_create(&(result->thread), NULL, (void*(*)(void*))decompress_thread, result) != 0) {
+          log(warn, "%s: cannot start decompression thread\n", path);
+          fclose(result->stream);
+          close(result->out);
+          free(result);
+          return NULL;
+     }
+
+     return &(result->fn);
+}
@@ -0,0 +1,104 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EXP_DECOMPRESS_H__
+#define __EXP_DECOMPRESS_H__
+
+/**
+ * @file
+ * The header for decompressors.
+ */
+
+#include <stdio.h>
+
+#include "exp.h"
+#include "exp_log.h"
+
+/**
+ * @addtogroup exp_input
+ * @{
+ */
+
+/**
+ * The decompressor interface.
+ *
+ * A decompressor inflates a compressed file on a helper thread, so
+ * that decompression overlaps with parsing; the decompressed data is
+ * read from a pipe.
+ */
+typedef struct decompressor_s decompressor_t;
+
+/**
+ * Get the decompressed stream.
+ *
+ * @param[in] this the target decompressor
+ *
+ * @return the stream to read the decompressed data from
+ */
+typedef FILE *(*decompressor_stream_fn)(decompressor_t *this);
+
+/**
+ * Wait for the decompression to finish, and free the
+ * decompressor. The stream must have been read to its end.
+ *
+ * @param[in] this the target decompressor
+ *
+ * @return `true` if the decompression succeeded, `false` otherwise
+ */
+typedef bool_t (*decompressor_free_fn)(decompressor_t *this);
+
+struct decompressor_s {
+     /**
+      * @see decompressor_stream_fn
+      */
+     decompressor_stream_fn stream;
+     /**
+      * @see decompressor_free_fn
+      */
+     decompressor_free_fn free;
+};
+
+/**
+ * Create a new decompressor if the file is compressed. The
+ * compression format (gzip, bzip2, xz, zstd) is detected using the
+ * magic bytes at the start of the file.
+ *
+ * If a decompressor is returned, it takes ownership of the file
+ * descriptor; otherwise the caller keeps it.
+ *
+ * @param[in] log the logger
+ * @param[in] fd the file descriptor of the open file
+ * @param[in] path the file path
+ *
+ * @return the new decompressor, or `null` if the file is not compressed
+ */
+decompressor_t *new_decompressor(logger_t log, int fd, const char *path);
+
+/**
+ * Tell if a file is compressed, using the same magic bytes as
+ * [new_decompressor](@ref new_decompressor).
+ *
+ * @param[in] fd the file descriptor of the open file
+ *
+ * @return `true` if the file is compressed, `false` otherwise
+ */
+bool_t is_compressed(int fd);
+
+/**
+ * @}
+ */
+
+#endif /* __EXP_DECOMPRESS_H__ */
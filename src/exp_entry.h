@@ -84,23 +84,40 @@ typedef int (*entry_second_fn)(entry_t *this);
 
 /**
  * @param[in] this the target entry
- * @return the host of the entry
+ * @return the host of the entry; it may be a buffer of the thread, only
+ * valid until the next call of `host` (on any entry), so it must be
+ * copied to be kept
  */
 typedef const char *(*entry_host_fn)(entry_t *this);
 
 /**
  * @param[in] this the target entry
- * @return the daemon of the entry
+ * @return the daemon of the entry; it may be a buffer of the thread, only
+ * valid until the next call of `daemon` (on any entry), so it must be
+ * copied to be kept
  */
 typedef const char *(*entry_daemon_fn)(entry_t *this);
 
 /**
  * @param[in] this the target entry
- * @return the logline of the entry
+ * @return the logline of the entry; it may be a buffer of the thread, only
+ * valid until the next call of `logline` (on any entry), so it must be
+ * copied to be kept
  */
 typedef const char *(*entry_logline_fn)(entry_t *this);
 
-struct entry_s {
+/**
+ * Free the entry
+ *
+ * @param[in] this the target entry
+ */
+typedef void (*entry_free_fn)(entry_t *this);
+
+/**
+ * The operations of an entry; all the entries of the same kind share one
+ * table.
+ */
+typedef struct {
      /**
       * @see entry_get_name_fn
       */
@@ -141,6 +158,17 @@ struct entry_s {
       * @see entry_logline_fn
       */
      entry_logline_fn logline;
+     /**
+      * @see entry_free_fn
+      */
+     entry_free_fn    free   ;
+} entry_ops_t;
+
+struct entry_s {
+     /**
+      * The operations of the entry
+      */
+     const entry_ops_t *ops;
 };
 
 /**
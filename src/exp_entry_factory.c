@@ -21,6 +21,7 @@
  * This file contains the implementation of the entry factories.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <cad_array.h>
 #include <cad_hash.h>
@@ -29,6 +30,8 @@
 #include "exp_log.h"
 
 #define DEFAULT_CAPACITY 16
+#define MIXED_FACTORY "mixed"
+#define MIXED_FALLBACK_FACTORY "raw"
 
 static cad_array_t *factories_list = NULL;
 static cad_hash_t  *factories_map  = NULL;
@@ -41,6 +44,14 @@ static int compare_factories(entry_factory_t **f1, entry_factory_t **f2) {
      return result;
 }
 
+void init_entry_scratch(entry_scratch_t *scratch) {
+     scratch->match = new_match();
+}
+
+void clean_entry_scratch(entry_scratch_t *scratch) {
+     scratch->match->ops->free(scratch->match);
+}
+
 void sort_factories(logger_t log) {
      int i, n;
      entry_factory_t *f;
@@ -78,3 +89,160 @@ entry_factory_t *entry_factory(int index) {
 entry_factory_t *entry_factory_named(const char *name) {
      return factories_map->get(factories_map, name);
 }
+
+uint64_t entry_factories_signature(bool_t mixed) {
+     uint64_t result = mixed ? hash_bytes(HASH_INIT, MIXED_FACTORY, strlen(MIXED_FACTORY) + 1) : HASH_INIT, signature;
+     int i, n = entry_factories_length();
+     entry_factory_t *factory;
+     for (i = 0; i < n; i++) {
+          factory = entry_factory(i);
+          signature = factory->signature(factory);
+          result = hash_bytes(result, &signature, sizeof(uint64_t));
+     }
+     return result;
+}
+
+/*
+ * The mixed factory: the factories are tried in priority order, but
+ * only the ones with candidate patterns. The candidates are given by
+ * one regexp set of the patterns of all the factories, which scans the
+ * line once.
+ */
+
+#define STACK_CANDIDATES 64
+
+typedef struct {
+     entry_factory_t fn;
+     logger_t log;
+     int count;
+     entry_factory_t **factories;
+     int *offsets;
+     regexp_set_t *regexps;
+     entry_factory_t *fallback;
+} mixed_factory_t;
+
+static const char *mixed_get_name(mixed_factory_t *this) {
+     return MIXED_FACTORY;
+}
+
+static int mixed_priority(mixed_factory_t *this) {
+     return 0;
+}
+
+static bool_t mixed_tally_logic(mixed_factory_t *this, size_t tally, size_t tally_threshold, size_t max_sample_lines) {
+     return true;
+}
+
+/*
+ * Returns the index of the factory that understands the line, and
+ * sets the pattern it matched; -1 if no factory understands the line.
+ */
+static int mixed_dispatch_(mixed_factory_t *this, line_t *line, const char *candidates, int *pattern, entry_scratch_t *scratch) {
+     entry_factory_t *factory;
+     int f, i;
+
+     for (f = 0; f < this->count; f++) {
+          for (i = this->offsets[f]; i < this->offsets[f + 1] && !candidates[i]; i++);
+          if (i < this->offsets[f + 1]) {
+               factory = this->factories[f];
+               *pattern = factory->is_type(factory, line, candidates + this->offsets[f], scratch);
+               if (*pattern >= 0) {
+                    return f;
+               }
+          }
+     }
+     return -1;
+}
+
+static int mixed_dispatch(mixed_factory_t *this, line_t *line, const char *candidates, int *pattern, entry_scratch_t *scratch) {
+     char stack[STACK_CANDIDATES];
+     char *buffer;
+     int result, n;
+
+     if (candidates != NULL) {
+          return mixed_dispatch_(this, line, candidates, pattern, scratch);
+     }
+     n = this->offsets[this->count];
+     buffer = n <= STACK_CANDIDATES ? stack : malloc(n);
+     this->regexps->candidates(this->regexps, line->buffer, line->length, buffer);
+     result = mixed_dispatch_(this, line, buffer, pattern, scratch);
+     if (buffer != stack) {
+          free(buffer);
+     }
+     return result;
+}
+
+static int mixed_is_type(mixed_factory_t *this, line_t *line, const char *candidates, entry_scratch_t *scratch) {
+     int pattern;
+     return mixed_dispatch(this, line, candidates, &pattern, scratch);
+}
+
+static entry_t *mixed_new_entry(mixed_factory_t *this, line_t *line, int pattern, entry_scratch_t *scratch) {
+     entry_factory_t *factory = this->fallback;
+     int f = mixed_dispatch(this, line, NULL, &pattern, scratch);
+     if (f < 0) {
+          /* as in a file where the line matches no pattern */
+          pattern = NO_PATTERN;
+     } else {
+          factory = this->factories[f];
+     }
+     return factory->new_entry(factory, line, pattern, scratch);
+}
+
+static void mixed_set_extradirs(mixed_factory_t *this, const char * const*extradirs) {
+     /* the registered factories have their own */
+}
+
+static void mixed_set_limits(mixed_factory_t *this, regexp_limits_t limits) {
+     /* the registered factories have their own */
+}
+
+static uint64_t mixed_signature(mixed_factory_t *this) {
+     return entry_factories_signature(true);
+}
+
+static int mixed_add_regexps(mixed_factory_t *this, regexp_set_t *set) {
+     int f, result = 0;
+     for (f = 0; f < this->count; f++) {
+          result += this->factories[f]->add_regexps(this->factories[f], set);
+     }
+     return result;
+}
+
+static entry_factory_t mixed_factory_fn = {
+     .get_name = (entry_factory_get_name_fn)mixed_get_name,
+     .priority = (entry_factory_priority_fn)mixed_priority,
+     .tally_logic = (entry_factory_tally_logic_fn)mixed_tally_logic,
+     .is_type = (entry_factory_is_type_fn)mixed_is_type,
+     .new_entry = (entry_factory_new_entry_fn)mixed_new_entry,
+     .set_extradirs = (entry_factory_set_extradirs_fn)mixed_set_extradirs,
+     .set_limits = (entry_factory_set_limits_fn)mixed_set_limits,
+     .signature = (entry_factory_signature_fn)mixed_signature,
+     .add_regexps = (entry_factory_add_regexps_fn)mixed_add_regexps,
+};
+
+entry_factory_t *new_mixed_factory(logger_t log) {
+     mixed_factory_t *result = malloc(sizeof(mixed_factory_t));
+     entry_factory_t *factory;
+     int f, n = entry_factories_length();
+
+     result->fn = mixed_factory_fn;
+     result->log = log;
+     result->count = 0;
+     result->factories = malloc(n * sizeof(entry_factory_t *));
+     result->offsets = malloc((n + 1) * sizeof(int));
+     result->regexps = new_regexp_set(log);
+     result->fallback = entry_factory_named(MIXED_FALLBACK_FACTORY);
+     result->offsets[0] = 0;
+     for (f = 0; f < n; f++) {
+          factory = entry_factory(f);
+          /* the fallback matches anything: it only gets the lines that no other factory understands */
+          if (factory != result->fallback) {
+               result->factories[result->count] = factory;
+               result->offsets[result->count + 1] = result->offsets[result->count] + factory->add_regexps(factory, result->regexps);
+               result->count++;
+               log(debug, "Mixed factory %2d: %s has %d patterns\n", result->count, factory->get_name(factory), result->offsets[result->count] - result->offsets[result->count - 1]);
+          }
+     }
+     return &(result->fn);
+}
@@ -24,6 +24,7 @@
 
 #include "exp_entry.h"
 #include "exp_file.h"
+#include "exp_regexp.h"
 
 /**
  * @addtogroup exp_input
@@ -65,28 +66,98 @@ typedef int (*entry_factory_priority_fn)(entry_factory_t *this);
  */
 typedef bool_t (*entry_factory_tally_logic_fn)(entry_factory_t *this, size_t tally, size_t tally_threshold, size_t max_sample_lines);
 
+/**
+ * Caller-provided working memory for
+ * [is_type](@ref entry_factory_is_type_fn) and
+ * [new_entry](@ref entry_factory_new_entry_fn), so that lines are
+ * analyzed without allocating. Each thread must use its own, prepared
+ * by init_entry_scratch() and released by clean_entry_scratch().
+ */
+typedef struct {
+     /**
+      * A line-sized buffer
+      */
+     char buffer[MAX_LINE_SIZE];
+     /**
+      * A reusable match (see new_match())
+      */
+     match_t *match;
+} entry_scratch_t;
+
 /**
  * Is the given line understandable by the factory? The answer to that question is used to set the tally.
  *
+ * Factories are reentrant: this function does not change the factory.
+ *
  * @param[in] this the target entry factory
  * @param[in] line the line to check
+ * @param[in] candidates if not `NULL`, only the patterns whose entry
+ * is non-zero are tried (see [add_regexps](@ref entry_factory_add_regexps_fn))
+ * @param[in] scratch the working memory to use
  *
- * @return `true` if the line is of a type this factory understands; `false` otherwise
+ * @return the index of the factory pattern that matches the line if
+ * the line is of a type this factory understands; -1 otherwise
+ */
+typedef int (*entry_factory_is_type_fn)(entry_factory_t *this, line_t *line, const char *candidates, entry_scratch_t *scratch);
+
+/**
+ * The pattern to give to [new_entry](@ref entry_factory_new_entry_fn)
+ * for a line that is known to match no pattern: the entry is built as
+ * for a line that matches none of the factory patterns.
  */
-typedef bool_t (*entry_factory_is_type_fn)(entry_factory_t *this, line_t *line);
+#define NO_PATTERN -2
 
 /**
  * Creates a new entry corresponding to the analysis of the given line.
  *
+ * Factories are reentrant: this function does not change the factory.
+ *
  * @param[in] this the target entry factory
  * @param[in] line the line to analyze
+ * @param[in] pattern the index of the pattern to use, as returned by
+ * [is_type](@ref entry_factory_is_type_fn), -1 to use the first
+ * pattern that matches, or [NO_PATTERN](@ref NO_PATTERN)
+ * @param[in] scratch the working memory to use
  *
  * @return the analyzed line
  */
-typedef entry_t *(*entry_factory_new_entry_fn)(entry_factory_t *this, line_t *line);
+typedef entry_t *(*entry_factory_new_entry_fn)(entry_factory_t *this, line_t *line, int pattern, entry_scratch_t *scratch);
 
 typedef void (*entry_factory_set_extradirs_fn)(entry_factory_t *this, const char * const*extradirs);
 
+/**
+ * Set the limits of the patterns of the factory, and what to do with
+ * a line on which a pattern gives up.
+ *
+ * @param[in] this the target entry factory
+ * @param[in] limits the limits
+ */
+typedef void (*entry_factory_set_limits_fn)(entry_factory_t *this, regexp_limits_t limits);
+
+/**
+ * A digest of what the factory parses lines with (e.g. its patterns
+ * and their [limits](@ref entry_factory_set_limits_fn)), to detect that
+ * the entries it would create have changed.
+ *
+ * @param[in] this the target entry factory
+ *
+ * @return the signature of the factory
+ */
+typedef uint64_t (*entry_factory_signature_fn)(entry_factory_t *this);
+
+/**
+ * Add the patterns of the factory to the regexp set, in the order of
+ * their indexes: the candidates the set computes for a line, from the
+ * index of the first added pattern, may then be given to
+ * [is_type](@ref entry_factory_is_type_fn).
+ *
+ * @param[in] this the target entry factory
+ * @param[in] set the regexp set to add the patterns to
+ *
+ * @return the number of added patterns
+ */
+typedef int (*entry_factory_add_regexps_fn)(entry_factory_t *this, regexp_set_t *set);
+
 struct entry_factory_s {
      /**
       * @see entry_factory_get_name_fn
@@ -112,6 +183,18 @@ struct entry_factory_s {
       * @see entry_factory_set_extradirs_fn
       */
      entry_factory_set_extradirs_fn set_extradirs;
+     /**
+      * @see entry_factory_set_limits_fn
+      */
+     entry_factory_set_limits_fn set_limits;
+     /**
+      * @see entry_factory_signature_fn
+      */
+     entry_factory_signature_fn signature;
+     /**
+      * @see entry_factory_add_regexps_fn
+      */
+     entry_factory_add_regexps_fn add_regexps;
 };
 
 /**
@@ -123,6 +206,20 @@ struct entry_factory_s {
  */
 void register_all_factories(logger_t log);
 
+/**
+ * Prepare the working memory of a thread.
+ *
+ * @param[out] scratch the working memory
+ */
+void init_entry_scratch(entry_scratch_t *scratch);
+
+/**
+ * Release the working memory of a thread.
+ *
+ * @param[in] scratch the working memory
+ */
+void clean_entry_scratch(entry_scratch_t *scratch);
+
 /**
  * Sort all the known priorities by descending priority and ascending name.
  *
@@ -162,6 +259,33 @@ entry_factory_t *entry_factory(int index);
  */
 entry_factory_t *entry_factory_named(const char *name);
 
+/**
+ * The combined [signature](@ref entry_factory_signature_fn) of all the
+ * registered factories.
+ *
+ * @param[in] mixed `true` if the factory is selected for each line
+ * (see [new_mixed_factory](@ref new_mixed_factory)), `false` if it is
+ * selected for each file
+ *
+ * @return the signature of the factories
+ */
+uint64_t entry_factories_signature(bool_t mixed);
+
+/**
+ * Create the factory of mixed-format files: each line is analyzed by
+ * the first registered factory (by priority) that understands it, or
+ * as an unmatched line by the "raw" factory. The patterns of all the
+ * factories are put in one [regexp set](@ref regexp_set_t), so that
+ * only the patterns that may match the line are tried.
+ *
+ * The registered factories must already know their extra directories.
+ *
+ * @param[in] log the logger
+ *
+ * @return the mixed factory
+ */
+entry_factory_t *new_mixed_factory(logger_t log);
+
 /**
  * @}
  */
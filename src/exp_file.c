@@ -25,15 +25,30 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <cad_array.h>
 
 #include "exp_file.h"
+#include "exp_arena.h"
+#include "exp_decompress.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EXP_SIMD
+#include <immintrin.h>
+#endif
+
+#define READ_BUFFER_SIZE 65536
+#define TAIL_BUFFER_SIZE (1024 * 1024)
 
 typedef struct file_impl_s file_impl_t;
 
 struct file_impl_s {
      file_t fn;
      logger_t log;
+     cad_memory_t *memory;
      size_t size;
      cad_array_t *lines;
 };
@@ -51,103 +66,512 @@ static size_t impl_size(file_impl_t *this) {
 }
 
 static void impl_free(file_impl_t *this) {
+     int i, n = this->lines->count(this->lines);
+     for (i = 0; i < n; i++) {
+          this->memory->free(*(line_t **)this->lines->get(this->lines, i));
+     }
      this->lines->free(this->lines);
-     free(this);
+     this->memory->free(this);
 }
 
-static file_t file_impl_fn = {
+static const file_ops_t file_impl_ops = {
      .lines_count = (file_lines_count_fn)impl_lines_count,
      .line = (file_line_fn)impl_line,
      .size = (file_size_fn)impl_size,
      .free = (file_free_fn)impl_free,
 };
 
+typedef struct file_mmap_s file_mmap_t;
+
+struct file_mmap_s {
+     file_t fn;
+     logger_t log;
+     size_t size;
+     char *map;
+     size_t map_length;
+     size_t count;
+     size_t capacity;
+     line_t *lines;
+};
+
+static size_t mmap_lines_count(file_mmap_t *this) {
+     return this->count;
+}
+
+static line_t *mmap_line(file_mmap_t *this, int index) {
+     return this->lines + index;
+}
+
+static size_t mmap_size(file_mmap_t *this) {
+     return this->size;
+}
+
+static void mmap_free(file_mmap_t *this) {
+     if (this->map != NULL) {
+          munmap(this->map, this->map_length);
+     }
+     free(this->lines);
+     free(this);
+}
+
+static const file_ops_t file_mmap_ops = {
+     .lines_count = (file_lines_count_fn)mmap_lines_count,
+     .line = (file_line_fn)mmap_line,
+     .size = (file_size_fn)mmap_size,
+     .free = (file_free_fn)mmap_free,
+};
+
 line_t *new_line(size_t length, const char *content) {
-     line_t *result = malloc(sizeof(line_t) + length + 1);
-     char *line = (char*)result->buffer;
+     line_t *result = current_memory()->malloc(sizeof(line_t) + length + 1);
+     char *line = (char*)(result + 1);
      result->length = length;
-     memcpy(line, content, length + 1);
+     result->buffer = line;
+     memcpy(line, content, length);
      line[length] = '\0';
      return result;
 }
 
-static void read_all_lines(file_impl_t *this, FILE *in) {
-     static char buffer[MAX_LINE_SIZE];
-     static char linebuf[MAX_LINE_SIZE];
+/**
+ * Find the end of the line starting at `buffer`.
+ *
+ * @return the position of the next newline, or `end` if there is none
+ */
+typedef const char *(*find_eol_fn)(const char *buffer, const char *end);
+
+static const char *find_eol_scalar(const char *buffer, const char *end) {
+     const char *result = memchr(buffer, '\n', end - buffer);
+     return result == NULL ? end : result;
+}
+
+#ifdef EXP_SIMD
+
+__attribute__((target("sse2")))
+static const char *find_eol_sse2(const char *buffer, const char *end) {
+     const __m128i newline = _mm_set1_epi8('\n');
+     int mask;
+     while (end - buffer >= 16) {
+          mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)buffer), newline));
+          if (mask != 0) {
+               return buffer + __builtin_ctz(mask);
+          }
+          buffer += 16;
+     }
+     return find_eol_scalar(buffer, end);
+}
+
+__attribute__((target("avx2")))
+static const char *find_eol_avx2(const char *buffer, const char *end) {
+     const __m256i newline = _mm256_set1_epi8('\n');
+     unsigned int mask;
+     while (end - buffer >= 32) {
+          mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)buffer), newline));
+          if (mask != 0) {
+               return buffer + __builtin_ctz(mask);
+          }
+          buffer += 32;
+     }
+     return find_eol_sse2(buffer, end);
+}
+
+#endif
+
+static find_eol_fn find_eol_impl = find_eol_scalar;
 
-     line_t *line = NULL;
+#ifdef EXP_SIMD
 
+/* selected once at startup, not on every line */
+__attribute__((constructor))
+static void select_find_eol(void) {
+     __builtin_cpu_init();
+     if (__builtin_cpu_supports("avx2")) {
+          find_eol_impl = find_eol_avx2;
+     } else if (__builtin_cpu_supports("sse2")) {
+          find_eol_impl = find_eol_sse2;
+     }
+}
+
+#endif
+
+static size_t read_lines(logger_t log, FILE *in, line_iterator_fn iterator, void *data) {
+     char buffer[READ_BUFFER_SIZE];
+     char linebuf[MAX_LINE_SIZE];
+
+     line_t line;
+
+     const char *start, *end, *eol;
      size_t buffer_length;
+     size_t run;
      size_t line_length = 0;
-     size_t buffer_index;
      bool_t line_too_long_flag = false;
      size_t count_lines_too_long = 0;
-     int count = 0;
-
-     this->lines = cad_new_array(stdlib_memory, sizeof(line_t *));
-     this->size = 0;
-
-     while ((buffer_length = fread(buffer, 1, MAX_LINE_SIZE, in)) > 0) {
-          for (buffer_index = 0; buffer_index < buffer_length; buffer_index++) {
-               if (buffer[buffer_index] == '\n') {
-                    line = new_line(line_length, linebuf);
-                    this->lines->insert(this->lines, count++, &line);
-                    this->size += line_length;
-                    line_length = 0;
-                    line_too_long_flag = false;
-               } else if (line_length >= MAX_LINE_SIZE) {
-                    if (!line_too_long_flag) {
-                         this->log(info, "Truncating line %lu\n", (unsigned long)count);
-                         count_lines_too_long++;
-                         line_too_long_flag = true;
-                         linebuf[MAX_LINE_SIZE - 1] = '\0';
-                    }
+     size_t count = 0;
+
+     while ((buffer_length = fread(buffer, 1, READ_BUFFER_SIZE, in)) > 0) {
+          end = buffer + buffer_length;
+          for (start = buffer; start < end; start = eol + 1) {
+               eol = find_eol_impl(start, end);
+               run = eol - start;
+               if (line_length == 0 && eol < end && run < MAX_LINE_SIZE) {
+                    /* the whole line is in the buffer: no copy */
+                    line.buffer = start;
+                    line.length = run;
                } else {
-                    linebuf[line_length++] = buffer[buffer_index];
+                    if (line_length + run >= MAX_LINE_SIZE) {
+                         if (!line_too_long_flag) {
+                              log(info, "Truncating line %lu\n", (unsigned long)count);
+                              count_lines_too_long++;
+                              line_too_long_flag = true;
+                         }
+                         run = MAX_LINE_SIZE - 1 - line_length;
+                    }
+                    memcpy(linebuf + line_length, start, run);
+                    line_length += run;
+                    if (eol == end) {
+                         /* the line continues in the next buffer */
+                         break;
+                    }
+                    line.buffer = linebuf;
+                    line.length = line_length;
                }
+               iterator(&line, data);
+               count++;
+               line_length = 0;
+               line_too_long_flag = false;
           }
      }
 
      if (ferror(in)) {
-          this->log(warn, "Error during read: %s\n", strerror(errno));
+          log(warn, "Error during read: %s\n", strerror(errno));
      } else if (line_length > 0) {
-          line = new_line(line_length, linebuf);
-          this->lines->insert(this->lines, count++, &line);
-          this->size += line_length;
+          line.buffer = linebuf;
+          line.length = line_length;
+          iterator(&line, data);
+          count++;
      }
 
-     this->size += count; /* count 1 per EOL */
+     if (count_lines_too_long > 0) {
+          log(warn, "%lu line%s too long, truncated to %d characters\n", (unsigned long)count_lines_too_long, count_lines_too_long > 1 ? "s" : "", MAX_LINE_SIZE - 1);
+     }
+     log(debug, "Read %lu line%s\n", (unsigned long)count, count > 1 ? "s" : "");
+     return count;
+}
+
+static size_t map_lines(logger_t log, const char *map, size_t length, line_iterator_fn iterator, void *data) {
+     const char *buffer = map;
+     const char *end = buffer + length;
+     const char *eol;
+     line_t line;
+     size_t count_lines_too_long = 0;
+     size_t count = 0;
+
+     while (buffer < end) {
+          eol = find_eol_impl(buffer, end);
+          line.buffer = buffer;
+          line.length = eol - buffer;
+          if (line.length >= MAX_LINE_SIZE) {
+               log(info, "Truncating line %lu\n", (unsigned long)count);
+               count_lines_too_long++;
+               line.length = MAX_LINE_SIZE - 1;
+          }
+          iterator(&line, data);
+          count++;
+          buffer = eol + 1;
+     }
 
      if (count_lines_too_long > 0) {
-          this->log(warn, "%lu line%s too long, truncated to %d characters\n", (unsigned long)count_lines_too_long, count_lines_too_long > 1 ? "s" : "", MAX_LINE_SIZE - 1);
+          log(warn, "%lu line%s too long, truncated to %d characters\n", (unsigned long)count_lines_too_long, count_lines_too_long > 1 ? "s" : "", MAX_LINE_SIZE - 1);
+     }
+     log(debug, "Mapped %lu line%s\n", (unsigned long)count, count > 1 ? "s" : "");
+     return count;
+}
+
+static void impl_add_line(line_t *line, file_impl_t *this) {
+     line_t *copy = new_line(line->length, line->buffer);
+     this->lines->insert(this->lines, this->lines->count(this->lines), &copy);
+     this->size += line->length;
+}
+
+static void mmap_add_line(line_t *line, file_mmap_t *this) {
+     if (this->count == this->capacity) {
+          this->capacity = this->capacity * 2 + 16;
+          this->lines = realloc(this->lines, this->capacity * sizeof(line_t));
+     }
+     this->lines[this->count++] = *line;
+     this->size += line->length;
+}
+
+static file_t *new_file_mmap(logger_t log, int fd, size_t length) {
+     file_mmap_t *result;
+     void *map = NULL;
+
+     if (length > 0) {
+          map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (map == MAP_FAILED) {
+               log(info, "Cannot map file: %s\n", strerror(errno));
+               return NULL;
+          }
+     }
+
+     result = malloc(sizeof(file_mmap_t));
+     result->fn.ops = &file_mmap_ops;
+     result->log = log;
+     result->map = map;
+     result->map_length = length;
+     result->capacity = length / 64 + 16;
+     result->lines = malloc(result->capacity * sizeof(line_t));
+     result->count = 0;
+     result->size = 0;
+     map_lines(log, map, length, (line_iterator_fn)mmap_add_line, result);
+     result->size += result->count; /* count 1 per EOL */
+
+     return &(result->fn);
+}
+
+static file_t *new_file_buffered(logger_t log, FILE *in) {
+     cad_memory_t *memory = current_memory();
+     file_impl_t *result = memory->malloc(sizeof(file_impl_t));
+     result->fn.ops = &file_impl_ops;
+     result->log = log;
+     result->memory = memory;
+     result->lines = cad_new_array(*memory, sizeof(line_t *));
+     result->size = 0;
+     result->size += read_lines(log, in, (line_iterator_fn)impl_add_line, result); /* count 1 per EOL */
+     return &(result->fn);
+}
+
+/*
+ * Check how the decompression went. A file that looks compressed but
+ * cannot be decoded at all is read as plain text instead (returns
+ * true); a file that fails after some data keeps the lines read so far.
+ */
+static bool_t read_as_plain(logger_t log, level_t error_level, const char *path, decompressor_t *decompressor, size_t count) {
+     if (decompressor->free(decompressor)) {
+          return false;
+     }
+     if (count == 0) {
+          log(error_level, "Cannot decompress, reading as plain text: %s\n", path);
+          return true;
      }
-     this->log(debug, "Read %lu line%s\n", (unsigned long)count, count > 1 ? "s" : "");
+     log(error_level, "Incomplete compressed data, only %lu line%s read: %s\n", (unsigned long)count, count > 1 ? "s" : "", path);
+     return false;
+}
+
+static int open_file(logger_t log, level_t error_level, const char *path, struct stat *st) {
+     int result = open(path, O_RDONLY);
+     if (result < 0) {
+          log(error_level, "%s: %s\n", strerror(errno), path);
+     } else if (fstat(result, st) != 0) {
+          st->st_mode = 0;
+     }
+     return result;
+}
+
+/*
+ * Scan the complete lines after the offset with pread(), not mmap(): a
+ * followed file may be truncated or rotated during the scan, and
+ * reading a mapped page past its end kills the process (SIGBUS).
+ */
+static bool_t scan_tail(logger_t log, level_t error_level, const char *path, int fd, size_t *offset, line_iterator_fn iterator, void *data) {
+     char *buffer = malloc(TAIL_BUFFER_SIZE);
+     size_t length = 0, end, position = *offset;
+     ssize_t n;
+
+     while ((n = pread(fd, buffer + length, TAIL_BUFFER_SIZE - length, position)) != 0) {
+          if (n < 0) {
+               if (errno == EINTR) {
+                    continue;
+               }
+               log(error_level, "%s: %s\n", strerror(errno), path);
+               free(buffer);
+               return false;
+          }
+          position += n;
+          length += n;
+          for (end = length; end > 0 && buffer[end - 1] != '\n'; end--) {
+               /* an unterminated last line is not complete yet */
+          }
+          if (end > 0) {
+               map_lines(log, buffer, end, iterator, data);
+               length -= end;
+               memmove(buffer, buffer + end, length);
+               *offset = position - length;
+          } else if (length > MAX_LINE_SIZE) {
+               /* the line will be truncated anyway */
+               length = MAX_LINE_SIZE;
+          }
+     }
+
+     free(buffer);
+     return true;
+}
+
+bool_t scan_file_from(logger_t log, level_t error_level, const char *path, size_t *offset, line_iterator_fn iterator, void *data) {
+     decompressor_t *decompressor;
+     struct stat st;
+     size_t count;
+     bool_t result;
+     int fd;
+
+     if (!strcmp("-", path)) {
+          *offset = 0;
+          return scan_file(log, error_level, path, iterator, data);
+     }
+
+     fd = open_file(log, error_level, path, &st);
+     if (fd < 0) {
+          return false;
+     }
+
+     if (!S_ISREG(st.st_mode)) {
+          close(fd);
+          *offset = 0;
+          return scan_file(log, error_level, path, iterator, data);
+     }
+
+     if (*offset == (size_t)st.st_size) {
+          log(info, "No new data: %s\n", path);
+          close(fd);
+          return true;
+     }
+     if (*offset > (size_t)st.st_size) {
+          /* its lines were already counted: reading it again is up to the caller */
+          log(error_level, "File shorter than already read, not scanned: %s\n", path);
+          close(fd);
+          return false;
+     }
+
+     if (*offset > 0 && is_compressed(fd)) {
+          log(error_level, "Compressed file changed, cannot resume it: %s\n", path);
+          close(fd);
+          *offset = (size_t)st.st_size;
+          return false;
+     }
+
+     decompressor = new_decompressor(log, fd, path);
+     if (decompressor != NULL) {
+          log(info, "Scanning file: %s\n", path);
+          count = read_lines(log, decompressor->stream(decompressor), iterator, data);
+          if (!read_as_plain(log, error_level, path, decompressor, count)) {
+               *offset = (size_t)st.st_size;
+               return true;
+          }
+          *offset = 0;
+          fd = open_file(log, error_level, path, &st);
+          if (fd < 0) {
+               return false;
+          }
+     }
+
+     log(info, "Scanning file: %s from offset %lu\n", path, (unsigned long)*offset);
+     result = scan_tail(log, error_level, path, fd, offset, iterator, data);
+     close(fd);
+
+     return result;
 }
 
 file_t *new_file(logger_t log, level_t error_level, const char *path) {
-     file_impl_t *result = malloc(sizeof(file_impl_t));
+     file_t *result = NULL;
+     decompressor_t *decompressor;
+     struct stat st;
      FILE *in;
+     int fd;
 
      if (!strcmp("-", path)) {
-          in = stdin;
           log(info, "Reading stdin\n");
-     } else {
-          in = fopen(path, "r");
+          return new_file_buffered(log, stdin);
+     }
+
+     fd = open_file(log, error_level, path, &st);
+     if (fd < 0) {
+          return NULL;
+     }
+     log(info, "Reading file: %s\n", path);
+
+     decompressor = new_decompressor(log, fd, path);
+     if (decompressor != NULL) {
+          result = new_file_buffered(log, decompressor->stream(decompressor));
+          if (!read_as_plain(log, error_level, path, decompressor, result->ops->lines_count(result))) {
+               return result;
+          }
+          result->ops->free(result);
+          result = NULL;
+          fd = open_file(log, error_level, path, &st);
+          if (fd < 0) {
+               return NULL;
+          }
+     }
+
+     if (S_ISREG(st.st_mode)) {
+          result = new_file_mmap(log, fd, st.st_size);
+     }
+
+     if (result == NULL) {
+          in = fdopen(fd, "r");
           if (!in) {
                log(error_level, "%s: %s\n", strerror(errno), path);
-               free(result);
+               close(fd);
                return NULL;
           }
-          log(info, "Reading file: %s\n", path);
+          result = new_file_buffered(log, in);
+          fclose(in);
+     } else {
+          close(fd);
      }
 
-     result->fn = file_impl_fn;
-     result->log = log;
-     read_all_lines(result, in);
+     return result;
+}
+
+bool_t scan_file(logger_t log, level_t error_level, const char *path, line_iterator_fn iterator, void *data) {
+     decompressor_t *decompressor;
+     struct stat st;
+     void *map = MAP_FAILED;
+     size_t count;
+     FILE *in;
+     int fd;
+
+     if (!strcmp("-", path)) {
+          log(info, "Scanning stdin\n");
+          read_lines(log, stdin, iterator, data);
+          return true;
+     }
+
+     fd = open_file(log, error_level, path, &st);
+     if (fd < 0) {
+          return false;
+     }
+     log(info, "Scanning file: %s\n", path);
 
-     if (in != stdin) {
+     decompressor = new_decompressor(log, fd, path);
+     if (decompressor != NULL) {
+          count = read_lines(log, decompressor->stream(decompressor), iterator, data);
+          if (!read_as_plain(log, error_level, path, decompressor, count)) {
+               return true;
+          }
+          fd = open_file(log, error_level, path, &st);
+          if (fd < 0) {
+               return false;
+          }
+     }
+
+     if (S_ISREG(st.st_mode) && st.st_size > 0) {
+          map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+     }
+
+     if (map != MAP_FAILED) {
+          close(fd);
+          madvise(map, st.st_size, MADV_SEQUENTIAL);
+          map_lines(log, map, st.st_size, iterator, data);
+          munmap(map, st.st_size);
+     } else {
+          in = fdopen(fd, "r");
+          if (!in) {
+               log(error_level, "%s: %s\n", strerror(errno), path);
+               close(fd);
+               return false;
+          }
+          read_lines(log, in, iterator, data);
           fclose(in);
      }
 
-     return &(result->fn);
+     return true;
 }
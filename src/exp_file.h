@@ -34,6 +34,11 @@
 
 /**
  * The line structure.
+ *
+ * A line is a view on some text: either a buffer of its own (see
+ * [new_line](@ref new_line)) or a part of a memory-mapped file. In the
+ * latter case the content is *not* `\0`-terminated; always use the
+ * `length`.
  */
 typedef struct line_s line_t;
 
@@ -45,7 +50,7 @@ struct line_s {
      /**
       * The line content
       */
-     const char buffer[0];
+     const char *buffer;
 };
 
 /**
@@ -88,7 +93,11 @@ typedef line_t *(*file_line_fn)(file_t *this, int index);
  */
 typedef void (*file_free_fn)(file_t *this);
 
-struct file_s {
+/**
+ * The operations of a file; all the files of the same kind share one
+ * table.
+ */
+typedef struct {
      /**
       * @see file_lines_count_fn
       */
@@ -105,11 +114,21 @@ struct file_s {
       * @see file_free_fn
       */
      file_free_fn free;
+} file_ops_t;
+
+struct file_s {
+     /**
+      * The operations of the file
+      */
+     const file_ops_t *ops;
 };
 
 /**
  * Create a new file
  *
+ * Regular files are memory-mapped and their lines are views into the
+ * mapping; other files (stdin, pipes...) are read into memory.
+ *
  * @param[in] log the logger
  * @param[in] error_level the level to log file errors
  * @param[in] path the file path
@@ -119,7 +138,51 @@ struct file_s {
 file_t *new_file(logger_t log, level_t error_level, const char *path);
 
 /**
- * Create a new line. The `content` is copied to the line buffer.
+ * Called by [scan_file](@ref scan_file) for each line of the file.
+ *
+ * @param[in] line the line; it is only valid during the call
+ * @param[in] data the data given to `scan_file`
+ */
+typedef void (*line_iterator_fn)(line_t *line, void *data);
+
+/**
+ * Read a file line by line without keeping the lines in memory.
+ *
+ * @param[in] log the logger
+ * @param[in] error_level the level to log file errors
+ * @param[in] path the file path
+ * @param[in] iterator the function called for each line
+ * @param[in] data the data given to the iterator
+ *
+ * @return `true` if the file was read, `false` on error
+ */
+bool_t scan_file(logger_t log, level_t error_level, const char *path, line_iterator_fn iterator, void *data);
+
+/**
+ * Read the lines of a file appended since a previous scan.
+ *
+ * Regular files are read from `offset` up to their last newline: an
+ * unterminated last line is left for the next scan. A file shorter
+ * than `offset` is not read: the caller decides whether to read it
+ * again from the start. Compressed files cannot be resumed: one that
+ * changed after a previous scan is not read again. Other files (stdin,
+ * pipes...) are always read from the start.
+ *
+ * @param[in] log the logger
+ * @param[in] error_level the level to log file errors
+ * @param[in] path the file path
+ * @param[in,out] offset the offset to start at (0 to read the whole file); set to the offset to resume the next scan at
+ * @param[in] iterator the function called for each line
+ * @param[in] data the data given to the iterator
+ *
+ * @return `true` if the file was read, `false` on error or if it could not be resumed
+ */
+bool_t scan_file_from(logger_t log, level_t error_level, const char *path, size_t *offset, line_iterator_fn iterator, void *data);
+
+/**
+ * Create a new line. The `content` is copied to the line buffer,
+ * which is `\0`-terminated. The line is allocated with the
+ * [current memory](@ref current_memory).
  *
  * @param[in] length the length of the line
  * @param[in] content the content of the line
@@ -53,24 +53,51 @@ struct filter_impl_s {
      logger_t log;
      cad_array_t *replacements;
      const char * const*extradirs;
+     regexp_limits_t limits;
 };
 
-static const char *impl_scrub(filter_impl_t *this, const char *line) {
-     static char result[MAX_LINE_SIZE];
+/*
+ * Each stopword reads the result of the previous one and writes to the
+ * other buffer.
+ */
+static const char *impl_scrub(filter_impl_t *this, const char *line, char *buffer) {
      int i, n = this->replacements->count(this->replacements);
      filter_replacement_t *repl;
+     char other[MAX_LINE_SIZE];
+     char *buffers[2] = { buffer, other };
+     const char *string = line;
+     int line_length = strlen(line), length, result, out = 0;
 
-     strncpy(result, line, MAX_LINE_SIZE);
-     result[MAX_LINE_SIZE-1] = '\0';
+     if (line_length >= MAX_LINE_SIZE) {
+          line_length = MAX_LINE_SIZE - 1;
+     }
+     length = line_length;
      for (i = 0; i < n; i++) {
           repl = *(filter_replacement_t**)this->replacements->get(this->replacements, i);
-          repl->stopword->replace_all(repl->stopword, repl->replacement, result);
+          result = repl->stopword->replace_all(repl->stopword, repl->replacement, string, length, buffers[out], MAX_LINE_SIZE);
+          if (result < 0) {
+               if (this->limits.action == limit_raw) {
+                    string = line;
+                    length = line_length;
+                    break;
+               }
+               /* the buffer is partly replaced: keep the previous one, as if the pattern did not match */
+               continue;
+          }
+          string = buffers[out];
+          length = result;
+          out = 1 - out;
      }
-     return result;
+     if (string != buffer) {
+          memcpy(buffer, string, length);
+          buffer[length] = '\0';
+     }
+     return buffer;
 }
 
 static bool_t impl_bleach(filter_impl_t *this, const char *line) {
-     const char *scrubbed = impl_scrub(this, line);
+     char buffer[MAX_LINE_SIZE];
+     const char *scrubbed = impl_scrub(this, line, buffer);
      return !strcmp("#", scrubbed);
 }
 
@@ -138,7 +165,7 @@ static bool_t impl_extend_(filter_impl_t *this, const char *dir, const char *fil
      line_t *line;
      regexp_t *regexp;
      bool_t has_replacement = replacement != NULL;
-     static char re_[MAX_LINE_SIZE];
+     char re_[MAX_LINE_SIZE];
      char *re;
      int i, j, n;
 
@@ -146,19 +173,18 @@ static bool_t impl_extend_(filter_impl_t *this, const char *dir, const char *fil
      file = new_file(this->log, debug, path);
      if (file != NULL) {
           result = true;
-          n = file->lines_count(file);
+          n = file->ops->lines_count(file);
           for (i = 0; i < n; i++) {
-               line = file->line(file, i);
-               if (has_replacement) {
-                    re = (char*)line->buffer;
-               } else {
-                    strncpy(re_, line->buffer, line->length);
+               line = file->ops->line(file, i);
+               memcpy(re_, line->buffer, line->length);
+               re_[line->length] = '\0';
+               re = re_;
+               if (!has_replacement) {
                     j = line->length - 1;
                     while(j >= 0 && re_[j] == ' ') {
                          j--;
                     }
                     re_[j+1] = '\0';
-                    re = re_;
                     replacement = split(&re);
                     if (replacement == NULL) {
                          replacement = "#";
@@ -167,11 +193,12 @@ static bool_t impl_extend_(filter_impl_t *this, const char *dir, const char *fil
                if (re[0] != '\0') {
                     regexp = new_regexp(this->log, re, 0);
                     if (regexp != NULL) {
+                         regexp->limit(regexp, this->limits.match, this->limits.depth);
                          add_regexp(this, regexp, replacement);
                     }
                }
           }
-          file->free(file);
+          file->ops->free(file);
      }
      free(path);
 
@@ -201,13 +228,14 @@ static filter_t filter_impl_fn = {
      .bleach = (filter_bleach_fn)impl_bleach,
 };
 
-filter_t *new_filter(logger_t log, const char * const*extradirs) {
+filter_t *new_filter(logger_t log, const char * const*extradirs, regexp_limits_t limits) {
      filter_impl_t *result = malloc(sizeof(filter_impl_t));
 
      result->fn = filter_impl_fn;
      result->log = log;
      result->replacements = cad_new_array(stdlib_memory, sizeof(filter_replacement_t*));
      result->extradirs = extradirs;
+     result->limits = limits;
 
      return &(result->fn);
 }
@@ -25,6 +25,7 @@
 #include "exp.h"
 #include "exp_log.h"
 #include "exp_entry.h"
+#include "exp_regexp.h"
 
 /**
  * @addtogroup exp_output
@@ -57,14 +58,20 @@ typedef void (*filter_extend_fn)(filter_t *this, const char *filename, const cha
  * Scrub patterns out of the given line, replacing them by their
  * respective replacements (see [extend](@ref filter_extend_fn)).
  *
- * The returned string is a static buffer.
+ * The line is copied to the caller-provided buffer, which is then
+ * scrubbed; the line is truncated if it is longer than the buffer.
+ * If a pattern gives up on its limits, the line is kept as is when
+ * the limit action is `limit_raw`; else the pattern is skipped: the
+ * line is left as the previous patterns made it, without the
+ * replacements made before the limit.
  *
  * @param[in] this the target filter
  * @param[in] line the line to scrub
+ * @param[out] buffer the buffer to write the scrubbed line to, at least `MAX_LINE_SIZE` long; it must not overlap the line
  *
- * @return the scrubbed line
+ * @return the scrubbed line, i.e. the buffer
  */
-typedef const char *(*filter_scrub_fn)(filter_t *this, const char *line);
+typedef const char *(*filter_scrub_fn)(filter_t *this, const char *line, char *buffer);
 
 /**
  * See if the line can be reduced to nothing by intensive [scrubbing](@ref filter_scrub_fn)
@@ -96,10 +103,11 @@ struct filter_s {
  *
  * @param[in] log the logger
  * @param[in] extradirs extra directories to scan
+ * @param[in] limits the limits of the patterns
  *
  * @return the new filter
  */
-filter_t *new_filter(logger_t log, const char * const*extradirs);
+filter_t *new_filter(logger_t log, const char * const*extradirs, regexp_limits_t limits);
 
 /**
  * @}
@@ -47,11 +47,16 @@ struct fingerprint_impl_s {
      input_t *input;
      output_t *output;
      const char * const*extradirs;
+     bool_t prepared;
 };
 
 static void fingerprint_impl_run(fingerprint_impl_t *this, void *output) {
      int i, n = this->input->files_length(this->input);
-     this->output->prepare(this->output);
+     if (!this->prepared) {
+          /* the fingerprints do not change when run again in follow mode */
+          this->output->prepare(this->output);
+          this->prepared = true;
+     }
      for (i = 0; i < n; i++) {
           this->output->fingerprint_file(this->output, i, output);
      }
@@ -124,6 +129,7 @@ fingerprint_t *new_fingerprint(logger_t log, options_t output_options) {
      result->log = log;
      result->input = new_input(log);
      result->extradirs = output_options.fingerprint_extradirs;
+     result->prepared = false;
      prepare_input(result);
      result->output = new_output_hash(log, result->input);
      result->output->set_options(result->output, options);
@@ -0,0 +1,175 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @ingroup exp_output
+ * @file
+ *
+ * This file contains the implementation of the follow mode.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define WATCH_EVENTS (IN_MODIFY | IN_CREATE | IN_MOVED_TO)
+#endif
+
+#include "exp_follow.h"
+
+#define CLEAR_SCREEN "\033[H\033[J"
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_interrupt(int sig) {
+     interrupted = 1;
+}
+
+static void catch_interrupts(void) {
+     struct sigaction action;
+     memset(&action, 0, sizeof(struct sigaction));
+     action.sa_handler = on_interrupt;
+     sigemptyset(&action.sa_mask);
+     /* no SA_RESTART: the wait must be interrupted */
+     sigaction(SIGINT, &action, NULL);
+     sigaction(SIGTERM, &action, NULL);
+}
+
+/*
+ * The directories of the files are watched rather than the files
+ * themselves, to also see the files that replace them.
+ */
+static int watch_files(logger_t log, input_t *input) {
+     int result = -1;
+#ifdef __linux__
+     input_file_t *file;
+     char *path;
+     int i, n = input->files_length(input);
+
+     result = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+     if (result < 0) {
+          log(warn, "Cannot watch files, polling them: %s\n", strerror(errno));
+          return -1;
+     }
+     for (i = 0; i < n; i++) {
+          file = input->file(input, i);
+          if (strcmp("-", file->ops->get_name(file))) {
+               path = strdup(file->ops->get_name(file));
+               if (inotify_add_watch(result, dirname(path), WATCH_EVENTS) < 0) {
+                    log(warn, "Cannot watch %s: %s\n", file->ops->get_name(file), strerror(errno));
+               }
+               free(path);
+          }
+     }
+#endif
+     return result;
+}
+
+/*
+ * Wait for a change in the watched directories, or for the timeout;
+ * the events themselves are dropped: all the files are checked anyway.
+ */
+static void wait_changes(int fd, int timeout) {
+     struct pollfd pfd = { .fd = fd, .events = POLLIN };
+     char buffer[4096];
+     if (fd < 0) {
+          poll(NULL, 0, timeout);
+     } else if (poll(&pfd, 1, timeout) > 0) {
+          while (read(fd, buffer, sizeof(buffer)) > 0) {
+               /* drain */
+          }
+     }
+}
+
+static long now_ms(void) {
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/*
+ * Preparing and displaying change the output data; they are run on
+ * a snapshot, restored afterwards to keep on aggregating.
+ */
+static void report(logger_t log, output_t *output, state_t *state) {
+     FILE *snapshot = tmpfile();
+
+     if (snapshot == NULL) {
+          log(warn, "Cannot save the report data: %s\n", strerror(errno));
+          return;
+     }
+     output->save_state(output, snapshot);
+     if (state != NULL) {
+          state->save(state, (state_writer_fn)output->save_state, output);
+     }
+
+     if (isatty(STDOUT_FILENO)) {
+          fputs(CLEAR_SCREEN, stdout);
+     }
+     output->prepare(output);
+     output->display(output);
+     fflush(stdout);
+
+     rewind(snapshot);
+     if (!output->load_state(output, snapshot)) {
+          log(warn, "Cannot restore the report data\n");
+     }
+     fclose(snapshot);
+}
+
+void follow(logger_t log, input_t *input, output_t *output, state_t *state, int interval) {
+     int fd = watch_files(log, input);
+     long next, now;
+     bool_t dirty = false;
+
+     if (interval < 1) {
+          interval = 1;
+     }
+     catch_interrupts();
+
+     report(log, output, state);
+     next = now_ms() + interval * 1000L;
+     log(info, "Following %lu file%s\n", (unsigned long)input->files_length(input), input->files_length(input) == 1 ? "" : "s");
+
+     while (!interrupted) {
+          now = now_ms();
+          wait_changes(fd, next > now ? (int)(next - now) : 0);
+          if (input->update(input) > 0) {
+               dirty = true;
+          }
+          if (now_ms() >= next) {
+               if (dirty) {
+                    report(log, output, state);
+                    dirty = false;
+               }
+               next = now_ms() + interval * 1000L;
+          }
+     }
+
+     if (dirty) {
+          report(log, output, state);
+     }
+     if (fd >= 0) {
+          close(fd);
+     }
+}
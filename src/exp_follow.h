@@ -0,0 +1,58 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EXP_FOLLOW_H__
+#define __EXP_FOLLOW_H__
+
+/**
+ * @file
+ * The header for the follow mode.
+ */
+
+#include "exp.h"
+#include "exp_log.h"
+#include "exp_input.h"
+#include "exp_output.h"
+#include "exp_state.h"
+
+/**
+ * @addtogroup exp_output
+ * @{
+ */
+
+/**
+ * Follow the parsed input files, like `tail -f`: the lines appended to
+ * the files (or to the files replacing them when they are rotated) are
+ * aggregated as they come, and the report is displayed again every
+ * *interval* seconds if there were new entries. The files are watched
+ * with inotify when available, otherwise they are polled.
+ *
+ * Returns when interrupted (SIGINT or SIGTERM), after displaying the
+ * last report.
+ *
+ * @param[in] log the logger
+ * @param[in] input the input, in streaming mode
+ * @param[in] output the output
+ * @param[in] state the state, saved along with each report; may be `null`
+ * @param[in] interval the number of seconds between two reports
+ */
+void follow(logger_t log, input_t *input, output_t *output, state_t *state, int interval);
+
+/**
+ * @}
+ */
+
+#endif /* __EXP_FOLLOW_H__ */
@@ -25,24 +25,53 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <cad_array.h>
+#include <cad_hash.h>
 
 #include "exp_input.h"
 #include "exp_file.h"
 #include "exp_entry.h"
 #include "exp_entry_factory.h"
+#include "exp_arena.h"
+#include "exp_cache.h"
 
 #define SAMPLE_SIZE 10
-#define TALLY_THRESHOLD (SAMPLE_SIZE / 4)
+#define SAMPLE_ROUNDS 4
+#define FALLBACK_FACTORY "raw"
+#define STREAM_WINDOW 1000
+#define DEFAULT_INTERVAL 5
+
+/*
+ * How the factory of a file was selected.
+ */
+typedef struct {
+     entry_factory_t *factory;
+     size_t sampled;
+     size_t tally;
+     bool_t fallback;
+} detection_t;
 
 typedef struct {
      input_file_t fn;
      logger_t log;
      file_t *file;
      entry_factory_t *factory;
+     detection_t detection;
      size_t length;
      size_t size;
      entry_t **entries;
+     arena_t *arena;
+     cached_file_t *cached;
+     size_t offset;
+     uint64_t dev;
+     uint64_t ino;
+     size_t *counts;
+     columns_t columns;
+     int built;
+     cad_hash_t *strings;
+     size_t strings_capacity;
      char filename[0];
 } input_file_impl_t;
 
@@ -63,15 +92,106 @@ static size_t impl_size(input_file_impl_t *this) {
 }
 
 static entry_t *impl_entry(input_file_impl_t *this, int index) {
-     return this->entries[index];
+     return this->entries == NULL ? NULL : this->entries[index];
+}
+
+/*
+ * Columns: built from the entries, one column at a time, when first
+ * requested.
+ */
+
+static bool_t column_time_field(int value, int max) {
+     return value >= 0 && value < max;
+}
+
+static int64_t column_time_of(entry_t *entry) {
+     int year = entry->ops->year(entry), month = entry->ops->month(entry), day = entry->ops->day(entry);
+     int hour = entry->ops->hour(entry), minute = entry->ops->minute(entry), second = entry->ops->second(entry);
+     if (column_time_field(year, 100000000) && column_time_field(month, 100) && column_time_field(day, 100)
+         && column_time_field(hour, 100) && column_time_field(minute, 100) && column_time_field(second, 100)) {
+          return COLUMN_TIME(year, month, day, hour, minute, second);
+     }
+     return NO_COLUMN_TIME;
+}
+
+static uint32_t column_string(input_file_impl_t *this, const char *string) {
+     const char **strings;
+     void *index;
+     if (string == NULL) {
+          return 0;
+     }
+     index = this->strings->get(this->strings, string);
+     if (index == NULL) {
+          if (this->columns.strings_length == this->strings_capacity) {
+               this->strings_capacity *= 2;
+               this->columns.strings = realloc((void*)this->columns.strings, this->strings_capacity * sizeof(char*));
+          }
+          strings = (const char **)this->columns.strings;
+          index = (void*)(uintptr_t)this->columns.strings_length;
+          strings[this->columns.strings_length++] = strdup(string);
+          this->strings->set(this->strings, string, index);
+     }
+     return (uint32_t)(uintptr_t)index;
 }
 
-static input_file_t input_file_impl_fn = {
+static const uint32_t *column_strings(input_file_impl_t *this, const char *(*field)(entry_t*)) {
+     uint32_t *result = malloc(this->length * sizeof(uint32_t));
+     entry_t *entry;
+     size_t i;
+     if (this->strings == NULL) {
+          /* index 0 is the missing string */
+          this->strings = cad_new_hash(stdlib_memory, cad_hash_strings);
+          this->strings_capacity = 16;
+          this->columns.strings = calloc(this->strings_capacity, sizeof(char*));
+          this->columns.strings_length = 1;
+     }
+     for (i = 0; i < this->length; i++) {
+          entry = this->entries[i];
+          result[i] = column_string(this, field(entry));
+     }
+     return result;
+}
+
+static const char *entry_host(entry_t *entry) {
+     return entry->ops->host(entry);
+}
+
+static const char *entry_daemon(entry_t *entry) {
+     return entry->ops->daemon(entry);
+}
+
+static const columns_t *impl_columns(input_file_impl_t *this, int columns) {
+     int64_t *times;
+     size_t i;
+     if (this->entries == NULL) {
+          return NULL;
+     }
+     columns &= ~this->built;
+     this->columns.length = this->length;
+     if (columns & column_time) {
+          times = malloc(this->length * sizeof(int64_t));
+          for (i = 0; i < this->length; i++) {
+               times[i] = column_time_of(this->entries[i]);
+          }
+          this->columns.times = times;
+     }
+     if (columns & column_host) {
+          this->columns.hosts = column_strings(this, entry_host);
+     }
+     if (columns & column_daemon) {
+          this->columns.daemons = column_strings(this, entry_daemon);
+     }
+     this->built |= columns;
+     return &(this->columns);
+}
+
+static const input_file_ops_t input_file_impl_ops = {
      .get_factory = (input_file_get_factory_fn)impl_get_factory,
      .get_name = (input_file_get_name_fn)impl_get_name,
      .entries_length = (input_file_entries_length_fn)impl_entries_length,
      .size = (input_file_size_fn)impl_size,
      .entry = (input_file_entry_fn)impl_entry,
+     .columns = (input_file_columns_fn)impl_columns,
 };
 
 typedef struct {
@@ -79,6 +199,11 @@ typedef struct {
      logger_t log;
      options_t options;
      cad_array_t *files;
+     input_listener_fn listener;
+     void *listener_data;
+     cache_t *cache;
+     state_t *state;
+     entry_factory_t *mixed;
 } input_impl_t;
 
 static size_t impl_files_length(input_impl_t *this) {
@@ -112,91 +237,689 @@ static void impl_sort_files(input_impl_t *this) {
      }
 }
 
-static entry_factory_t *select_entry_factory(logger_t log, file_t *file) {
-     entry_factory_t *result = NULL;
-     int i, f, nl, nlines;
+/*
+ * The factory is selected on a sample of at most SAMPLE_SIZE *
+ * SAMPLE_ROUNDS lines, taken in the middle of as many equal strata of
+ * the file: the cost does not depend on the size of the file, and the
+ * result does not depend on chance. Each round samples SAMPLE_SIZE more
+ * lines, spread over the whole file, until a factory is accepted. If
+ * none is, the "raw" factory is used.
+ */
+static detection_t select_entry_factory(logger_t log, file_t *file) {
+     detection_t result = { NULL, 0, 0, false };
+     size_t i, nl, nlines, points;
+     int f, round;
      int nf = entry_factories_length();
      line_t *line;
      entry_factory_t *factory;
      size_t *tally = malloc(sizeof(size_t) * nf);
+     entry_scratch_t scratch;
      bool_t found;
      memset(tally, 0, sizeof(size_t) * nf);
+     init_entry_scratch(&scratch);
 
-     nlines = file->lines_count(file);
-     if (nlines > 0) {
-          do {
-               for (i = 0; i < SAMPLE_SIZE; i++) {
-                    nl = rand() % nlines;
-                    line = file->line(file, nl);
-                    log(debug, "Sample line %4d/%4d [%d %s] | %.*s\n", nl+1, nlines, nf, nf == 1 ? "factory" : "factories", (int)line->length, line->buffer);
-                    found = false;
-                    for (f = 0; !found && f < nf; f++) {
-                         factory = entry_factory(f);
-                         if (factory->is_type(factory, line)) {
-                              log(debug, " => %s\n", factory->get_name(factory));
-                              tally[f]++;
-                              found = true;
-                         }
-                    }
-                    if (!found) {
-                              log(debug, " => NOT FOUND\n");
+     nlines = file->ops->lines_count(file);
+     points = nlines < SAMPLE_SIZE * SAMPLE_ROUNDS ? nlines : SAMPLE_SIZE * SAMPLE_ROUNDS;
+     for (round = 0; result.factory == NULL && round < SAMPLE_ROUNDS && (size_t)round < points; round++) {
+          for (i = round; i < points; i += SAMPLE_ROUNDS) {
+               nl = (2 * i + 1) * nlines / (2 * points);
+               line = file->ops->line(file, nl);
+               log(debug, "Sample line %4lu/%4lu [%d %s] | %.*s\n", (unsigned long)nl+1, (unsigned long)nlines, nf, nf == 1 ? "factory" : "factories", (int)line->length, line->buffer);
+               found = false;
+               for (f = 0; !found && f < nf; f++) {
+                    factory = entry_factory(f);
+                    if (factory->is_type(factory, line, NULL, &scratch) >= 0) {
+                         log(debug, " => %s\n", factory->get_name(factory));
+                         tally[f]++;
+                         found = true;
                     }
                }
-
-               for (f = 0; f < nf; f++) {
-                    factory = entry_factory(f);
-                    log(debug, "tally[%s] = %lu\n", factory->get_name(factory), (unsigned long)tally[f]);
+               if (!found) {
+                         log(debug, " => NOT FOUND\n");
                }
+               result.sampled++;
+          }
 
-               for (f = 0; result == NULL && f < nf; f++) {
-                    factory = entry_factory(f);
-                    if (factory->tally_logic(factory, tally[f], TALLY_THRESHOLD, SAMPLE_SIZE)) {
-                         result = factory;
-                    }
+          for (f = 0; f < nf; f++) {
+               factory = entry_factory(f);
+               log(debug, "tally[%s] = %lu/%lu\n", factory->get_name(factory), (unsigned long)tally[f], (unsigned long)result.sampled);
+          }
+
+          for (f = 0; result.factory == NULL && f < nf; f++) {
+               factory = entry_factory(f);
+               if (factory->tally_logic(factory, tally[f], result.sampled / 4, result.sampled)) {
+                    result.factory = factory;
+                    result.tally = tally[f];
                }
-          } while (result == NULL);
+          }
      }
 
+     clean_entry_scratch(&scratch);
+
+     if (result.factory == NULL && result.sampled > 0) {
+          result.factory = entry_factory_named(FALLBACK_FACTORY);
+          result.fallback = true;
+          log(info, "No factory recognized the %lu sampled lines, falling back to \"%s\"\n", (unsigned long)result.sampled, FALLBACK_FACTORY);
+     }
+
+     free(tally);
      return result;
 }
 
-static input_file_impl_t *do_parse(input_impl_t *this, file_t *in, const char *filename) {
+/*
+ * In mixed mode, the factory is selected for each line instead.
+ */
+static detection_t select_factory(input_impl_t *this, file_t *file) {
+     detection_t result = { NULL, 0, 0, false };
+     if (this->mixed == NULL) {
+          result = select_entry_factory(this->log, file);
+     } else if (file->ops->lines_count(file) > 0) {
+          result.factory = this->mixed;
+     }
+     return result;
+}
+
+static entry_factory_t *factory_named(input_impl_t *this, const char *name) {
+     if (this->mixed != NULL && !strcmp(name, this->mixed->get_name(this->mixed))) {
+          return this->mixed;
+     }
+     return entry_factory_named(name);
+}
+
+static input_file_impl_t *new_input_file(input_impl_t *this, const char *filename, entry_factory_t *factory) {
+     input_file_impl_t *result = malloc(sizeof(input_file_impl_t) + strlen(filename) + 1);
+     this->log(info, "Using factory \"%s\" for file %s\n", factory->get_name(factory), filename);
+     result->fn.ops = &input_file_impl_ops;
+     result->log = this->log;
+     result->file = NULL;
+     result->factory = factory;
+     memset(&(result->detection), 0, sizeof(detection_t));
+     result->length = 0;
+     result->size = 0;
+     result->entries = NULL;
+     result->arena = NULL;
+     result->cached = NULL;
+     result->offset = 0;
+     result->dev = 0;
+     result->ino = 0;
+     result->counts = NULL;
+     memset(&(result->columns), 0, sizeof(columns_t));
+     result->built = 0;
+     result->strings = NULL;
+     result->strings_capacity = 0;
+     if (factory == this->mixed) {
+          result->counts = calloc(entry_factories_length(), sizeof(size_t));
+     }
+     strcpy(result->filename, filename);
+     return result;
+}
+
+/*
+ * Parallel parsing of a single file: its lines are split into ranges
+ * of about the same size in bytes, each parsed by its own thread in its
+ * own arena.
+ */
+
+#define MIN_RANGE_LINES 10000
+
+typedef struct {
+     entry_factory_t *factory;
+     file_t *in;
+     entry_t **entries;
+     int start;
+     int end;
+     arena_t *arena;
+     pthread_t thread;
+     bool_t started;
+} range_t;
+
+static void *parse_range(range_t *range) {
+     entry_factory_t *factory = range->factory;
+     file_t *in = range->in;
+     arena_t *previous = use_arena(range->arena);
+     entry_scratch_t scratch;
+     int i;
+     init_entry_scratch(&scratch);
+     for (i = range->start; i < range->end; i++) {
+          range->entries[i] = factory->new_entry(factory, in->ops->line(in, i), -1, &scratch);
+     }
+     clean_entry_scratch(&scratch);
+     use_arena(previous);
+     return NULL;
+}
+
+static void parse_ranges(logger_t log, entry_factory_t *factory, file_t *in, entry_t **entries, int jobs, arena_t *arena) {
+     int i, j, n = in->ops->lines_count(in);
+     range_t *ranges = malloc(jobs * sizeof(range_t));
+     size_t size = 0, total = 0;
+
+     for (i = 0; i < n; i++) {
+          total += in->ops->line(in, i)->length + 1;
+     }
+
+     ranges[0].start = 0;
+     for (i = 0, j = 0; j < jobs - 1; j++) {
+          while (i < n && size < total / jobs * (j + 1)) {
+               size += in->ops->line(in, i++)->length + 1;
+          }
+          ranges[j].end = ranges[j + 1].start = i;
+     }
+     ranges[jobs - 1].end = n;
+
+     log(info, "Parsing %d lines with %d jobs\n", n, jobs);
+     for (j = 0; j < jobs; j++) {
+          ranges[j].factory = factory;
+          ranges[j].in = in;
+          ranges[j].entries = entries;
+          ranges[j].arena = j == 0 ? arena : new_arena();
+     }
+     for (j = 1; j < jobs; j++) {
+          ranges[j].started = pthread_create(&(ranges[j].thread), NULL, (void*(*)(void*))parse_range, ranges + j) == 0;
+          if (!ranges[j].started) {
+               log(warn, "Could not start job %d\n", j + 1);
+          }
+     }
+     parse_range(ranges);
+     for (j = 1; j < jobs; j++) {
+          if (ranges[j].started) {
+               pthread_join(ranges[j].thread, NULL);
+          } else {
+               parse_range(ranges + j);
+          }
+          arena->merge(arena, ranges[j].arena);
+     }
+
+     free(ranges);
+}
+
+/*
+ * Mixed files count their entries by factory.
+ */
+static void count_entry(input_file_impl_t *this, entry_t *entry) {
+     const char *name = entry->ops->get_name(entry);
+     entry_factory_t *factory;
+     int f, n = entry_factories_length();
+     for (f = 0; f < n; f++) {
+          factory = entry_factory(f);
+          if (!strcmp(name, factory->get_name(factory))) {
+               this->counts[f]++;
+               return;
+          }
+     }
+}
+
+static void count_entries(input_file_impl_t *this) {
+     size_t i;
+     if (this->counts != NULL) {
+          for (i = 0; i < this->length; i++) {
+               count_entry(this, this->entries[i]);
+          }
+     }
+}
+
+static void log_counts(input_impl_t *this, input_file_impl_t *file) {
+     entry_factory_t *factory;
+     int f, n = entry_factories_length();
+     if (file->counts != NULL) {
+          for (f = 0; f < n; f++) {
+               if (file->counts[f] > 0) {
+                    factory = entry_factory(f);
+                    this->log(info, "File %s: %lu lines of \"%s\"\n", file->filename, (unsigned long)file->counts[f], factory->get_name(factory));
+               }
+          }
+     }
+}
+
+static input_file_impl_t *do_parse(input_impl_t *this, file_t *in, const char *filename, int jobs, arena_t *arena) {
      input_file_impl_t *result = NULL;
-     entry_factory_t *factory = select_entry_factory(this->log, in);
+     detection_t detection = select_factory(this, in);
+     entry_factory_t *factory = detection.factory;
+     entry_scratch_t scratch;
      line_t *line;
-     int i, n = in->lines_count(in);
+     int i, n = in->ops->lines_count(in);
 
      if (factory == NULL) {
           this->log(warn, "Input factory not found for file %s\n", filename);
      } else {
-          this->log(info, "Using factory \"%s\" for file %s\n", factory->get_name(factory), filename);
-          result = malloc(sizeof(input_file_impl_t) + strlen(filename) + 1);
-          result->fn = input_file_impl_fn;
-          result->log = this->log;
+          result = new_input_file(this, filename, factory);
+          result->detection = detection;
           result->file = in;
-          result->factory = factory;
-          result->length = in->lines_count(in);
-          result->size = in->size(in);
-          result->entries = malloc(result->length * sizeof(entry_t*));
-          strcpy(result->filename, filename);
+          result->length = in->ops->lines_count(in);
+          result->size = in->ops->size(in);
+          result->entries = current_memory()->malloc(result->length * sizeof(entry_t*));
+          if (jobs > n / MIN_RANGE_LINES) {
+               jobs = n / MIN_RANGE_LINES;
+          }
+          if (jobs > 1) {
+               parse_ranges(this->log, factory, in, result->entries, jobs, arena);
+          } else {
+               init_entry_scratch(&scratch);
+               for (i = 0; i < n; i++) {
+                    line = in->ops->line(in, i);
+                    result->entries[i] = factory->new_entry(factory, line, -1, &scratch);
+               }
+               clean_entry_scratch(&scratch);
+          }
+          count_entries(result);
+     }
+
+     return result;
+}
+
+/*
+ * Streaming: the first lines are kept in a window file used to select
+ * the factory; then each line is analyzed, given to the listener, and
+ * dropped.
+ */
+
+typedef struct {
+     file_t fn;
+     size_t count;
+     size_t size;
+     line_t *lines[STREAM_WINDOW];
+} window_file_t;
+
+static size_t window_lines_count(window_file_t *this) {
+     return this->count;
+}
+
+static line_t *window_line(window_file_t *this, int index) {
+     return this->lines[index];
+}
+
+static size_t window_size(window_file_t *this) {
+     return this->size;
+}
+
+static void window_free(window_file_t *this) {
+     size_t i;
+     for (i = 0; i < this->count; i++) {
+          free(this->lines[i]);
+     }
+     free(this);
+}
+
+static const file_ops_t window_file_ops = {
+     .lines_count = (file_lines_count_fn)window_lines_count,
+     .line = (file_line_fn)window_line,
+     .size = (file_size_fn)window_size,
+     .free = (file_free_fn)window_free,
+};
+
+typedef struct {
+     input_impl_t *input;
+     const char *filename;
+     window_file_t *window;
+     input_file_impl_t *file;
+     entry_scratch_t scratch;
+} stream_t;
+
+static void stream_entry(stream_t *this, line_t *line) {
+     input_file_impl_t *file = this->file;
+     entry_factory_t *factory = file->factory;
+     entry_t *entry = factory->new_entry(factory, line, -1, &(this->scratch));
+     if (file->counts != NULL) {
+          count_entry(file, entry);
+     }
+     this->input->listener(this->input->listener_data, &(file->fn), file->length, entry);
+     entry->ops->free(entry);
+     file->length++;
+     file->size += line->length + 1;
+}
+
+static void stream_start(stream_t *this) {
+     window_file_t *window = this->window;
+     detection_t detection = select_factory(this->input, &(window->fn));
+     size_t i;
+
+     this->window = NULL;
+     if (detection.factory == NULL) {
+          this->input->log(warn, "Input factory not found for file %s\n", this->filename);
+     } else {
+          this->file = new_input_file(this->input, this->filename, detection.factory);
+          this->file->detection = detection;
+          for (i = 0; i < window->count; i++) {
+               stream_entry(this, window->lines[i]);
+          }
+     }
+     window->fn.ops->free(&(window->fn));
+}
+
+static void stream_line(line_t *line, stream_t *this) {
+     window_file_t *window = this->window;
+     if (this->file != NULL) {
+          stream_entry(this, line);
+     } else if (window != NULL) {
+          window->lines[window->count++] = new_line(line->length, line->buffer);
+          window->size += line->length + 1;
+          if (window->count == STREAM_WINDOW) {
+               stream_start(this);
+          }
+     }
+}
+
+/*
+ * With a state, a file already read by a previous run is resumed where
+ * it stopped, with the same factory; its entries are numbered after
+ * the ones already read.
+ */
+static void stream_resume(stream_t *this, size_t *offset) {
+     input_impl_t *input = this->input;
+     entry_factory_t *factory = NULL;
+     const char *name;
+     size_t entries;
+
+     *offset = input->state->resume(input->state, this->filename, &name, &entries);
+     if (name != NULL) {
+          factory = factory_named(input, name);
+     }
+     if (factory == NULL) {
+          *offset = 0;
+     } else {
+          this->file = new_input_file(input, this->filename, factory);
+          this->file->length = entries;
+          this->window->fn.ops->free(&(this->window->fn));
+          this->window = NULL;
+     }
+}
+
+static input_file_impl_t *do_stream(input_impl_t *this, const char *filename) {
+     stream_t stream = {
+          .input = this,
+          .filename = filename,
+          .window = malloc(sizeof(window_file_t)),
+          .file = NULL,
+     };
+     size_t offset = 0;
+     struct stat st = { 0 };
+     bool_t scanned;
+     stream.window->fn.ops = &window_file_ops;
+     stream.window->count = 0;
+     stream.window->size = 0;
+     init_entry_scratch(&(stream.scratch));
+
+     if (this->state == NULL && !this->options.follow) {
+          scanned = scan_file(this->log, warn, filename, (line_iterator_fn)stream_line, &stream);
+     } else {
+          if (this->state != NULL) {
+               stream_resume(&stream, &offset);
+          }
+          stat(filename, &st);
+          scanned = scan_file_from(this->log, warn, filename, &offset, (line_iterator_fn)stream_line, &stream);
+     }
+
+     if (!scanned) {
+          if (stream.window != NULL) {
+               stream.window->fn.ops->free(&(stream.window->fn));
+          }
+     } else if (stream.window != NULL) {
+          stream_start(&stream);
+     }
+     clean_entry_scratch(&(stream.scratch));
+
+     if (scanned && stream.file != NULL && (this->state != NULL || this->options.follow)) {
+          stream.file->offset = offset;
+          stream.file->dev = st.st_dev;
+          stream.file->ino = st.st_ino;
+          if (this->state != NULL) {
+               this->state->update(this->state, filename, offset, stream.file->factory->get_name(stream.file->factory), stream.file->length);
+          }
+     }
+
+     return stream.file;
+}
+
+/*
+ * Follow mode: the files are read again from where they were left. A
+ * file replaced by another one (rotation) or truncated is read from its
+ * start, with the same factory.
+ */
+static size_t update_file(input_impl_t *this, input_file_impl_t *file) {
+     stream_t stream = {
+          .input = this,
+          .filename = file->filename,
+          .window = NULL,
+          .file = file,
+     };
+     size_t length = file->length;
+     struct stat st;
+
+     if (!strcmp("-", file->filename) || stat(file->filename, &st) != 0) {
+          return 0;
+     }
+     if ((uint64_t)st.st_dev != file->dev || (uint64_t)st.st_ino != file->ino || (size_t)st.st_size < file->offset) {
+          this->log(info, "File rotated: %s\n", file->filename);
+          file->offset = 0;
+          file->dev = st.st_dev;
+          file->ino = st.st_ino;
+     }
+     if (file->offset == (size_t)st.st_size) {
+          return 0;
+     }
+
+     init_entry_scratch(&(stream.scratch));
+     if (scan_file_from(this->log, warn, file->filename, &(file->offset), (line_iterator_fn)stream_line, &stream) && this->state != NULL) {
+          this->state->update(this->state, file->filename, file->offset, file->factory->get_name(file->factory), file->length);
+     }
+     clean_entry_scratch(&(stream.scratch));
+     return file->length - length;
+}
+
+static size_t impl_update(input_impl_t *this) {
+     size_t result = 0;
+     int i, n = this->files->count(this->files);
+     for (i = 0; i < n; i++) {
+          result += update_file(this, *(input_file_impl_t **)this->files->get(this->files, i));
+     }
+     return result;
+}
+
+/*
+ * Cached files: the entries are replayed from the cache instead of
+ * parsing the file again.
+ */
+
+static input_file_impl_t *from_cache(input_impl_t *this, const char *filename, cached_file_t *cached) {
+     input_file_impl_t *result = NULL;
+     entry_factory_t *factory = factory_named(this, cached->factory(cached));
+     entry_t *entry;
+     size_t i, n = cached->entries_length(cached);
+
+     if (factory == NULL) {
+          this->log(warn, "Unknown cached factory \"%s\" for file %s\n", cached->factory(cached), filename);
+          cached->free(cached);
+          return NULL;
+     }
+
+     result = new_input_file(this, filename, factory);
+     result->size = cached->size(cached);
+     if (this->listener != NULL) {
           for (i = 0; i < n; i++) {
-               line = in->line(in, i);
-               result->entries[i] = factory->new_entry(factory, line);
+               entry = cached->entry(cached, i);
+               if (result->counts != NULL) {
+                    count_entry(result, entry);
+               }
+               this->listener(this->listener_data, &(result->fn), i, entry);
           }
+          result->length = n;
+          cached->free(cached);
+     } else {
+          result->length = n;
+          result->entries = malloc(n * sizeof(entry_t*));
+          for (i = 0; i < n; i++) {
+               result->entries[i] = cached->entry(cached, i);
+          }
+          result->cached = cached;
+          count_entries(result);
      }
 
      return result;
 }
 
-static input_file_impl_t *impl_parse(input_impl_t *this, const char *filename) {
+/*
+ * The lines and entries of a parsed file are allocated in an arena of
+ * its own, released all at once.
+ */
+static input_file_impl_t *parse_file(input_impl_t *this, const char *filename, int jobs) {
      input_file_impl_t *result = NULL;
-     file_t *in = new_file(this->log, warn, filename);
-     if (in != NULL) {
-          result = do_parse(this, in, filename);
+     arena_t *arena, *previous;
+     cached_file_t *cached;
+     cache_key_t key = { false };
+     file_t *in;
+     if (this->state == NULL && this->cache != NULL && (cached = this->cache->load(this->cache, filename, &key)) != NULL) {
+          result = from_cache(this, filename, cached);
+     } else if (this->listener != NULL) {
+          result = do_stream(this, filename);
+     } else {
+          arena = new_arena();
+          previous = use_arena(arena);
+          in = new_file(this->log, warn, filename);
+          if (in != NULL) {
+               result = do_parse(this, in, filename, jobs, arena);
+          }
+          use_arena(previous);
           if (result != NULL) {
-               this->files->insert(this->files, this->files->count(this->files), &result);
+               result->arena = arena;
+               if (this->cache != NULL) {
+                    this->cache->save(this->cache, &key, result->factory->get_name(result->factory), result->size, result->length, result->entries);
+               }
+          } else {
+               if (in != NULL) {
+                    in->ops->free(in);
+               }
+               arena->free(arena);
           }
      }
+     if (result != NULL) {
+          log_counts(this, result);
+     }
+     return result;
+}
+
+static input_file_impl_t *impl_parse(input_impl_t *this, const char *filename) {
+     input_file_impl_t *result = parse_file(this, filename, this->options.jobs);
+     if (result != NULL) {
+          this->files->insert(this->files, this->files->count(this->files), &result);
+     }
+     return result;
+}
+
+/*
+ * Parallel parsing: the files are given to a pool of workers, largest
+ * first.
+ */
+
+typedef struct {
+     int index;
+     const char *filename;
+     off_t size;
+     input_file_impl_t *result;
+} job_t;
+
+typedef struct {
+     input_impl_t *input;
+     job_t **jobs;
+     int count;
+     int next;
+     int file_jobs;
+     pthread_mutex_t lock;
+} job_queue_t;
+
+static int job_comparator(job_t **job1, job_t **job2) {
+     int result = ((*job2)->size > (*job1)->size) - ((*job2)->size < (*job1)->size);
+     if (result == 0) {
+          result = (*job1)->index - (*job2)->index;
+     }
+     return result;
+}
+
+static void *job_worker(job_queue_t *queue) {
+     job_t *job;
+     do {
+          pthread_mutex_lock(&(queue->lock));
+          job = queue->next < queue->count ? queue->jobs[queue->next++] : NULL;
+          pthread_mutex_unlock(&(queue->lock));
+          if (job != NULL) {
+               job->result = parse_file(queue->input, job->filename, queue->file_jobs);
+          }
+     } while (job != NULL);
+     return NULL;
+}
+
+static void parse_jobs(input_impl_t *this, int njobs, int count, job_t *jobs) {
+     job_queue_t queue = {
+          .input = this,
+          .jobs = malloc(count * sizeof(job_t*)),
+          .count = count,
+          .next = 0,
+          .file_jobs = this->options.jobs / njobs,
+     };
+     pthread_t *workers = malloc(njobs * sizeof(pthread_t));
+     struct stat st;
+     int i;
+
+     for (i = 0; i < count; i++) {
+          jobs[i].size = stat(jobs[i].filename, &st) == 0 ? st.st_size : 0;
+          queue.jobs[i] = jobs + i;
+     }
+     qsort(queue.jobs, count, sizeof(job_t*), (comparator_fn)job_comparator);
+
+     this->log(info, "Parsing %d files with %d jobs\n", count, njobs);
+     pthread_mutex_init(&(queue.lock), NULL);
+     for (i = 0; i < njobs; i++) {
+          if (pthread_create(workers + i, NULL, (void*(*)(void*))job_worker, &queue) != 0) {
+               this->log(warn, "Could not start job %d\n", i + 1);
+               break;
+          }
+     }
+     if (i == 0) {
+          job_worker(&queue);
+     }
+     while (i > 0) {
+          pthread_join(workers[--i], NULL);
+     }
+     pthread_mutex_destroy(&(queue.lock));
+
+     free(workers);
+     free(queue.jobs);
+}
+
+static size_t impl_parse_all(input_impl_t *this, int count, const char * const *filenames) {
+     size_t result = 0;
+     job_t *jobs = malloc(count * sizeof(job_t));
+     int i, njobs = this->options.jobs;
+
+     for (i = 0; i < count; i++) {
+          jobs[i].index = i;
+          jobs[i].filename = filenames[i];
+          jobs[i].result = NULL;
+     }
+
+     if (njobs > count) {
+          njobs = count;
+     }
+     if (njobs > 1 && this->listener != NULL) {
+          this->log(info, "Streamed files are parsed sequentially\n");
+          njobs = 1;
+     }
+
+     if (njobs > 1) {
+          parse_jobs(this, njobs, count, jobs);
+     } else {
+          for (i = 0; i < count; i++) {
+               this->log(debug, "Input %d/%d: %s\n", i + 1, count, filenames[i]);
+               jobs[i].result = parse_file(this, filenames[i], this->options.jobs);
+          }
+     }
+
+     for (i = 0; i < count; i++) {
+          if (jobs[i].result != NULL) {
+               this->files->insert(this->files, this->files->count(this->files), &(jobs[i].result));
+               result++;
+          }
+     }
+
+     free(jobs);
      return result;
 }
 
@@ -213,6 +936,14 @@ static options_set_t impl_options_set(input_impl_t *this) {
           .year=false,
           .exp_mode=false,
           .dev=true,
+          .jobs=true,
+          .cache=true,
+          .state=true,
+          .follow=true,
+          .interval=true,
+          .stats=true,
+          .mixed=true,
+          .limits=true,
      };
      return result;
 }
@@ -220,6 +951,14 @@ static options_set_t impl_options_set(input_impl_t *this) {
 static options_t impl_default_options(input_impl_t *this) {
      static options_t result = {
           .factory_extradirs = NULL,
+          .jobs = 1,
+          .cache = false,
+          .state = NULL,
+          .follow = false,
+          .interval = DEFAULT_INTERVAL,
+          .stats = false,
+          .mixed = false,
+          .limits = { 0, 0, limit_skip },
      };
      return result;
 }
@@ -229,28 +968,96 @@ static void impl_set_options(input_impl_t *this, options_t options) {
      entry_factory_t *factory;
 
      this->options = options;
-     if (this->options.factory_extradirs != NULL) {
-          for (i = 0; i < n; i++) {
-               factory = entry_factory(i);
-               factory->set_extradirs(factory, this->options.factory_extradirs);
+     for (i = 0; i < n; i++) {
+          factory = entry_factory(i);
+          factory->set_limits(factory, this->options.limits);
+          factory->set_extradirs(factory, this->options.factory_extradirs);
+     }
+
+     if (this->cache != NULL) {
+          this->cache->free(this->cache);
+          this->cache = NULL;
+     }
+     if (this->options.mixed && this->mixed == NULL) {
+          this->mixed = new_mixed_factory(this->log);
+     }
+     if (this->options.cache) {
+          this->cache = new_cache(this->log, entry_factories_signature(this->options.mixed));
+     }
+}
+
+static void impl_set_listener(input_impl_t *this, input_listener_fn listener, void *data) {
+     this->listener = listener;
+     this->listener_data = data;
+}
+
+static void impl_set_state(input_impl_t *this, state_t *state) {
+     this->state = state;
+}
+
+static void print_detection(input_file_impl_t *file, FILE *out) {
+     detection_t *detection = &(file->detection);
+     if (file->counts != NULL) {
+          fputs("selected for each line", out);
+     } else if (detection->sampled == 0) {
+          fputs("known", out);
+     } else if (detection->fallback) {
+          fprintf(out, "fallback, none of %lu sampled lines recognized", (unsigned long)detection->sampled);
+     } else {
+          fprintf(out, "detected on %lu/%lu sampled lines", (unsigned long)detection->tally, (unsigned long)detection->sampled);
+     }
+}
+
+static void impl_print_stats(input_impl_t *this, FILE *out) {
+     input_file_impl_t *file;
+     entry_factory_t *factory;
+     int i, n = this->files->count(this->files);
+     int f, nf = entry_factories_length();
+     fprintf(out, "Files: %d\n", n);
+     for (i = 0; i < n; i++) {
+          file = *(input_file_impl_t **)this->files->get(this->files, i);
+          fprintf(out, "%s:\n", file->filename);
+          fprintf(out, "  factory: %s (", file->factory->get_name(file->factory));
+          print_detection(file, out);
+          fprintf(out, ")\n");
+          if (file->counts != NULL) {
+               for (f = 0; f < nf; f++) {
+                    if (file->counts[f] > 0) {
+                         factory = entry_factory(f);
+                         fprintf(out, "    %s: %lu\n", factory->get_name(factory), (unsigned long)file->counts[f]);
+                    }
+               }
           }
+          fprintf(out, "  entries: %lu\n", (unsigned long)file->length);
+          fprintf(out, "  size:    %lu\n", (unsigned long)file->size);
      }
 }
 
 static input_t input_impl_fn = {
      .parse = (input_parse_fn)impl_parse,
+     .parse_all = (input_parse_all_fn)impl_parse_all,
      .files_length = (input_files_length_fn)impl_files_length,
      .file = (input_file_fn)impl_file,
      .sort_files = (input_sort_files_fn)impl_sort_files,
      .options_set = (input_options_set_fn)impl_options_set,
      .default_options = (input_default_options_fn)impl_default_options,
      .set_options = (input_set_options_fn)impl_set_options,
+     .set_listener = (input_set_listener_fn)impl_set_listener,
+     .set_state = (input_set_state_fn)impl_set_state,
+     .update = (input_update_fn)impl_update,
+     .print_stats = (input_print_stats_fn)impl_print_stats,
 };
 
 input_t *new_input(logger_t log) {
      input_impl_t *result = malloc(sizeof(input_impl_t));
      result->fn = input_impl_fn;
      result->log = log;
+     result->options = impl_default_options(result);
      result->files = cad_new_array(stdlib_memory, sizeof(input_file_t *));
+     result->listener = NULL;
+     result->listener_data = NULL;
+     result->cache = NULL;
+     result->state = NULL;
+     result->mixed = NULL;
      return &(result->fn);
 }
@@ -22,11 +22,15 @@
  * The header for inputs.
  */
 
+#include <stdio.h>
+#include <stdint.h>
+
 #include "exp.h"
 #include "exp_log.h"
 #include "exp_entry.h"
 #include "exp_entry_factory.h"
 #include "exp_options.h"
+#include "exp_state.h"
 
 /**
  * @addtogroup exp_input
@@ -53,6 +57,19 @@ typedef struct input_file_s input_file_t;
  */
 typedef input_file_t *(*input_parse_fn)(input_t *this, const char *filename);
 
+/**
+ * Parse several files. They may be parsed in parallel (see the `jobs`
+ * option) but they are known in the given order, as if they were
+ * [parsed](@ref input_parse_fn) one after the other.
+ *
+ * @param[in] this the target input
+ * @param[in] count the number of files
+ * @param[in] filenames the names of the files to parse
+ *
+ * @return the number of successfully parsed files
+ */
+typedef size_t (*input_parse_all_fn)(input_t *this, int count, const char * const *filenames);
+
 /**
  * Get the number of successfully [parsed](@ref input_parse_fn) files
  *
@@ -105,11 +122,70 @@ typedef options_t (*input_default_options_fn)(input_t *this);
  */
 typedef void (*input_set_options_fn)(input_t *this, options_t options);
 
+/**
+ * Called for each entry when the input is streamed (see
+ * [set_listener](@ref input_set_listener_fn)).
+ *
+ * @param[in] data the listener data
+ * @param[in] file the input file the entry belongs to
+ * @param[in] index the index of the entry in its file
+ * @param[in] entry the entry; it is freed after the call
+ */
+typedef void (*input_listener_fn)(void *data, input_file_t *file, int index, entry_t *entry);
+
+/**
+ * Switch the input to streaming mode: each parsed entry is given to
+ * the *listener* then dropped. The input files are still
+ * [parsed](@ref input_parse_fn) and known but they don't keep their
+ * [entries](@ref input_file_entry_fn).
+ *
+ * @param[in] this the target input
+ * @param[in] listener the function to call for each entry
+ * @param[in] data the listener data
+ */
+typedef void (*input_set_listener_fn)(input_t *this, input_listener_fn listener, void *data);
+
+/**
+ * Read the files incrementally: each file is read from where the
+ * previous run stopped, as recorded by the *state*, which is then
+ * updated. Only meaningful in streaming mode (see
+ * [set_listener](@ref input_set_listener_fn)).
+ *
+ * @param[in] this the target input
+ * @param[in] state the state
+ */
+typedef void (*input_set_state_fn)(input_t *this, state_t *state);
+
+/**
+ * Read what was appended to the parsed files since they were last
+ * read; the new entries are given to the listener (see
+ * [set_listener](@ref input_set_listener_fn)). A file that was rotated
+ * is read again from its start. Only meaningful in follow mode.
+ *
+ * @param[in] this the target input
+ *
+ * @return the number of new entries
+ */
+typedef size_t (*input_update_fn)(input_t *this);
+
+/**
+ * Print statistics about the parsed files: how their factory was
+ * selected, their number of entries and their size.
+ *
+ * @param[in] this the target input
+ * @param[in] out the stream to print to
+ */
+typedef void (*input_print_stats_fn)(input_t *this, FILE *out);
+
 struct input_s {
      /**
       * @see input_parse_fn
       */
      input_parse_fn parse;
+     /**
+      * @see input_parse_all_fn
+      */
+     input_parse_all_fn parse_all;
      /**
       * @see input_files_length_fn
       */
@@ -134,6 +210,22 @@ struct input_s {
       * @see input_set_options_fn
       */
      input_set_options_fn set_options;
+     /**
+      * @see input_set_listener_fn
+      */
+     input_set_listener_fn set_listener;
+     /**
+      * @see input_set_state_fn
+      */
+     input_set_state_fn set_state;
+     /**
+      * @see input_update_fn
+      */
+     input_update_fn update;
+     /**
+      * @see input_print_stats_fn
+      */
+     input_print_stats_fn print_stats;
 };
 
 /**
@@ -178,6 +270,8 @@ typedef size_t (*input_file_size_fn)(input_file_t *this);
 /**
  * Get the *index*-th analyzed line.
  *
+ * Not available in streaming mode (returns `null`).
+ *
  * @param[in] this the target input file
  * @param[in] index the index of the line to return
  *
@@ -185,7 +279,97 @@ typedef size_t (*input_file_size_fn)(input_file_t *this);
  */
 typedef entry_t *(*input_file_entry_fn)(input_file_t *this, int index);
 
-struct input_file_s {
+/**
+ * A calendar time packed in an integer; from the most to the least
+ * significant: year, month, day, hour, minute, second (two decimal
+ * digits each, except the year). The fields are those of the entry,
+ * *not* normalized (see `mktime()`), so that the order of packed
+ * times is the order of their fields, and a time truncated to a unit
+ * (see COLUMN_TIME_UNIT) keeps only the fields down to that unit.
+ */
+#define COLUMN_TIME(year, month, day, hour, minute, second) \
+     ((((((int64_t)(year) * 100 + (month)) * 100 + (day)) * 100 + (hour)) * 100 + (minute)) * 100 + (second))
+
+/**
+ * The packed time of an entry whose fields do not fit; use the entry.
+ */
+#define NO_COLUMN_TIME INT64_MIN
+
+/**
+ * The divisor of a packed time that keeps the fields down to the
+ * *n*-th (0 for the second, 5 for the year).
+ */
+#define COLUMN_TIME_UNIT(n) ((int64_t[]){1LL, 100LL, 10000LL, 1000000LL, 100000000LL, 10000000000LL}[n])
+
+/**
+ * Unpack one field of a packed time (0 for the second, 5 for the
+ * year).
+ */
+#define COLUMN_TIME_FIELD(time, n) ((int)((n) == 5 ? (time) / COLUMN_TIME_UNIT(5) : (time) / COLUMN_TIME_UNIT(n) % 100))
+
+/**
+ * The columns of an input file.
+ */
+typedef enum {
+     /** the packed time of each entry (see COLUMN_TIME) */
+     column_time = 1,
+     /** the host of each entry, as an index in the column strings */
+     column_host = 2,
+     /** the daemon of each entry, as an index in the column strings */
+     column_daemon = 4,
+} column_t;
+
+/**
+ * The entries of an input file, column by column: the *i*-th value of
+ * each column belongs to the *i*-th entry.
+ */
+typedef struct {
+     /**
+      * The number of entries
+      */
+     size_t length;
+     /**
+      * The packed times, if requested
+      */
+     const int64_t *times;
+     /**
+      * The hosts, if requested
+      */
+     const uint32_t *hosts;
+     /**
+      * The daemons, if requested
+      */
+     const uint32_t *daemons;
+     /**
+      * The distinct hosts and daemons; a missing one is `null`
+      */
+     const char * const *strings;
+     /**
+      * The number of strings
+      */
+     size_t strings_length;
+} columns_t;
+
+/**
+ * Get the entries of the input file column by column, so that they
+ * can be scanned without calling the entries. The columns are built
+ * on the first request; they stay valid as long as the input file,
+ * until the next request.
+ *
+ * Not available in streaming mode (returns `null`).
+ *
+ * @param[in] this the target input file
+ * @param[in] columns the wanted columns (a mask of column_t)
+ *
+ * @return the columns
+ */
+typedef const columns_t *(*input_file_columns_fn)(input_file_t *this, int columns);
+
+/**
+ * The operations of an input file; all the input files of the same kind share one
+ * table.
+ */
+typedef struct {
      /**
       * @see input_file_get_factory_fn
       */
@@ -206,6 +390,17 @@ struct input_file_s {
       * @see input_file_entry_fn
       */
      input_file_entry_fn entry;
+     /**
+      * @see input_file_columns_fn
+      */
+     input_file_columns_fn columns;
+} input_file_ops_t;
+
+struct input_file_s {
+     /**
+      * The operations of the input file
+      */
+     const input_file_ops_t *ops;
 };
 
 /**
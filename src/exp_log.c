@@ -30,6 +30,7 @@
 
 static void taglog(level_t level) {
    struct timeval tm;
+   struct tm local;
    char buffer[20];
    static char *tag[] = {
       "WARN ",
@@ -37,7 +38,7 @@ static void taglog(level_t level) {
       "DEBUG"
    };
    gettimeofday(&tm, NULL);
-   strftime(buffer, 20, "%Y/%m/%d %H:%M:%S", localtime(&tm.tv_sec));
+   strftime(buffer, 20, "%Y/%m/%d %H:%M:%S", localtime_r(&tm.tv_sec, &local));
    fprintf(stderr, "%s.%06ld [%s] ", buffer, tm.tv_usec, tag[level]);
 }
 
@@ -46,8 +47,10 @@ static int warn_logger(level_t level, char *format, ...) {
    va_list arg;
    if(level <= warn) {
       va_start(arg, format);
+      flockfile(stderr);
       taglog(level);
       result = vfprintf(stderr, format, arg);
+      funlockfile(stderr);
       va_end(arg);
    }
    return result;
@@ -58,8 +61,10 @@ static int info_logger(level_t level, char *format, ...) {
    va_list arg;
    if(level <= info) {
       va_start(arg, format);
+      flockfile(stderr);
       taglog(level);
       result = vfprintf(stderr, format, arg);
+      funlockfile(stderr);
       va_end(arg);
    }
    return result;
@@ -70,8 +75,10 @@ static int debug_logger(level_t level, char *format, ...) {
    va_list arg;
    if(level <= debug) {
       va_start(arg, format);
+      flockfile(stderr);
       taglog(level);
       result = vfprintf(stderr, format, arg);
+      funlockfile(stderr);
       va_end(arg);
    }
    return result;
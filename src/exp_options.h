@@ -23,6 +23,7 @@
  */
 
 #include "exp.h"
+#include "exp_regexp.h"
 
 /**
  * @addtogroup exp_misc
@@ -74,6 +75,15 @@ typedef struct {
      bool_t             exp_mode;
      int                dev;
      bool_t             color;
+     bool_t             stream;
+     int                jobs;
+     bool_t             cache;
+     const char        *state;
+     bool_t             follow;
+     int                interval;
+     bool_t             stats;
+     bool_t             mixed;
+     regexp_limits_t    limits;
 } options_t;
 
 /**
@@ -95,6 +105,15 @@ typedef struct {
      bool_t exp_mode;
      bool_t dev;
      bool_t color;
+     bool_t stream;
+     bool_t jobs;
+     bool_t cache;
+     bool_t state;
+     bool_t follow;
+     bool_t interval;
+     bool_t stats;
+     bool_t mixed;
+     bool_t limits;
 } options_set_t;
 
 /**
@@ -22,6 +22,8 @@
  * The header for inputs.
  */
 
+#include <stdio.h>
+
 #include "exp.h"
 #include "exp_log.h"
 #include "exp_input.h"
@@ -74,6 +76,41 @@ typedef options_t (*output_default_options_fn)(output_t *this);
  */
 typedef void (*output_set_options_fn)(output_t *this, options_t options);
 
+/**
+ * Aggregate one entry. Called for each entry of each input file,
+ * either by [prepare](@ref output_prepare_fn) or directly by the input
+ * in streaming mode (see [set_listener](@ref input_set_listener_fn)).
+ *
+ * The entry must not be kept after the call.
+ *
+ * @param[in] this the target output
+ * @param[in] file the input file the entry belongs to
+ * @param[in] index the index of the entry in its file
+ * @param[in] entry the entry to aggregate
+ */
+typedef void (*output_stream_fn)(output_t *this, input_file_t *file, int index, entry_t *entry);
+
+/**
+ * Write the aggregated data, before [prepare](@ref output_prepare_fn),
+ * to be [restored](@ref output_load_state_fn) by a later run.
+ *
+ * @param[in] this the target output
+ * @param[in] out the state file
+ */
+typedef void (*output_save_state_fn)(output_t *this, FILE *out);
+
+/**
+ * Restore the aggregated data [saved](@ref output_save_state_fn) by a
+ * previous run. Nothing is restored if the data was not saved by the
+ * same kind of output with the same options.
+ *
+ * @param[in] this the target output
+ * @param[in] in the state file
+ *
+ * @return `true` if the data was restored, `false` otherwise
+ */
+typedef bool_t (*output_load_state_fn)(output_t *this, FILE *in);
+
 /**
  * Prepare the log analysis and display relevant results.
  *
@@ -105,6 +142,18 @@ struct output_s {
       * @see output_set_options_fn
       */
      output_set_options_fn set_options;
+     /**
+      * @see output_stream_fn
+      */
+     output_stream_fn stream;
+     /**
+      * @see output_save_state_fn
+      */
+     output_save_state_fn save_state;
+     /**
+      * @see output_load_state_fn
+      */
+     output_load_state_fn load_state;
      /**
       * @see output_prepare_fn
       */
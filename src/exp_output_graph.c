@@ -30,11 +30,12 @@
 
 #include "exp_output.h"
 #include "exp_file.h"
+#include "exp_state.h"
 
 #define DEFAULT_GRAPH_HEIGHT 6
 
 typedef struct output_graph_s output_graph_t;
-typedef void (*time_fn)(output_graph_t *this, struct tm *time, entry_t *entry);
+typedef void (*time_fn)(struct tm *time);
 typedef void (*increment_time_fn)(struct tm *time);
 typedef int (*value_fn)(struct tm *time);
 
@@ -45,19 +46,23 @@ struct output_graph_s {
      options_t options;
      const char *unit;
      int duration;
+     int64_t column_unit;
      time_fn time;
      increment_time_fn increment_time;
      value_fn value;
+     cad_hash_t *counts;
+     bool_t has_start;
      cad_hash_t *dict;
      double minh, minz, max;
      struct tm start, middle, end;
      char **keys;
 };
 
-static const char* strdate(struct tm*time) {
-     static char result[128];
-     strftime(result, 128, "%Y-%m-%d %H:%M:%S ", time);
-     return result;
+#define DATE_SIZE 128
+
+static const char* strdate(struct tm*time, char *buffer) {
+     strftime(buffer, DATE_SIZE, "%Y-%m-%d %H:%M:%S ", time);
+     return buffer;
 }
 
 static void graph_prepare_max(cad_hash_t *hash, int index, const char *key, double *value, output_graph_t *graph) {
@@ -82,29 +87,221 @@ static int cmpstr(const char **a, const char **b) {
      return strcmp(*a, *b);
 }
 
+static int year(output_graph_t *this, int year) {
+     if (year == 0) {
+          year = this->options.year;
+     }
+     return year - 1900;
+}
+
+/*
+ * The time of an entry, truncated to the unit of the graph
+ */
+static void entry_time(output_graph_t *this, struct tm *time, entry_t *entry) {
+     time->tm_sec  = entry->ops->second(entry);
+     time->tm_min  = entry->ops->minute(entry);
+     time->tm_hour = entry->ops->hour(entry);
+     time->tm_mday = entry->ops->day(entry);
+     time->tm_mon  = entry->ops->month(entry) - 1;
+     time->tm_year = year(this, entry->ops->year(entry));
+     time->tm_isdst = -1;
+     this->time(time);
+}
+
+static void packed_time(output_graph_t *this, struct tm *time, int64_t packed) {
+     time->tm_sec  = COLUMN_TIME_FIELD(packed, 0);
+     time->tm_min  = COLUMN_TIME_FIELD(packed, 1);
+     time->tm_hour = COLUMN_TIME_FIELD(packed, 2);
+     time->tm_mday = COLUMN_TIME_FIELD(packed, 3);
+     time->tm_mon  = COLUMN_TIME_FIELD(packed, 4) - 1;
+     time->tm_year = year(this, COLUMN_TIME_FIELD(packed, 5));
+     time->tm_isdst = -1;
+     this->time(time);
+}
+
+static void graph_start(output_graph_t *this, struct tm *time) {
+     struct tm current = *time;
+     if (!this->has_start || (difftime(mktime(&current), mktime(&this->start)) < 0)) {
+          this->start = current;
+     }
+     this->has_start = true;
+}
+
+static void graph_count(output_graph_t *this, struct tm *time, size_t n) {
+     char date[DATE_SIZE];
+     const char *key;
+     size_t *count;
+
+     key = strdate(time, date);
+     count = this->counts->get(this->counts, key);
+     if (count == NULL) {
+          count = malloc(sizeof(size_t));
+          *count = 0;
+          this->counts->set(this->counts, key, count);
+     }
+     *count += n;
+}
+
+static void output_graph_stream(output_graph_t *this, input_file_t *file, int index, entry_t *entry) {
+     struct tm current = {0,};
+
+     entry_time(this, &current, entry);
+     if (index == 0) {
+          graph_start(this, &current);
+     }
+     graph_count(this, &current, 1);
+}
+
+/*
+ * Entries usually come in time order: each run of entries in the same
+ * unit of time is counted at once.
+ */
+static void graph_count_run(output_graph_t *this, int64_t packed, size_t run) {
+     struct tm current = {0,};
+     if (run > 0) {
+          packed_time(this, &current, packed);
+          graph_count(this, &current, run);
+     }
+}
+
+static void graph_columns(output_graph_t *this, input_file_t *file, const columns_t *columns) {
+     int64_t packed, first = 0;
+     size_t i, run = 0;
+
+     for (i = 0; i < columns->length; i++) {
+          packed = columns->times[i];
+          if (run > 0 && packed != NO_COLUMN_TIME && packed / this->column_unit == first / this->column_unit) {
+               run++;
+          } else {
+               graph_count_run(this, first, run);
+               run = 0;
+               if (i == 0 || packed == NO_COLUMN_TIME) {
+                    output_graph_stream(this, file, i, file->ops->entry(file, i));
+               } else {
+                    first = packed;
+                    run = 1;
+               }
+          }
+     }
+     graph_count_run(this, first, run);
+}
+
+/*
+ * State: the counts are saved with the start of the graph.
+ */
+
+static void graph_save_count(cad_hash_t *counts, int index, const char *key, size_t *count, FILE *out) {
+     state_write_string(out, key);
+     state_write_number(out, *count);
+}
+
+static void output_graph_save_state(output_graph_t *this, FILE *out) {
+     state_write_string(out, this->unit);
+     state_write_number(out, this->options.year);
+     state_write_number(out, this->has_start);
+     state_write_number(out, this->start.tm_year);
+     state_write_number(out, this->start.tm_mon);
+     state_write_number(out, this->start.tm_mday);
+     state_write_number(out, this->start.tm_hour);
+     state_write_number(out, this->start.tm_min);
+     state_write_number(out, this->start.tm_sec);
+     state_write_number(out, this->counts->count(this->counts));
+     this->counts->iterate(this->counts, (cad_hash_iterator_fn)graph_save_count, out);
+}
+
+static void graph_free_count(cad_hash_t *counts, int index, const char *key, size_t *count, void *data) {
+     free(count);
+}
+
+static bool_t output_graph_load_state(output_graph_t *this, FILE *in) {
+     cad_hash_t *counts;
+     struct tm start = {0,};
+     uint64_t year, has_start, tm[6], value, i, n;
+     size_t *count;
+     char *unit, *key;
+     bool_t result;
+
+     result = state_read_string(in, &unit) && unit != NULL && !strcmp(unit, this->unit)
+          && state_read_number(in, &year) && year == (uint64_t)this->options.year
+          && state_read_number(in, &has_start);
+     for (i = 0; result && i < 6; i++) {
+          result = state_read_number(in, tm + i);
+     }
+     result = result && state_read_number(in, &n);
+     free(unit);
+     if (!result) {
+          this->log(warn, "State not saved by a %s graph output with the same options\n", this->unit);
+          return false;
+     }
+     start.tm_year = tm[0];
+     start.tm_mon  = tm[1];
+     start.tm_mday = tm[2];
+     start.tm_hour = tm[3];
+     start.tm_min  = tm[4];
+     start.tm_sec  = tm[5];
+     start.tm_isdst = -1;
+
+     counts = cad_new_hash(stdlib_memory, cad_hash_strings);
+     for (i = 0; result && i < n; i++) {
+          result = state_read_string(in, &key) && key != NULL && state_read_number(in, &value);
+          if (result) {
+               count = malloc(sizeof(size_t));
+               *count = value;
+               counts->set(counts, key, count);
+          }
+          free(key);
+     }
+
+     if (!result) {
+          counts->iterate(counts, (cad_hash_iterator_fn)graph_free_count, NULL);
+          counts->free(counts);
+          return false;
+     }
+
+     this->counts->iterate(this->counts, (cad_hash_iterator_fn)graph_free_count, NULL);
+     this->counts->free(this->counts);
+     this->counts = counts;
+     this->has_start = has_start != 0;
+     this->start = start;
+     return true;
+}
+
+static void graph_free_value(cad_hash_t *dict, int index, const char *key, double *value, void *data) {
+     free(value);
+}
+
 static void output_graph_prepare(output_graph_t *this) {
      struct tm current = {0,};
-     bool_t is_first = true;
      input_file_t *file;
-     entry_t *entry;
-     int i, n = this->input->files_length(this->input), j, m;
+     const columns_t *columns;
+     int i, n = this->input->files_length(this->input);
+     char date[DATE_SIZE];
      const char *key;
      double *value;
-
-     this->start = this->middle = this->end = current;
-
-     for (i = 0; i < n; i++) {
-          file = this->input->file(this->input, i);
-          if (file->entries_length(file) > 0) {
-               entry = file->entry(file, 0);
-               this->time(this, &current, entry);
-               if (is_first || (difftime(mktime(&current), mktime(&this->start)) < 0)) {
-                    this->start = current;
+     size_t *count;
+
+     if (!this->options.stream) {
+          for (i = 0; i < n; i++) {
+               file = this->input->file(this->input, i);
+               columns = file->ops->columns(file, column_time);
+               if (columns != NULL) {
+                    graph_columns(this, file, columns);
                }
-               is_first = false;
           }
      }
 
+     /* prepared again in follow mode */
+     if (this->dict->count(this->dict) > 0) {
+          this->dict->iterate(this->dict, (cad_hash_iterator_fn)graph_free_value, NULL);
+          this->dict->free(this->dict);
+          this->dict = cad_new_hash(stdlib_memory, cad_hash_strings);
+     }
+
+     if (!this->has_start) {
+          this->start = current;
+     }
+     this->middle = this->end = current;
+
      current = this->start;
      for (i = 0; i < this->duration; i++) {
           if (i > 0) {
@@ -113,10 +310,12 @@ static void output_graph_prepare(output_graph_t *this) {
           if (i == this->duration / 2) {
                this->middle = current;
           }
-          key = strdate(&current);
+          key = strdate(&current, date);
+          count = this->counts->get(this->counts, key);
           value = malloc(sizeof(double));
-          *value = 0.0;
+          *value = count == NULL ? 0.0 : (double)*count;
           this->dict->set(this->dict, key, value);
+          free(this->keys[i]);
           this->keys[i] = strdup(key);
      }
      this->end = current;
@@ -127,19 +326,7 @@ static void output_graph_prepare(output_graph_t *this) {
           this->log(debug, "%4d\t%s\n", i+1, this->keys[i]);
      }
 
-     for (i = 0; i < n; i++) {
-          file = this->input->file(this->input, i);
-          m = file->entries_length(file);
-          for (j = 0; j < m;j++) {
-               entry = file->entry(file, j);
-               this->time(this, &current, entry);
-               key = strdate(&current);
-               value = this->dict->get(this->dict, key);
-               if (value != NULL) {
-                    *value = (*value) + 1;
-               }
-          }
-     }
+     this->max = 0;
      this->dict->iterate(this->dict, (cad_hash_iterator_fn)graph_prepare_max, this);
      this->minz = this->minh = this->max;
      this->dict->iterate(this->dict, (cad_hash_iterator_fn)graph_prepare_minz, this);
@@ -186,12 +373,14 @@ static void output_graph_display(output_graph_t *this) {
      char char_scale[4];
      char char_scaletick[4];
      char str_scale[64];
-     int y, i, p;
+     int y, i, p = 0;
      char c_scale     = this->options.exp_mode ? '-' : '#';
      char c_scaletick = this->options.exp_mode ? '|' : '#';
 
      int graph_position_start, graph_position_middle, graph_position_end;
      int graph_width;
+     char start[DATE_SIZE];
+     char end[DATE_SIZE];
      const char *key;
      double *value;
 
@@ -204,7 +393,7 @@ static void output_graph_display(output_graph_t *this) {
 
      scale = (this->max - this->minz) / graph.height;
 
-     this->log(info, "Graph: dates from %sto %s-- occurrences between %.4g and %.4g\n", strdate(&(this->start)), strdate(&(this->end)), graph.min, graph.max);
+     this->log(info, "Graph: dates from %sto %s-- occurrences between %.4g and %.4g\n", strdate(&(this->start), start), strdate(&(this->end), end), graph.min, graph.max);
 
      for (i = 0; i < this->duration; i++) {
           key = this->keys[i];
@@ -317,8 +506,8 @@ static void output_graph_display(output_graph_t *this) {
      printf("%s\n", color_off);
 
      fputc('\n', stdout);
-     printf("%sStart Time:%s\t%s\t\t%sMinimum Value:%s %g\n", color_caption, color_off, strdate(&(this->start)), color_caption, color_off, this->minz);
-     printf("%sEnd Time:%s\t%s\t\t%sMaximum Value:%s %g\n", color_caption, color_off, strdate(&(this->end)), color_caption, color_off, this->max);
+     printf("%sStart Time:%s\t%s\t\t%sMinimum Value:%s %g\n", color_caption, color_off, strdate(&(this->start), start), color_caption, color_off, this->minz);
+     printf("%sEnd Time:%s\t%s\t\t%sMaximum Value:%s %g\n", color_caption, color_off, strdate(&(this->end), end), color_caption, color_off, this->max);
      printf("%sDuration:%s\t%d %ss \t\t\t%sScale:%s %.12g%s\n", color_caption, color_off, this->duration, this->unit, color_caption, color_off, scale, (scale == (int)scale) ? ".0" : "");
      fputc('\n', stdout);
 }
@@ -337,6 +526,7 @@ static options_set_t output_graph_options_set(output_graph_t *this) {
           .exp_mode = true,
           .dev = false,
           .color = true,
+          .stream = true,
      };
      return result;
 }
@@ -367,20 +557,26 @@ static output_t output_graph_fn = {
      .options_set = (output_options_set_fn)output_graph_options_set,
      .default_options = (output_default_options_fn)output_graph_default_options,
      .set_options = (output_set_options_fn)output_graph_set_options,
+     .stream = (output_stream_fn)output_graph_stream,
+     .save_state = (output_save_state_fn)output_graph_save_state,
+     .load_state = (output_load_state_fn)output_graph_load_state,
      .prepare = (output_prepare_fn)output_graph_prepare,
      .display = (output_display_fn)output_graph_display,
 };
 
-static output_t *new_output_graph(logger_t log, input_t *input, const char *unit, int duration, time_fn time, increment_time_fn increment_time, value_fn value) {
+static output_t *new_output_graph(logger_t log, input_t *input, const char *unit, int duration, int64_t column_unit, time_fn time, increment_time_fn increment_time, value_fn value) {
      output_graph_t *result = malloc(sizeof(output_graph_t));
      result->fn = output_graph_fn;
      result->log = log;
      result->input = input;
      result->unit = unit;
      result->duration = duration;
+     result->column_unit = column_unit;
      result->time = time;
      result->increment_time = increment_time;
      result->value = value;
+     result->counts = cad_new_hash(stdlib_memory, cad_hash_strings);
+     result->has_start = false;
      result->dict = cad_new_hash(stdlib_memory, cad_hash_strings);
      result->minh = result->minz = result->max = 0;
      result->keys = malloc(duration * sizeof(char*));
@@ -398,22 +594,8 @@ static void normalize_time(struct tm*time) {
      *time = *ltime;
 }
 
-static int year(output_graph_t *this, entry_t *entry) {
-     int result = entry->year(entry);
-     if (result == 0) {
-          result = this->options.year;
-     }
-     return result - 1900;
-}
-
-static void second_time(output_graph_t *this, struct tm *time, entry_t *entry) {
-     time->tm_sec  = entry->second(entry);
-     time->tm_min  = entry->minute(entry);
-     time->tm_hour = entry->hour(entry);
-     time->tm_mday = entry->day(entry);
-     time->tm_mon  = entry->month(entry) - 1;
-     time->tm_year = year(this, entry);
-     time->tm_isdst = -1;
+static void second_time(struct tm *time) {
+     /* nothing to truncate */
 }
 
 static void second_increment_time(struct tm*time) {
@@ -425,14 +607,8 @@ static int second_value(struct tm*time) {
      return time->tm_sec;
 }
 
-static void minute_time(output_graph_t *this, struct tm *time, entry_t *entry) {
+static void minute_time(struct tm *time) {
      time->tm_sec  = 0;
-     time->tm_min  = entry->minute(entry);
-     time->tm_hour = entry->hour(entry);
-     time->tm_mday = entry->day(entry);
-     time->tm_mon  = entry->month(entry) - 1;
-     time->tm_year = year(this, entry);
-     time->tm_isdst = -1;
 }
 
 static void minute_increment_time(struct tm*time) {
@@ -444,14 +620,9 @@ static int minute_value(struct tm*time) {
      return time->tm_min;
 }
 
-static void hour_time(output_graph_t *this, struct tm *time, entry_t *entry) {
+static void hour_time(struct tm *time) {
      time->tm_sec  = 0;
      time->tm_min  = 0;
-     time->tm_hour = entry->hour(entry);
-     time->tm_mday = entry->day(entry);
-     time->tm_mon  = entry->month(entry) - 1;
-     time->tm_year = year(this, entry);
-     time->tm_isdst = -1;
 }
 
 static void hour_increment_time(struct tm*time) {
@@ -463,14 +634,10 @@ static int hour_value(struct tm*time) {
      return time->tm_hour;
 }
 
-static void day_time(output_graph_t *this, struct tm *time, entry_t *entry) {
+static void day_time(struct tm *time) {
      time->tm_sec  = 0;
      time->tm_min  = 0;
      time->tm_hour = 0;
-     time->tm_mday = entry->day(entry);
-     time->tm_mon  = entry->month(entry) - 1;
-     time->tm_year = year(this, entry);
-     time->tm_isdst = -1;
 }
 
 static void day_increment_time(struct tm*time) {
@@ -482,14 +649,11 @@ static int day_value(struct tm*time) {
      return time->tm_mday;
 }
 
-static void month_time(output_graph_t *this, struct tm *time, entry_t *entry) {
+static void month_time(struct tm *time) {
      time->tm_sec  = 0;
      time->tm_min  = 0;
      time->tm_hour = 0;
      time->tm_mday = 1;
-     time->tm_mon  = entry->month(entry) - 1;
-     time->tm_year = year(this, entry);
-     time->tm_isdst = -1;
 }
 
 static void month_increment_time(struct tm*time) {
@@ -501,14 +665,12 @@ static int month_value(struct tm*time) {
      return time->tm_mon + 1;
 }
 
-static void year_time(output_graph_t *this, struct tm *time, entry_t *entry) {
+static void year_time(struct tm *time) {
      time->tm_sec  = 0;
      time->tm_min  = 0;
      time->tm_hour = 0;
      time->tm_mday = 1;
      time->tm_mon  = 0;
-     time->tm_year = year(this, entry);
-     time->tm_isdst = -1;
 }
 
 static void year_increment_time(struct tm*time) {
@@ -521,25 +683,25 @@ static int year_value(struct tm*time) {
 }
 
 output_t *new_output_sgraph(logger_t log, input_t *input) {
-     return new_output_graph(log, input, "second", 60, second_time, second_increment_time, second_value);
+     return new_output_graph(log, input, "second", 60, COLUMN_TIME_UNIT(0), second_time, second_increment_time, second_value);
 }
 
 output_t *new_output_mgraph(logger_t log, input_t *input) {
-     return new_output_graph(log, input, "minute", 60, minute_time, minute_increment_time, minute_value);
+     return new_output_graph(log, input, "minute", 60, COLUMN_TIME_UNIT(1), minute_time, minute_increment_time, minute_value);
 }
 
 output_t *new_output_hgraph(logger_t log, input_t *input) {
-     return new_output_graph(log, input, "hour", 24, hour_time, hour_increment_time, hour_value);
+     return new_output_graph(log, input, "hour", 24, COLUMN_TIME_UNIT(2), hour_time, hour_increment_time, hour_value);
 }
 
 output_t *new_output_dgraph(logger_t log, input_t *input) {
-     return new_output_graph(log, input, "day", 31, day_time, day_increment_time, day_value);
+     return new_output_graph(log, input, "day", 31, COLUMN_TIME_UNIT(3), day_time, day_increment_time, day_value);
 }
 
 output_t *new_output_mograph(logger_t log, input_t *input) {
-     return new_output_graph(log, input, "month", 12, month_time, month_increment_time, month_value);
+     return new_output_graph(log, input, "month", 12, COLUMN_TIME_UNIT(4), month_time, month_increment_time, month_value);
 }
 
 output_t *new_output_ygraph(logger_t log, input_t *input) {
-     return new_output_graph(log, input, "year", 10, year_time, year_increment_time, year_value);
+     return new_output_graph(log, input, "year", 10, COLUMN_TIME_UNIT(5), year_time, year_increment_time, year_value);
 }
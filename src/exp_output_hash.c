@@ -34,8 +34,10 @@
 #include "exp_filter.h"
 #include "exp_fingerprint.h"
 #include "exp_file.h"
+#include "exp_state.h"
 
 #define SAMPLE_THRESHOLD 3
+#define SAMPLE_SEED 1
 
 typedef struct output_hash_s output_hash_t;
 struct output_hash_s {
@@ -44,17 +46,20 @@ struct output_hash_s {
      logger_t log;
      input_t *input;
      options_t options;
-     filter_t **filters;
+     cad_hash_t *filters;
      cad_hash_t *dict;
      size_t max_count;
      fingerprint_t *fingerprint;
      size_t meancount;
      size_t devcount;
-     void (*fill)(output_hash_t*,input_file_t*,filter_t*);
+     void (*fill)(output_hash_t*,entry_t*,filter_t*);
+     int column;
+     unsigned int seed;
 };
 
 typedef struct {
-     cad_array_t *entries;
+     size_t count;
+     char *sample;
      char key[0];
 } dict_entry_t;
 
@@ -68,12 +73,15 @@ typedef struct {
 
 typedef void (*fingerprint_iterator_fn)(const char *key, fingerprint_data_t *data);
 
-static const char *hash_key(entry_t *entry) {
+/*
+ * The buffer is used only if the key is not the logline itself; it
+ * must be at least MAX_LINE_SIZE long.
+ */
+static const char *hash_key(entry_t *entry, char *buffer) {
      const char *result;
-     static char buffer[MAX_LINE_SIZE];
      const char *daemon, *logline;
-     daemon = entry->daemon(entry);
-     logline = entry->logline(entry);
+     daemon = entry->ops->daemon(entry);
+     logline = entry->ops->logline(entry);
      if (logline == NULL) {
           result = "#";
      } else if (daemon == NULL || daemon[0] == '\0') {
@@ -85,17 +93,42 @@ static const char *hash_key(entry_t *entry) {
      return result;
 }
 
-static void fingerprint_iterate(input_file_t *file, filter_t *filter, fingerprint_iterator_fn iterator, fingerprint_data_t *data) {
+/*
+ * The filter depends on the factory that analyzed the entry, which is
+ * not always the one of its file (see new_mixed_factory).
+ */
+static filter_t *hash_filter(output_hash_t *this, entry_t *entry) {
+     const char *name = entry->ops->get_name(entry);
+     filter_t *result = this->filters->get(this->filters, name);
+     char filename[128];
+     if (result == NULL) {
+          result = new_filter(this->log, this->options.filter_extradirs, this->options.limits);
+          if (this->options.filter) {
+               snprintf(filename, 128, "%s.%s.stopwords", this->type, name);
+               result->extend(result, filename, NULL);
+               snprintf(filename, 128, "%s.stopwords", this->type);
+               result->extend(result, filename, "#");
+          }
+          this->filters->set(this->filters, name, result);
+     }
+     return result;
+}
+
+static void fingerprint_iterate(output_hash_t *this, input_file_t *file, fingerprint_iterator_fn iterator, fingerprint_data_t *data) {
      /*
       * Quick'n'dirty way to iterate over unique keys of one file
       */
      entry_t *entry;
-     int i, n = file->entries_length(file);
+     filter_t *filter;
+     int i, n = file->ops->entries_length(file);
      const char *key;
+     char keybuf[MAX_LINE_SIZE];
+     char scrubbuf[MAX_LINE_SIZE];
      cad_hash_t *dict = cad_new_hash(stdlib_memory, cad_hash_strings);
      for (i = 0; i < n; i++) {
-          entry = file->entry(file, i);
-          key = filter->scrub(filter, hash_key(entry));
+          entry = file->ops->entry(file, i);
+          filter = hash_filter(this, entry);
+          key = filter->scrub(filter, hash_key(entry, keybuf), scrubbuf);
           if (dict->get(dict, key) == NULL) {
                iterator(key, data);
                dict->set(dict, key, entry);
@@ -117,41 +150,57 @@ static void fingerprint_file_del_key(const char *key, fingerprint_data_t *data)
      }
 }
 
-static int hash_increment(output_hash_t *this, const char *key, entry_t *value) {
+static int hash_increment(output_hash_t *this, const char *key, const char *sample) {
      dict_entry_t *entry = this->dict->get(this->dict, key);
-     int count;
+     size_t count;
      if (entry == NULL) {
           entry = malloc(sizeof(dict_entry_t) + strlen(key) + 1);
-          entry->entries = cad_new_array(stdlib_memory, sizeof(entry_t *));
+          entry->count = 0;
+          entry->sample = NULL;
           strcpy(entry->key, key);
           this->dict->set(this->dict, key, entry);
      }
-     count = entry->entries->count(entry->entries);
-     entry->entries->insert(entry->entries, count, &value);
-     count++; // = entry->entries->count(entry->entries);
+     count = ++(entry->count);
+     switch(this->options.sample) {
+     case sample_none:
+          break;
+     case sample_threshold:
+          /* keep the first entry */
+          if (entry->sample == NULL) {
+               entry->sample = strdup(sample);
+          }
+          break;
+     case sample_all:
+          /* keep a random entry (reservoir sampling); the seed is fixed
+           * so that the same input always shows the same samples */
+          if (rand_r(&(this->seed)) % count == 0) {
+               free(entry->sample);
+               entry->sample = strdup(sample);
+          }
+          break;
+     }
      if (count > this->max_count) {
           this->max_count = count;
      }
      return count;
 }
 
+static void dict_entry_free(dict_entry_t *entry) {
+     free(entry->sample);
+     free(entry);
+}
+
 static void fingerprint_increment(output_hash_t *this, input_file_t *fingerprint_file) {
      /*
       * Called from the fingerprint output, add the fingerprint key
       */
-     entry_factory_t *factory;
-     entry_t *fingerprint_entry;
-     line_t *fingerprint_line;
      char buffer[MAX_LINE_SIZE];
      const char *filename;
 
-     factory = entry_factory_named("raw");
-     strcpy(buffer, fingerprint_file->get_name(fingerprint_file));
+     strcpy(buffer, fingerprint_file->ops->get_name(fingerprint_file));
      filename = basename(buffer);
      this->log(info, "Adding fingerprint: %s\n", filename);
-     fingerprint_line = new_line(strlen(filename), filename);
-     fingerprint_entry = factory->new_entry(factory, fingerprint_line);
-     hash_increment(this, filename, fingerprint_entry);
+     hash_increment(this, filename, filename);
 }
 
 static bool_t output_hash_fingerprint_file(output_hash_t *this, int index, output_hash_t *data) {
@@ -168,16 +217,15 @@ static bool_t output_hash_fingerprint_file(output_hash_t *this, int index, outpu
           .data = data,
      };
      input_file_t *file = this->input->file(this->input, index);
-     filter_t *filter = this->filters[index];
      size_t threshold;
 
-     fingerprint_iterate(file, filter, fingerprint_file_count, &fingerprint);
+     fingerprint_iterate(this, file, fingerprint_file_count, &fingerprint);
      threshold = (int)floor(THRESHOLD_COEFFICIENT * (double)fingerprint.fgcount);
-     this->log(debug, "Threshold %s: %lu/%lu\n", file->get_name(file), (unsigned long)threshold, (unsigned long)fingerprint.fgcount);
+     this->log(debug, "Threshold %s: %lu/%lu\n", file->ops->get_name(file), (unsigned long)threshold, (unsigned long)fingerprint.fgcount);
 
      if (fingerprint.count > threshold) {
-          this->log(debug, "Found fingerprint (%lu > %lu): %s\n", (unsigned long)fingerprint.count, (unsigned long)threshold, file->get_name(file));
-          fingerprint_iterate(file, filter, fingerprint_file_del_key, &fingerprint);
+          this->log(debug, "Found fingerprint (%lu > %lu): %s\n", (unsigned long)fingerprint.count, (unsigned long)threshold, file->ops->get_name(file));
+          fingerprint_iterate(this, file, fingerprint_file_del_key, &fingerprint);
           fingerprint_increment(data, file);
           this->log(debug, "Removed %lu keys\n", (unsigned long)fingerprint.delcount);
           result = true;
@@ -188,126 +236,214 @@ static bool_t output_hash_fingerprint_file(output_hash_t *this, int index, outpu
      return result;
 }
 
-static void hash_fill_(output_hash_t *this, input_file_t *file, filter_t *filter) {
-     int i, n = file->entries_length(file);
-     entry_t *entry;
+static void hash_fill_(output_hash_t *this, entry_t *entry, filter_t *filter) {
      const char *line, *key;
-     for (i = 0; i < n; i++) {
-          entry = file->entry(file, i);
-          line = hash_key(entry);
-          key = filter->scrub(filter, line);
-          this->log(debug, "SCRUB|%s|%s|\n", line, key);
-          hash_increment(this, key, entry);
-     }
+     char keybuf[MAX_LINE_SIZE];
+     char scrubbuf[MAX_LINE_SIZE];
+     line = hash_key(entry, keybuf);
+     key = filter->scrub(filter, line, scrubbuf);
+     this->log(debug, "SCRUB|%s|%s|\n", line, key);
+     hash_increment(this, key, entry->ops->logline(entry));
 }
 
-static void wordcount_fill_(output_hash_t *this, input_file_t *file, filter_t *filter) {
-     int i, n = file->entries_length(file), inc;
-     entry_t *entry;
+static void wordcount_fill_(output_hash_t *this, entry_t *entry, filter_t *filter) {
+     const char *logline = entry->ops->logline(entry);
      char keybuf[MAX_LINE_SIZE];
      char *key, *next;
      bool_t full;
-     for (i = 0; i < n; i++) {
-          entry = file->entry(file, i);
-          this->log(info, "Wordcount %d/%d | %s\n", i+1, n, entry->logline(entry));
-          strcpy(keybuf, filter->scrub(filter, entry->logline(entry)));
-          key = next = keybuf;
-          this->log(debug, "Wordcount fill | %s | %s\n", entry->logline(entry), key);
-          full = false;
-          while (*next) {
-               switch(*next) {
-               case ' ':
-               case '\t':
-                    if (full) {
-                         *next = '\0';
-                         inc = hash_increment(this, key, entry);
-                         this->log(debug, " <%d> %s\n", inc, key);
-                         full = false;
-                    }
-                    key = next + 1;
-                    break;
-               default:
-                    full = true;
-                    break;
+     int inc;
+     this->log(info, "Wordcount | %s\n", logline);
+     filter->scrub(filter, logline, keybuf);
+     key = next = keybuf;
+     this->log(debug, "Wordcount fill | %s | %s\n", logline, key);
+     full = false;
+     while (*next) {
+          switch(*next) {
+          case ' ':
+          case '\t':
+               if (full) {
+                    *next = '\0';
+                    inc = hash_increment(this, key, logline);
+                    this->log(debug, " <%d> %s\n", inc, key);
+                    full = false;
                }
-               next++;
-          }
-          if (full) {
-               inc = hash_increment(this, key, entry);
-               this->log(debug, " <%d> %s\n", inc, key);
+               key = next + 1;
+               break;
+          default:
+               full = true;
+               break;
           }
+          next++;
+     }
+     if (full) {
+          inc = hash_increment(this, key, logline);
+          this->log(debug, " <%d> %s\n", inc, key);
      }
 }
 
-static void daemon_fill_(output_hash_t *this, input_file_t *file, filter_t *filter) {
-     int i, n = file->entries_length(file);
-     entry_t *entry;
-     const char *key;
-     for (i = 0; i < n; i++) {
-          entry = file->entry(file, i);
-          key = filter->scrub(filter, entry->daemon(entry));
-          hash_increment(this, key, entry);
+static void daemon_fill_(output_hash_t *this, entry_t *entry, filter_t *filter) {
+     char scrubbuf[MAX_LINE_SIZE];
+     const char *key = filter->scrub(filter, entry->ops->daemon(entry), scrubbuf);
+     hash_increment(this, key, entry->ops->logline(entry));
+}
+
+static void host_fill_(output_hash_t *this, entry_t *entry, filter_t *filter) {
+     char scrubbuf[MAX_LINE_SIZE];
+     const char *key = filter->scrub(filter, entry->ops->host(entry), scrubbuf);
+     int inc = hash_increment(this, key, entry->ops->logline(entry));
+     this->log(debug, "Host | %s | %s <%d>\n", entry->ops->host(entry), key, inc);
+}
+
+static void output_hash_stream(output_hash_t *this, input_file_t *file, int index, entry_t *entry) {
+     this->fill(this, entry, hash_filter(this, entry));
+}
+
+/*
+ * State: the dictionary is saved with the options that make its keys.
+ */
+
+static void hash_save_entry(cad_hash_t *dict, int index, const char *key, dict_entry_t *value, FILE *out) {
+     state_write_string(out, value->key);
+     state_write_number(out, value->count);
+     state_write_string(out, value->sample);
+}
+
+static void output_hash_save_state(output_hash_t *this, FILE *out) {
+     state_write_string(out, this->type);
+     state_write_number(out, this->options.filter);
+     state_write_number(out, this->options.sample);
+     state_write_number(out, this->dict->count(this->dict));
+     this->dict->iterate(this->dict, (cad_hash_iterator_fn)hash_save_entry, out);
+}
+
+static void hash_free_entry(cad_hash_t *dict, int index, const char *key, dict_entry_t *value, void *data) {
+     dict_entry_free(value);
+}
+
+static bool_t output_hash_load_state(output_hash_t *this, FILE *in) {
+     cad_hash_t *dict;
+     dict_entry_t *entry;
+     char *type, *key, *sample;
+     uint64_t filter, sample_type, count, i, n;
+     size_t max_count = 0;
+     bool_t result;
+
+     result = state_read_string(in, &type) && type != NULL && !strcmp(type, this->type)
+          && state_read_number(in, &filter) && filter == (uint64_t)this->options.filter
+          && state_read_number(in, &sample_type) && sample_type == (uint64_t)this->options.sample
+          && state_read_number(in, &n);
+     free(type);
+     if (!result) {
+          this->log(warn, "State not saved by a %s output with the same options\n", this->type);
+          return false;
      }
+
+     dict = cad_new_hash(stdlib_memory, cad_hash_strings);
+     for (i = 0; result && i < n; i++) {
+          result = state_read_string(in, &key) && key != NULL
+               && state_read_number(in, &count)
+               && state_read_string(in, &sample);
+          if (result) {
+               entry = malloc(sizeof(dict_entry_t) + strlen(key) + 1);
+               entry->count = count;
+               entry->sample = sample;
+               strcpy(entry->key, key);
+               dict->set(dict, key, entry);
+               if (count > max_count) {
+                    max_count = count;
+               }
+          }
+          free(key);
+     }
+
+     if (!result) {
+          dict->iterate(dict, (cad_hash_iterator_fn)hash_free_entry, NULL);
+          dict->free(dict);
+          return false;
+     }
+
+     this->dict->iterate(this->dict, (cad_hash_iterator_fn)hash_free_entry, NULL);
+     this->dict->free(this->dict);
+     this->dict = dict;
+     this->max_count = max_count;
+     this->meancount = this->devcount = 0;
+     return true;
 }
 
-static void host_fill_(output_hash_t *this, input_file_t *file, filter_t *filter) {
-     int i, n = file->entries_length(file), inc;
+/*
+ * Hosts and daemons are few: each one is scrubbed once per file (and
+ * per filter), found by its index in the column.
+ */
+static void hash_fill_column(output_hash_t *this, input_file_t *file, const columns_t *columns) {
+     const uint32_t *indexes = this->column == column_host ? columns->hosts : columns->daemons;
+     filter_t **filters = calloc(columns->strings_length, sizeof(filter_t*));
+     char **keys = calloc(columns->strings_length, sizeof(char*));
+     char scrubbuf[MAX_LINE_SIZE];
      entry_t *entry;
-     const char *key;
-     for (i = 0; i < n; i++) {
-          entry = file->entry(file, i);
-          key = filter->scrub(filter, entry->host(entry));
-          inc = hash_increment(this, key, entry);
-          this->log(debug, "Host %d/%d | %s | %s <%d>\n", i+1, n, entry->host(entry), key, inc);
+     filter_t *filter;
+     uint32_t index;
+     size_t i;
+     int inc;
+
+     for (i = 0; i < columns->length; i++) {
+          entry = file->ops->entry(file, i);
+          filter = hash_filter(this, entry);
+          index = indexes[i];
+          if (filters[index] != filter) {
+               free(keys[index]);
+               keys[index] = strdup(filter->scrub(filter, columns->strings[index], scrubbuf));
+               filters[index] = filter;
+          }
+          inc = hash_increment(this, keys[index], entry->ops->logline(entry));
+          if (this->column == column_host) {
+               this->log(debug, "Host | %s | %s <%d>\n", columns->strings[index], keys[index], inc);
+          }
      }
+
+     for (i = 0; i < columns->strings_length; i++) {
+          free(keys[i]);
+     }
+     free(keys);
+     free(filters);
 }
 
 static void hash_fill(output_hash_t *this) {
      int i, n = this->input->files_length(this->input);
+     int j, m;
      input_file_t *file;
-     filter_t *filter;
-     dict_entry_t *entry;
+     const columns_t *columns;
 
      for (i = 0; i < n; i++) {
           file = this->input->file(this->input, i);
-          filter = this->filters[i];
-          this->fill(this, file, filter);
-     }
-
-     entry = this->dict->del(this->dict, "#");
-     if (entry != NULL) {
-          entry->entries->free(entry->entries);
-          free(entry);
+          columns = this->column == 0 ? NULL : file->ops->columns(file, this->column);
+          if (columns != NULL) {
+               hash_fill_column(this, file, columns);
+          } else {
+               m = file->ops->entries_length(file);
+               for (j = 0; j < m; j++) {
+                    output_hash_stream(this, file, j, file->ops->entry(file, j));
+               }
+          }
      }
 }
 
 static void hash_calculate_stats(cad_hash_t *dict, int index, const char *key, dict_entry_t *value, output_hash_t *this) {
-     size_t count = value->entries->count(value->entries);
+     size_t count = value->count;
      this->meancount += count;
      this->devcount += count * count;
 }
 
 static void output_hash_prepare(output_hash_t *this) {
-     int i, n = this->input->files_length(this->input);
-     input_file_t *file;
-     entry_factory_t *factory;
-     filter_t *filter;
-     char filename[128];
+     dict_entry_t *entry;
 
-     this->filters = malloc(n * sizeof(filter_t*));
-     for (i = 0; i < n; i++) {
-          file = this->input->file(this->input, i);
-          factory = file->get_factory(file);
-          this->filters[i] = filter = new_filter(this->log, this->options.filter_extradirs);
-          if (this->options.filter) {
-               snprintf(filename, 128, "%s.%s.stopwords", this->type, factory->get_name(factory));
-               filter->extend(filter, filename, NULL);
-               snprintf(filename, 128, "%s.stopwords", this->type);
-               filter->extend(filter, filename, "#");
-          }
+     if (!this->options.stream) {
+          hash_fill(this);
      }
 
-     hash_fill(this);
+     entry = this->dict->del(this->dict, "#");
+     if (entry != NULL) {
+          dict_entry_free(entry);
+     }
 
      if (this->options.fingerprint) {
           this->fingerprint->run(this->fingerprint, this);
@@ -327,17 +463,16 @@ typedef struct {
 } dict_sort_buf ;
 
 static void hash_display_fill_buf(cad_hash_t *dict, int index, const char *key, dict_entry_t *value, dict_sort_buf *buf) {
-     if (value->entries->count(value->entries) == buf->count) {
+     if (value->count == buf->count) {
           buf->entries[buf->n++] = value;
      }
 }
 
 static void hash_display_count(output_hash_t *this, size_t count) {
-     int i, r;
+     int i;
      dict_entry_t **entries = malloc(this->dict->count(this->dict) * sizeof(dict_entry_t*));
      dict_sort_buf buf = { count, 0, entries };
      dict_entry_t *dictentry;
-     entry_t *entry;
      const char *color_on  = this->options.color ? DARK_GREEN : "";
      const char *color_off = this->options.color ? OFF : "";
 
@@ -352,16 +487,13 @@ static void hash_display_count(output_hash_t *this, size_t count) {
                     break;
                case sample_threshold:
                     if (count <= SAMPLE_THRESHOLD) {
-                         entry = *(entry_t **)dictentry->entries->get(dictentry->entries, 0);
-                         printf("%s%lu%s:\t%s\n", color_on, (unsigned long)count, color_off, entry->logline(entry));
+                         printf("%s%lu%s:\t%s\n", color_on, (unsigned long)count, color_off, dictentry->sample);
                     } else {
                          printf("%s%lu%s:\t%s\n", color_on, (unsigned long)count, color_off, dictentry->key);
                     }
                     break;
                case sample_all:
-                    r = rand() % count;
-                    entry = *(entry_t **)dictentry->entries->get(dictentry->entries, r);
-                    printf("%s%lu%s:\t%s\n", color_on, (unsigned long)count, color_off, entry->logline(entry));
+                    printf("%s%lu%s:\t%s\n", color_on, (unsigned long)count, color_off, dictentry->sample);
                     break;
                }
           }
@@ -417,6 +549,7 @@ static options_set_t output_hash_options_set(output_hash_t *this) {
           .exp_mode = false,
           .dev = true,
           .color = true,
+          .stream = true,
      };
      return result;
 }
@@ -460,42 +593,48 @@ static output_t output_hash_fn = {
      .options_set = (output_options_set_fn)output_hash_options_set,
      .default_options = (output_default_options_fn)output_hash_default_options,
      .set_options = (output_set_options_fn)output_hash_set_options,
+     .stream = (output_stream_fn)output_hash_stream,
+     .save_state = (output_save_state_fn)output_hash_save_state,
+     .load_state = (output_load_state_fn)output_hash_load_state,
      .prepare = (output_prepare_fn)output_hash_prepare,
      .display = (output_display_fn)output_hash_display,
 };
 
-static output_t *new_output_(logger_t log, input_t *input, const char *type, void (*fill)(output_hash_t*,input_file_t*,filter_t*)) {
+static output_t *new_output_(logger_t log, input_t *input, const char *type, void (*fill)(output_hash_t*,entry_t*,filter_t*), int column) {
      output_hash_t *result = malloc(sizeof(output_hash_t));
      result->fn = output_hash_fn;
      result->type = type;
      result->log = log;
      result->input = input;
+     result->filters = cad_new_hash(stdlib_memory, cad_hash_strings);
      result->dict = cad_new_hash(stdlib_memory, cad_hash_strings);
      result->max_count = result->meancount = result->devcount = 0;
      result->fill = fill;
+     result->column = column;
+     result->seed = SAMPLE_SEED;
      result->fingerprint = NULL;
      memset(&(result->options), 0, sizeof(options_t));
      return &(result->fn);
 }
 
 output_t *new_output_hash(logger_t log, input_t *input) {
-     return new_output_(log, input, "hash", hash_fill_);
+     return new_output_(log, input, "hash", hash_fill_, 0);
 }
 
 output_t *new_output_wordcount(logger_t log, input_t *input) {
-     output_t *result = new_output_(log, input, "words", wordcount_fill_);
+     output_t *result = new_output_(log, input, "words", wordcount_fill_, 0);
      result->default_options = (output_default_options_fn)output_nothash_default_options;
      return result;
 }
 
 output_t *new_output_daemon(logger_t log, input_t *input) {
-     output_t *result = new_output_(log, input, "daemon", daemon_fill_);
+     output_t *result = new_output_(log, input, "daemon", daemon_fill_, column_daemon);
      result->default_options = (output_default_options_fn)output_nothash_default_options;
      return result;
 }
 
 output_t *new_output_host(logger_t log, input_t *input) {
-     output_t *result = new_output_(log, input, "host", host_fill_);
+     output_t *result = new_output_(log, input, "host", host_fill_, column_host);
      result->default_options = (output_default_options_fn)output_nothash_default_options;
      return result;
 }
@@ -24,6 +24,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "exp_log.h"
 #include "exp_regexp.h"
@@ -31,147 +34,407 @@
 typedef struct {
      regexp_t fn;
      logger_t log;
-     pcre *re;
-     pcre_extra *extra;
+     pcre2_code *re;
+     bool_t jit;
+     regexp_engine_t *engine;
+     const char *engine_name;
      char *regex;
-     int max_substrings;
+     int flags;
+     uint32_t groups;
+     uint32_t names_count;
+     uint32_t names_size;
+     PCRE2_SPTR names;
+     uint32_t match_limit;
+     uint32_t depth_limit;
+     bool_t counted;
+     uint64_t matches;
+     uint64_t limited;
+     uint64_t nanoseconds;
 } regexp_impl_t;
 
+/*
+ * The match data is kept from one match to the next; it is replaced,
+ * once, only by a pattern with more groups than any before. Engines
+ * write their offsets to its ovector too.
+ */
 typedef struct {
      match_t fn;
      regexp_impl_t *regexp;
      const char *string;
-     const char *sub;
-     int subsmax;
+     char *sub;
+     int subcapacity;
+     pcre2_match_data *data;
+     uint32_t pairs;
      int subslen;
-     int subs[0];
+     PCRE2_SIZE *subs;
+     bool_t limited;
+     regexp_workspace_t workspace;
 } match_impl_t;
 
-static const char *match_impl_substring(match_impl_t *this, int index) {
-     int status;
-     if (this->sub != NULL) {
-          pcre_free_substring(this->sub);
-          this->sub = NULL;
+/*
+ * The name table of PCRE: each entry is the group number on two bytes
+ * (most significant first) followed by the name; entries are sorted by
+ * name.
+ */
+static int regexp_impl_group(regexp_impl_t *this, const char *name) {
+     PCRE2_SPTR entry;
+     int low = 0, high = (int)this->names_count - 1, mid, cmp;
+     while (low <= high) {
+          mid = (low + high) / 2;
+          entry = this->names + mid * this->names_size;
+          cmp = strcmp(name, (const char *)entry + 2);
+          if (cmp == 0) {
+               return (entry[0] << 8) | entry[1];
+          }
+          if (cmp < 0) {
+               high = mid - 1;
+          } else {
+               low = mid + 1;
+          }
      }
-     status = pcre_get_substring(this->string, this->subs, this->subslen, index, &(this->sub));
-     if (status < 0) {
+     return -1;
+}
+
+static bool_t match_impl_span(match_impl_t *this, int index, int *start, int *length) {
+     if (index < 0 || (uint32_t)index > this->regexp->groups) {
+          return false;
+     }
+     if (index >= this->subslen || this->subs[2 * index] == PCRE2_UNSET) {
+          *start = *length = 0;
+     } else {
+          *start = (int)this->subs[2 * index];
+          *length = (int)this->subs[2 * index + 1] - *start;
+     }
+     return true;
+}
+
+static bool_t match_impl_named_span(match_impl_t *this, const char *name, int *start, int *length) {
+     return match_impl_span(this, regexp_impl_group(this->regexp, name), start, length);
+}
+
+/*
+ * Copies are made in a buffer of the match, grown as needed.
+ */
+static const char *match_impl_substring(match_impl_t *this, int index) {
+     int start, length;
+     if (index < 0 || index >= this->subslen || !match_impl_span(this, index, &start, &length)) {
           return NULL;
      }
+     if (length >= this->subcapacity) {
+          this->subcapacity = length + 1;
+          this->sub = realloc(this->sub, this->subcapacity);
+     }
+     memcpy(this->sub, this->string + start, length);
+     this->sub[length] = '\0';
      return this->sub;
 }
 
 static const char *match_impl_named_substring(match_impl_t *this, const char *name) {
-     int status;
-     if (this->sub != NULL) {
-          pcre_free_substring(this->sub);
-          this->sub = NULL;
-     }
-     status = pcre_get_named_substring(this->regexp->re, this->string, this->subs, this->subslen, name, &(this->sub));
-     if (status < 0) {
-          return NULL;
+     return match_impl_substring(this, regexp_impl_group(this->regexp, name));
+}
+
+static bool_t match_impl_limited(match_impl_t *this) {
+     return this->limited;
+}
+
+static void match_clean(match_impl_t *this) {
+     free(this->sub);
+     if (this->data != NULL) {
+          pcre2_match_data_free(this->data);
      }
-     return this->sub;
+     free(this->workspace.buffer);
 }
 
 static void match_impl_free(match_impl_t *this) {
-     if (this->sub != NULL) {
-          pcre_free_substring(this->sub);
-     }
+     match_clean(this);
      free(this);
 }
 
-static match_t match_impl_fn = {
+static const match_ops_t match_impl_ops = {
      .substring = (regexp_match_substring_fn)match_impl_substring,
      .named_substring = (regexp_match_named_substring_fn)match_impl_named_substring,
+     .span = (regexp_match_span_fn)match_impl_span,
+     .named_span = (regexp_match_named_span_fn)match_impl_named_span,
+     .limited = (regexp_match_limited_fn)match_impl_limited,
      .free = (regexp_match_free_fn)match_impl_free,
 };
 
+static void match_init(match_impl_t *this) {
+     this->fn.ops = &match_impl_ops;
+     this->regexp = NULL;
+     this->string = NULL;
+     this->sub = NULL;
+     this->subcapacity = 0;
+     this->data = NULL;
+     this->pairs = 0;
+     this->subslen = 0;
+     this->subs = NULL;
+     this->limited = false;
+     this->workspace.buffer = NULL;
+     this->workspace.size = 0;
+}
+
+match_t *new_match(void) {
+     match_impl_t *result = malloc(sizeof(match_impl_t));
+     match_init(result);
+     return &(result->fn);
+}
+
+/*
+ * Each thread has its own JIT stack (in a match context) and its own
+ * match for replace_all(); they are freed when the thread ends.
+ */
+
+#define JIT_STACK_START (32 * 1024)
+#define JIT_STACK_MAX (1024 * 1024)
+
+typedef struct {
+     pcre2_jit_stack *stack;
+     pcre2_match_context *context;
+     match_impl_t match;
+} thread_regexp_t;
+
+static pthread_key_t thread_regexp_key;
+static pthread_once_t thread_regexp_once = PTHREAD_ONCE_INIT;
+static __thread thread_regexp_t *current_thread_regexp = NULL;
+
+static void free_thread_regexp(thread_regexp_t *this) {
+     match_clean(&(this->match));
+     pcre2_match_context_free(this->context);
+     pcre2_jit_stack_free(this->stack);
+     free(this);
+}
+
+static void create_thread_regexp_key(void) {
+     pthread_key_create(&thread_regexp_key, (void (*)(void *))free_thread_regexp);
+}
+
+static thread_regexp_t *thread_regexp(void) {
+     thread_regexp_t *result = current_thread_regexp;
+     if (result == NULL) {
+          pthread_once(&thread_regexp_once, create_thread_regexp_key);
+          result = malloc(sizeof(thread_regexp_t));
+          result->stack = pcre2_jit_stack_create(JIT_STACK_START, JIT_STACK_MAX, NULL);
+          result->context = pcre2_match_context_create(NULL);
+          pcre2_jit_stack_assign(result->context, NULL, result->stack);
+          match_init(&(result->match));
+          pthread_setspecific(thread_regexp_key, result);
+          current_thread_regexp = result;
+     }
+     return result;
+}
+
+/*
+ * The counted regexps. Counts are updated by atomic additions, without
+ * lock; the lock is for the array.
+ */
+
+static bool_t stats_started = false;
+static regexp_impl_t **counted = NULL;
+static int counted_count = 0;
+static int counted_capacity = 0;
+static pthread_mutex_t counted_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void count_regexp(regexp_impl_t *this) {
+     pthread_mutex_lock(&counted_lock);
+     if (counted_count == counted_capacity) {
+          counted_capacity = counted_capacity == 0 ? 64 : 2 * counted_capacity;
+          counted = realloc(counted, counted_capacity * sizeof(regexp_impl_t *));
+     }
+     counted[counted_count++] = this;
+     pthread_mutex_unlock(&counted_lock);
+}
+
+static void uncount_regexp(regexp_impl_t *this) {
+     int i;
+     pthread_mutex_lock(&counted_lock);
+     for (i = 0; i < counted_count && counted[i] != this; i++);
+     if (i < counted_count) {
+          counted[i] = counted[--counted_count];
+     }
+     pthread_mutex_unlock(&counted_lock);
+}
+
+static int compare_counted(const void *a, const void *b) {
+     const regexp_impl_t *x = *(regexp_impl_t * const *)a;
+     const regexp_impl_t *y = *(regexp_impl_t * const *)b;
+     return x->nanoseconds < y->nanoseconds ? 1 : x->nanoseconds > y->nanoseconds ? -1 : strcmp(x->regex, y->regex);
+}
+
+void start_regexp_stats(void) {
+     stats_started = true;
+}
+
+void log_regexp_stats(logger_t log, level_t level) {
+     regexp_impl_t *regexp;
+     int i;
+     pthread_mutex_lock(&counted_lock);
+     qsort(counted, counted_count, sizeof(regexp_impl_t *), compare_counted);
+     log(level, "Regexps: time (ms), matches, limits hit, engine, pattern\n");
+     for (i = 0; i < counted_count; i++) {
+          regexp = counted[i];
+          if (regexp->matches > 0) {
+               log(level, "%10.3f %10llu %6llu  %-9s %s\n", regexp->nanoseconds / 1e6, (unsigned long long)regexp->matches,
+                   (unsigned long long)regexp->limited, regexp->engine_name, regexp->regex);
+          }
+     }
+     pthread_mutex_unlock(&counted_lock);
+}
+
+static uint64_t nanoseconds(void) {
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static const char *regexp_impl_pattern(regexp_impl_t *this) {
      return this->regex;
 }
 
-static match_impl_t *regexp_impl_match(regexp_impl_t *this, const char *string, int start, int length, int pcre_flags) {
-     int subsmax = this->max_substrings * 3;
-     match_impl_t *result = malloc(sizeof(match_impl_t) + sizeof(int) * subsmax);
+/*
+ * JIT-compiled patterns skip the checks of pcre2_match(): the options
+ * are known to be valid here. Engines only know some options; PCRE2
+ * does the others, within the limits of the regexp (the context is
+ * shared by all the regexps of the thread).
+ */
+static bool_t regexp_impl_exec(regexp_impl_t *this, match_impl_t *match, const char *string, int start, int length, int pcre_flags) {
+     pcre2_match_context *context = thread_regexp()->context;
+     PCRE2_UCHAR message[256];
+     uint64_t begin = this->counted ? nanoseconds() : 0;
      int status;
 
-     result->fn = match_impl_fn;
-     result->regexp = this;
-     result->string = string;
-     result->sub = NULL;
-     result->subsmax = subsmax;
-     status = pcre_exec(this->re, this->extra, string, length, start, pcre_flags, result->subs, subsmax);
-     if (status < 0) {
-          switch(status) {
-          case PCRE_ERROR_NOMATCH     :                                                               break;
-          case PCRE_ERROR_NULL        : this->log(warn, "Something was null\n");                      break;
-          case PCRE_ERROR_BADOPTION   : this->log(warn, "A bad option was passed\n");                 break;
-          case PCRE_ERROR_BADMAGIC    : this->log(warn, "Magic number bad (compiled re corrupt?)\n"); break;
-          case PCRE_ERROR_UNKNOWN_NODE: this->log(warn, "Something kooky in the compiled re\n");      break;
-          case PCRE_ERROR_NOMEMORY    : this->log(warn, "Ran out of memory\n");                       break;
-          case PCRE_ERROR_BADOFFSET   : this->log(warn, "Bad offset\n");                              break;
-          default                     : this->log(warn, "PCRE error %d\n", status);                   break;
+     if (this->groups + 1 > match->pairs) {
+          if (match->data != NULL) {
+               pcre2_match_data_free(match->data);
           }
-          free(result);
-          return NULL;
+          match->pairs = this->groups + 1;
+          match->data = pcre2_match_data_create(match->pairs, NULL);
+          match->subs = pcre2_get_ovector_pointer(match->data);
      }
-
-     if (status == 0) {
-          result->subslen = this->max_substrings;
+     match->regexp = this;
+     match->string = string;
+     if (this->engine != NULL && (pcre_flags & ~PCRE2_NOTEMPTY_ATSTART) == 0) {
+          status = this->engine->exec(this->engine, string, start, length, pcre_flags, match->subs, &(match->workspace));
      } else {
-          result->subslen = status;
+          pcre2_set_match_limit(context, this->match_limit);
+          pcre2_set_depth_limit(context, this->depth_limit);
+          if (this->jit) {
+               status = pcre2_jit_match(this->re, (PCRE2_SPTR)string, length, start, pcre_flags, match->data, context);
+          } else {
+               status = pcre2_match(this->re, (PCRE2_SPTR)string, length, start, pcre_flags, match->data, context);
+          }
      }
+     match->limited = status == PCRE2_ERROR_MATCHLIMIT || status == PCRE2_ERROR_DEPTHLIMIT
+          || status == PCRE2_ERROR_HEAPLIMIT || status == PCRE2_ERROR_JIT_STACKLIMIT;
+     if (this->counted) {
+          __sync_fetch_and_add(&(this->matches), 1);
+          __sync_fetch_and_add(&(this->nanoseconds), nanoseconds() - begin);
+          if (match->limited) {
+               __sync_fetch_and_add(&(this->limited), 1);
+          }
+     }
+     if (status < 0) {
+          if (match->limited) {
+               pcre2_get_error_message(status, message, sizeof(message));
+               this->log(debug, "Regexp %s gave up: %s\n", this->regex, (const char *)message);
+          } else if (status != PCRE2_ERROR_NOMATCH) {
+               pcre2_get_error_message(status, message, sizeof(message));
+               this->log(warn, "PCRE error %d: %s\n", status, (const char *)message);
+          }
+          match->subslen = 0;
+          return false;
+     }
+
+     match->subslen = status;
+     return true;
+}
 
+static match_impl_t *regexp_impl_match(regexp_impl_t *this, const char *string, int start, int length, int pcre_flags) {
+     match_impl_t *result = malloc(sizeof(match_impl_t));
+     match_init(result);
+     if (!regexp_impl_exec(this, result, string, start, length, pcre_flags)) {
+          match_impl_free(result);
+          return NULL;
+     }
      return result;
 }
 
-static void regexp_impl_replace_all(regexp_impl_t *this, const char *replace, char *string) {
-     int len_string = strlen(string);
+static int append(char *buffer, int capacity, int length, const char *string, int count) {
+     if (count > capacity - 1 - length) {
+          count = capacity - 1 - length;
+     }
+     memcpy(buffer + length, string, count);
+     return length + count;
+}
+
+/*
+ * The string is matched from the end of each occurrence, without
+ * being modified.
+ */
+static int regexp_impl_replace_all(regexp_impl_t *this, const char *replace, const char *string, int length, char *buffer, int capacity) {
      int len_replace = strlen(replace);
-     match_impl_t *match;
-     int start, end, lost = 0, delta;
-
-     //this->log(debug, "s/%s/%s/%d|%s\n", this->regex, replace, len_string, string);
-     match = regexp_impl_match(this, string, 0, len_string, 0);
-     while (match != NULL) {
-          start = match->subs[0];
-          end = match->subs[1];
-          if (len_replace > end - start + lost) {
-               this->log(warn, "string replacement longer that matched substring, cannot replace\n");
-          } else {
-               delta = end - start - len_replace;
-               lost += delta;
-               if (delta < 0) {
-                    bcopy(string + end, string + end - delta, len_string - delta - start);
-               }
-               memcpy(string + start, replace, len_replace);
-               if (delta > 0) {
-                    bcopy(string + end, string + end - delta, len_string - delta - start);
-               }
-               len_string -= delta;
-               string[len_string] = '\0';
-               end = start + len_replace;
-          }
-          match_impl_free(match);
-          if (end >= len_string) {
-               match = NULL;
-          } else {
-               len_string -= end;
-               string += end;
-               match = regexp_impl_match(this, string, 0, len_string, PCRE_NOTEMPTY_ATSTART);
-          }
+     match_impl_t *match = &(thread_regexp()->match);
+     int done = 0, result = 0;
+     bool_t found;
+
+     found = regexp_impl_exec(this, match, string, 0, length, 0);
+     while (found) {
+          result = append(buffer, capacity, result, string + done, (int)match->subs[0] - done);
+          result = append(buffer, capacity, result, replace, len_replace);
+          done = (int)match->subs[1];
+          found = done < length && regexp_impl_exec(this, match, string, done, length, PCRE2_NOTEMPTY_ATSTART);
      }
+     result = append(buffer, capacity, result, string + done, length - done);
+     buffer[result] = '\0';
+
+     return match->limited ? -1 : result;
+}
+
+/*
+ * Each byte is tried alone as a partial subject: a partial (or full)
+ * match means that some string starting with that byte may match.
+ * Partial matching does not reject subjects shorter than the pattern
+ * needs.
+ */
+static void regexp_impl_first_bytes(regexp_impl_t *this, char *table) {
+     pcre2_match_data *data;
+     uint32_t options = 0;
+     int i, status;
+     char byte;
+
+     pcre2_pattern_info(this->re, PCRE2_INFO_ALLOPTIONS, &options);
+     if (!(options & PCRE2_ANCHORED)) {
+          memset(table, 1, 256);
+          return;
+     }
+     data = pcre2_match_data_create(1, NULL);
+     for (i = 0; i < 256; i++) {
+          byte = (char)i;
+          status = pcre2_match(this->re, (PCRE2_SPTR)&byte, 1, 0, PCRE2_PARTIAL_SOFT, data, NULL);
+          table[i] = status >= 0 || status == PCRE2_ERROR_PARTIAL;
+     }
+     pcre2_match_data_free(data);
+}
+
+static void regexp_impl_limit(regexp_impl_t *this, uint32_t match_limit, uint32_t depth_limit) {
+     if (match_limit == 0) {
+          pcre2_config(PCRE2_CONFIG_MATCHLIMIT, &match_limit);
+     }
+     if (depth_limit == 0) {
+          pcre2_config(PCRE2_CONFIG_DEPTHLIMIT, &depth_limit);
+     }
+     this->match_limit = match_limit;
+     this->depth_limit = depth_limit;
 }
 
 static void regexp_impl_free(regexp_impl_t *this) {
-     pcre_free(this->re);
-     if (this->extra != NULL) {
-#if PCRE_MINOR < 20
-          pcre_free(this->extra);
-#else
-          pcre_free_study(this->extra);
-#endif
+     if (this->counted) {
+          uncount_regexp(this);
      }
+     if (this->engine != NULL) {
+          this->engine->free(this->engine);
+     }
+     pcre2_code_free(this->re);
      free(this->regex);
      free(this);
 }
@@ -179,44 +442,470 @@ static void regexp_impl_free(regexp_impl_t *this) {
 static regexp_t regexp_impl_fn = {
      .pattern = (regexp_pattern_fn)regexp_impl_pattern,
      .match = (regexp_match_fn)regexp_impl_match,
+     .exec = (regexp_exec_fn)regexp_impl_exec,
      .replace_all = (regexp_replace_all_fn)regexp_impl_replace_all,
+     .first_bytes = (regexp_first_bytes_fn)regexp_impl_first_bytes,
+     .group = (regexp_group_fn)regexp_impl_group,
+     .limit = (regexp_limit_fn)regexp_impl_limit,
      .free = (regexp_free_fn)regexp_impl_free,
 };
 
+static const regexp_engine_new_fn engines[] = {
+     new_linear_engine,
+     NULL
+};
+
+/*
+ * A pattern that cannot be JIT-compiled (e.g. JIT is not supported on
+ * this platform) is interpreted. PCRE2 compiles all the patterns, even
+ * those run by an engine: it gives the groups, and the prefilter of
+ * regexp sets.
+ */
 regexp_t *new_regexp(logger_t log, const char *regex, int pcre_flags) {
      regexp_impl_t *result = malloc(sizeof(regexp_impl_t));
-     const char *pcre_error_string;
-     int pcre_error_index;
-     int max_substrings;
-     int capturecount, namecount;
+     PCRE2_UCHAR message[256];
+     PCRE2_SIZE error_offset;
+     int error, i;
 
-     result->re = pcre_compile(regex, pcre_flags, &pcre_error_string, &pcre_error_index, NULL);
+     result->re = pcre2_compile((PCRE2_SPTR)regex, PCRE2_ZERO_TERMINATED, pcre_flags, &error, &error_offset, NULL);
      if (result->re == NULL) {
           free(result);
-          log(warn, "Error while compiling regexp %s\n%s at %d\n", regex, pcre_error_string, pcre_error_index);
+          pcre2_get_error_message(error, message, sizeof(message));
+          log(warn, "Error while compiling regexp %s\n%s at %d\n", regex, (const char *)message, (int)error_offset);
           return NULL;
      }
 
-#if PCRE_MINOR < 20
-     result->extra = pcre_study(result->re, 0, &pcre_error_string);
-#else
-     result->extra = pcre_study(result->re, PCRE_STUDY_JIT_COMPILE, &pcre_error_string);
-#endif
-     if (pcre_error_string != NULL) {
-          pcre_free(result->re);
-          free(result);
-          log(warn, "Error while optimizing regexp %s\n%s\n", regex, pcre_error_string);
-          return NULL;
+     error = pcre2_jit_compile(result->re, PCRE2_JIT_COMPLETE);
+     result->jit = error == 0;
+     if (!result->jit) {
+          pcre2_get_error_message(error, message, sizeof(message));
+          log(debug, "Regexp %s is not JIT-compiled: %s\n", regex, (const char *)message);
      }
 
-     pcre_fullinfo(result->re, result->extra, PCRE_INFO_CAPTURECOUNT, &capturecount);
-     pcre_fullinfo(result->re, result->extra, PCRE_INFO_NAMECOUNT, &namecount);
-     max_substrings = capturecount + namecount;
+     pcre2_pattern_info(result->re, PCRE2_INFO_CAPTURECOUNT, &(result->groups));
+     /* the name table belongs to the compiled pattern */
+     pcre2_pattern_info(result->re, PCRE2_INFO_NAMECOUNT, &(result->names_count));
+     pcre2_pattern_info(result->re, PCRE2_INFO_NAMEENTRYSIZE, &(result->names_size));
+     pcre2_pattern_info(result->re, PCRE2_INFO_NAMETABLE, &(result->names));
+
+     result->engine = NULL;
+     for (i = 0; result->engine == NULL && engines[i] != NULL; i++) {
+          result->engine = engines[i](log, regex, pcre_flags, result->groups);
+     }
+     result->engine_name = result->engine != NULL ? result->engine->name(result->engine) : result->jit ? "PCRE2 JIT" : "PCRE2";
+     log(debug, "Regexp %s runs on the %s engine\n", regex, result->engine_name);
 
      result->fn = regexp_impl_fn;
      result->log = log;
      result->regex = strdup(regex);
-     result->max_substrings = max_substrings + 1;
+     result->flags = pcre_flags;
+     regexp_impl_limit(result, 0, 0);
+     result->counted = stats_started;
+     result->matches = result->limited = result->nanoseconds = 0;
+     if (result->counted) {
+          count_regexp(result);
+     }
+
+     return &(result->fn);
+}
+
+/*
+ * Required literals: the longest string of plain characters that every
+ * match contains, found by a conservative walk of the pattern. Anything
+ * not understood (inline options, backreferences, \Q...\E, etc.) gives
+ * no literal.
+ */
+
+#define MAX_LITERAL 64
+#define NO_QUANTIFIER -1
+
+typedef struct {
+     char buffer[MAX_LITERAL];
+     int length;
+} literal_t;
+
+typedef struct {
+     const char *p;
+     bool_t ok;
+} literal_parser_t;
+
+static void literal_end(literal_t *run, literal_t *best) {
+     if (run->length > best->length) {
+          *best = *run;
+     }
+     run->length = 0;
+}
+
+/*
+ * Returns the minimum count of the quantifier, if any. Anything that
+ * looks like a quantifier is taken as one: it can only make the
+ * literal shorter.
+ */
+static int literal_quantifier(literal_parser_t *this) {
+     const char *p = this->p;
+     int result = NO_QUANTIFIER;
+     switch (*p) {
+     case '?':
+     case '*':
+          result = 0;
+          p++;
+          break;
+     case '+':
+          result = 1;
+          p++;
+          break;
+     case '{':
+          if (isdigit(p[1]) || p[1] == ',') {
+               for (result = 0, p++; isdigit(*p); p++) {
+                    if (result < MAX_LITERAL) {
+                         result = result * 10 + *p - '0';
+                    }
+               }
+               if (*p == ',') {
+                    for (p++; isdigit(*p); p++);
+               }
+               if (*p == '}') {
+                    p++;
+               } else {
+                    return NO_QUANTIFIER;
+               }
+          }
+          break;
+     }
+     if (result != NO_QUANTIFIER && (*p == '?' || *p == '+')) {
+          p++;
+     }
+     this->p = p;
+     return result;
+}
+
+static void literal_char(literal_parser_t *this, char c, literal_t *run, literal_t *best) {
+     int min = literal_quantifier(this);
+     if (min != 0) {
+          if (run->length == MAX_LITERAL) {
+               literal_end(run, best);
+          }
+          run->buffer[run->length++] = c;
+     }
+     if (min != NO_QUANTIFIER) {
+          literal_end(run, best);
+     }
+}
+
+static void literal_class(literal_parser_t *this) {
+     const char *p = this->p;
+     if (*p == '^') {
+          p++;
+     }
+     if (*p == ']') {
+          p++;
+     }
+     while (*p != '\0' && *p != ']') {
+          if (*p == '\\' && p[1] != '\0') {
+               p += 2;
+          } else if (*p == '[' && p[1] == ':' && strstr(p + 2, ":]") != NULL) {
+               p = strstr(p + 2, ":]") + 2;
+          } else {
+               p++;
+          }
+     }
+     if (*p == ']') {
+          this->p = p + 1;
+     } else {
+          this->ok = false;
+     }
+}
+
+/*
+ * Returns false if the group must be discarded (lookarounds).
+ */
+static bool_t literal_group_kind(literal_parser_t *this) {
+     const char *p = this->p;
+     bool_t result = true;
+     if (*p == '*') {
+          this->ok = false;
+     } else if (*p == '?') {
+          p++;
+          if (*p == ':' || *p == '>') {
+               p++;
+          } else if (*p == '=' || *p == '!') {
+               p++;
+               result = false;
+          } else if (*p == '<' && (p[1] == '=' || p[1] == '!')) {
+               p += 2;
+               result = false;
+          } else if (*p == '<' || (*p == 'P' && p[1] == '<') || *p == '\'') {
+               p = strpbrk(p + 1, ">'");
+               if (p == NULL) {
+                    this->ok = false;
+               } else {
+                    p++;
+               }
+          } else {
+               this->ok = false;
+          }
+     }
+     if (this->ok) {
+          this->p = p;
+     }
+     return result;
+}
+
+/*
+ * Parses a group body up to its closing parenthesis (or the end of the
+ * pattern) and sets best to its longest required literal. Returns
+ * false if the body has alternatives: then nothing is required.
+ */
+static bool_t literal_group(literal_parser_t *this, literal_t *best) {
+     literal_t run = { .length = 0 }, inner;
+     bool_t result = true, kept, single;
+     char c;
+
+     best->length = 0;
+     while (this->ok && *this->p != '\0' && *this->p != ')') {
+          c = *this->p++;
+          switch (c) {
+          case '|':
+               result = false;
+               literal_end(&run, best);
+               break;
+          case '^':
+          case '$':
+               literal_end(&run, best);
+               break;
+          case '(':
+               literal_end(&run, best);
+               if (this->p[0] == '?' && this->p[1] == '#') {
+                    this->p = strchr(this->p, ')');
+                    if (this->p == NULL) {
+                         this->ok = false;
+                    } else {
+                         this->p++;
+                    }
+                    break;
+               }
+               kept = literal_group_kind(this);
+               single = literal_group(this, &inner);
+               if (this->ok && *this->p == ')') {
+                    this->p++;
+                    if (literal_quantifier(this) != 0 && kept && single && inner.length > best->length) {
+                         *best = inner;
+                    }
+               } else {
+                    this->ok = false;
+               }
+               break;
+          case '[':
+               literal_end(&run, best);
+               literal_class(this);
+               literal_quantifier(this);
+               break;
+          case '.':
+               literal_end(&run, best);
+               literal_quantifier(this);
+               break;
+          case '\\':
+               c = *this->p++;
+               if (c == '\0') {
+                    this->ok = false;
+               } else if (!isalnum(c)) {
+                    literal_char(this, c, &run, best);
+               } else if (strchr("dDsSwWhHvVRXN", c) != NULL) {
+                    literal_end(&run, best);
+                    literal_quantifier(this);
+               } else if (strchr("bBAzZGK", c) != NULL) {
+                    literal_end(&run, best);
+               } else {
+                    this->ok = false;
+               }
+               break;
+          case '*':
+          case '+':
+          case '?':
+               this->ok = false;
+               break;
+          default:
+               literal_char(this, c, &run, best);
+          }
+     }
+     literal_end(&run, best);
+     return result;
+}
+
+static void required_literal(regexp_impl_t *regexp, literal_t *result) {
+     literal_parser_t parser = { regexp->regex, true };
+     bool_t single;
+     result->length = 0;
+     if ((regexp->flags & (PCRE2_CASELESS | PCRE2_EXTENDED | PCRE2_EXTENDED_MORE)) == 0) {
+          single = literal_group(&parser, result);
+          if (!parser.ok || !single || *parser.p != '\0') {
+               result->length = 0;
+          }
+     }
+}
+
+/*
+ * Regexp sets: the required literals are searched all at once by an
+ * Aho-Corasick automaton, rebuilt each time a regexp is added.
+ */
+
+typedef struct {
+     regexp_t *regexp;
+     char first_bytes[256];
+     int node;
+     int next;
+} set_pattern_t;
+
+typedef struct {
+     int child[256];
+     int delta[256];
+     int fail;
+     int output;
+     int patterns;
+} set_node_t;
+
+typedef struct {
+     regexp_set_t fn;
+     logger_t log;
+     int count;
+     set_pattern_t *patterns;
+     int nodes;
+     set_node_t *trie;
+} regexp_set_impl_t;
+
+static int set_new_node(regexp_set_impl_t *this) {
+     int result = this->nodes++;
+     set_node_t *node;
+     this->trie = realloc(this->trie, this->nodes * sizeof(set_node_t));
+     node = this->trie + result;
+     memset(node->child, -1, sizeof(node->child));
+     node->fail = node->output = 0;
+     node->patterns = -1;
+     return result;
+}
+
+static void set_build(regexp_set_impl_t *this) {
+     int *queue = malloc(this->nodes * sizeof(int));
+     int head = 0, tail = 0;
+     int c, u, v, f;
+     set_node_t *trie = this->trie;
+
+     for (c = 0; c < 256; c++) {
+          v = trie[0].child[c];
+          if (v < 0) {
+               trie[0].delta[c] = 0;
+          } else {
+               trie[0].delta[c] = v;
+               trie[v].fail = 0;
+               queue[tail++] = v;
+          }
+     }
+     while (head < tail) {
+          u = queue[head++];
+          f = trie[u].fail;
+          trie[u].output = trie[f].patterns >= 0 ? f : trie[f].output;
+          for (c = 0; c < 256; c++) {
+               v = trie[u].child[c];
+               if (v < 0) {
+                    trie[u].delta[c] = trie[f].delta[c];
+               } else {
+                    trie[u].delta[c] = v;
+                    trie[v].fail = trie[f].delta[c];
+                    queue[tail++] = v;
+               }
+          }
+     }
+     free(queue);
+}
+
+static int regexp_set_impl_add(regexp_set_impl_t *this, regexp_impl_t *regexp) {
+     int result = this->count++;
+     set_pattern_t *pattern;
+     literal_t literal;
+     int i, node, child, c;
+
+     this->patterns = realloc(this->patterns, this->count * sizeof(set_pattern_t));
+     pattern = this->patterns + result;
+     pattern->regexp = &(regexp->fn);
+     regexp_impl_first_bytes(regexp, pattern->first_bytes);
+     pattern->node = -1;
+     pattern->next = -1;
+
+     required_literal(regexp, &literal);
+     this->log(debug, "Prefilter literal of %s: \"%.*s\"\n", regexp->regex, literal.length, literal.buffer);
+     if (literal.length > 0) {
+          for (i = node = 0; i < literal.length; i++) {
+               c = (unsigned char)literal.buffer[i];
+               if (this->trie[node].child[c] < 0) {
+                    child = set_new_node(this);
+                    this->trie[node].child[c] = child;
+               }
+               node = this->trie[node].child[c];
+          }
+          pattern->node = node;
+          pattern->next = this->trie[node].patterns;
+          this->trie[node].patterns = result;
+          set_build(this);
+     }
+
+     return result;
+}
+
+static int regexp_set_impl_count(regexp_set_impl_t *this) {
+     return this->count;
+}
+
+/*
+ * The scan stops as soon as all the literals that are still needed
+ * were found.
+ */
+static void regexp_set_impl_candidates(regexp_set_impl_t *this, const char *string, int length, char *candidates) {
+     const set_node_t *trie = this->trie;
+     const set_pattern_t *patterns = this->patterns;
+     unsigned char first = length == 0 ? 0 : (unsigned char)string[0];
+     int i, state, node, p, pending = 0;
 
+     for (i = 0; i < this->count; i++) {
+          candidates[i] = length == 0 || patterns[i].first_bytes[first];
+          if (candidates[i] && patterns[i].node >= 0) {
+               candidates[i] = 0;
+               pending++;
+          }
+     }
+     for (i = state = 0; pending > 0 && i < length; i++) {
+          state = trie[state].delta[(unsigned char)string[i]];
+          for (node = trie[state].patterns >= 0 ? state : trie[state].output; node > 0; node = trie[node].output) {
+               for (p = trie[node].patterns; p >= 0; p = patterns[p].next) {
+                    if (!candidates[p] && patterns[p].first_bytes[first]) {
+                         candidates[p] = 1;
+                         pending--;
+                    }
+               }
+          }
+     }
+}
+
+static void regexp_set_impl_free(regexp_set_impl_t *this) {
+     free(this->patterns);
+     free(this->trie);
+     free(this);
+}
+
+static regexp_set_t regexp_set_impl_fn = {
+     .add = (regexp_set_add_fn)regexp_set_impl_add,
+     .count = (regexp_set_count_fn)regexp_set_impl_count,
+     .candidates = (regexp_set_candidates_fn)regexp_set_impl_candidates,
+     .free = (regexp_set_free_fn)regexp_set_impl_free,
+};
+
+regexp_set_t *new_regexp_set(logger_t log) {
+     regexp_set_impl_t *result = malloc(sizeof(regexp_set_impl_t));
+     result->fn = regexp_set_impl_fn;
+     result->log = log;
+     result->count = 0;
+     result->patterns = NULL;
+     result->nodes = 0;
+     result->trie = NULL;
+     set_new_node(result);
      return &(result->fn);
 }
@@ -21,14 +21,15 @@
  * @file
  * The header for regexps.
  *
- * Note: the underlying engine is PCRE, hence powerful regular
+ * Note: the underlying engine is PCRE2, hence powerful regular
  * expressions (in particular, named groups are extensively used by
  * ExP).
  */
 
-#include <pcre.h>
-#if PCRE_MAJOR < 8
-#error PCRE is too old!!!
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#if PCRE2_MAJOR < 10
+#error PCRE2 is too old!!!
 #endif
 
 /**
@@ -55,12 +56,29 @@ typedef struct match_s match_t;
  * @param[in] string the string to match
  * @param[in] start the start of the string to match
  * @param[in] length the length of the string to match
- * @param[in] pcre_flags PCRE flags for regexp execution
+ * @param[in] pcre_flags PCRE2 options for regexp execution
  *
  * @return the match, or `null` if the string does not match
  */
 typedef match_t *(*regexp_match_fn)(regexp_t *this, const char *string, int start, int length, int pcre_flags);
 
+/**
+ * Try to match the regular expression, reusing the given *match*
+ * (see new_match()): nothing is allocated, unless the regexp has more
+ * groups than any other the match was used for. The previous result
+ * of the match is lost.
+ *
+ * @param[in] this the target regexp
+ * @param[in] match the match to fill
+ * @param[in] string the string to match
+ * @param[in] start the start of the string to match
+ * @param[in] length the length of the string to match
+ * @param[in] pcre_flags PCRE2 options for regexp execution
+ *
+ * @return `true` if the string matches, `false` otherwise
+ */
+typedef bool_t (*regexp_exec_fn)(regexp_t *this, match_t *match, const char *string, int start, int length, int pcre_flags);
+
 /**
  * Return the regexp pattern
  *
@@ -71,18 +89,64 @@ typedef match_t *(*regexp_match_fn)(regexp_t *this, const char *string, int star
 typedef const char *(*regexp_pattern_fn)(regexp_t *this);
 
 /**
- * Replace all occurrences of the regular expressions in *string* by
- * the given *replace*.
- *
- * Note that replacements happen in-place in the given *string*. Some
- * attention is given not to widen the string, but it may be
- * shortened.
+ * Replace all occurrences of the regular expression in *string* by
+ * the given *replace*, writing the result to *buffer*: the string is
+ * read once, and each part of it is copied once, whatever the lengths
+ * of the occurrences and of the replacement.
  *
  * @param[in] this the target regexp
  * @param[in] replace the replacement string
- * @param[in] string the string to be modified
+ * @param[in] string the string to read
+ * @param[in] length the length of the string
+ * @param[out] buffer the buffer to write the result to, always
+ * terminated by a `'\0'`; the result is truncated if it is too long.
+ * The buffer must not overlap the string.
+ * @param[in] capacity the size of the buffer
+ *
+ * @return the length of the result; or -1 if a match gave up on a
+ * [limit](@ref regexp_limit_fn), in which case the rest of the string
+ * is copied as is
+ */
+typedef int (*regexp_replace_all_fn)(regexp_t *this, const char *replace, const char *string, int length, char *buffer, int capacity);
+
+/**
+ * Tell which bytes may start a string the regexp matches: each
+ * *table* entry is set to a non-zero value if a non-empty string
+ * starting with that byte may match. Unanchored regexps may match
+ * anything.
+ *
+ * @param[in] this the target regexp
+ * @param[out] table the 256 bytes table to fill
+ */
+typedef void (*regexp_first_bytes_fn)(regexp_t *this, char *table);
+
+/**
+ * Find the number of a named group. Names are resolved once, when the
+ * regexp is created: callers that match often should find the numbers
+ * once and then use [span](@ref regexp_match_span_fn).
+ *
+ * @param[in] this the target regexp
+ * @param[in] name the name of the group
+ *
+ * @return the number of the group, or -1 if the regexp has no such group
  */
-typedef void (*regexp_replace_all_fn)(regexp_t *this, const char *replace, char *string);
+typedef int (*regexp_group_fn)(regexp_t *this, const char *name);
+
+/**
+ * Set the limits of PCRE2 for the regexp: a match that needs more
+ * calls of the internal match function of PCRE2 than *match_limit*,
+ * or a deeper backtracking than *depth_limit*, gives up (see
+ * [limited](@ref regexp_match_limited_fn)). Zero keeps the default of
+ * PCRE2.
+ *
+ * JIT-compiled patterns only know the match limit. Patterns run by an
+ * [engine](@ref regexp_engine_t) take a linear time and have no limit.
+ *
+ * @param[in] this the target regexp
+ * @param[in] match_limit the match limit
+ * @param[in] depth_limit the depth limit
+ */
+typedef void (*regexp_limit_fn)(regexp_t *this, uint32_t match_limit, uint32_t depth_limit);
 
 /**
  * Free the regexp
@@ -100,10 +164,26 @@ struct regexp_s {
       * @see regexp_match_fn
       */
      regexp_match_fn match;
+     /**
+      * @see regexp_exec_fn
+      */
+     regexp_exec_fn exec;
      /**
       * @see regexp_replace_all_fn
       */
      regexp_replace_all_fn replace_all;
+     /**
+      * @see regexp_first_bytes_fn
+      */
+     regexp_first_bytes_fn first_bytes;
+     /**
+      * @see regexp_group_fn
+      */
+     regexp_group_fn group;
+     /**
+      * @see regexp_limit_fn
+      */
+     regexp_limit_fn limit;
      /**
       * @see regexp_free_fn
       */
@@ -111,25 +191,66 @@ struct regexp_s {
 };
 
 /**
- * Return the *index*-th unnamed group
+ * Return a copy of the *index*-th group. The copy belongs to the match
+ * and is valid until the next copy or until the match is freed.
  *
  * @param[in] this the target match
- * @param[in] index the index of the unnamed group to return
+ * @param[in] index the index of the group to return
  *
- * @return the *index*-th unnamed group
+ * @return the *index*-th group, or `null` if there is no such group
  */
 typedef const char *(*regexp_match_substring_fn)(match_t *this, int index);
 
 /**
- * Return the named group
+ * Return a copy of the named group, as
+ * [substring](@ref regexp_match_substring_fn) does.
  *
  * @param[in] this the target match
  * @param[in] name the name of the group
  *
- * @return the named group
+ * @return the named group, or `null` if there is no such group
  */
 typedef const char *(*regexp_match_named_substring_fn)(match_t *this, const char *name);
 
+/**
+ * Find the *index*-th group without copying it: its position in the
+ * matched string. Nothing is allocated nor looked up.
+ *
+ * @param[in] this the target match
+ * @param[in] index the number of the group (see
+ * [group](@ref regexp_group_fn))
+ * @param[out] start the offset of the group in the matched string
+ * @param[out] length the length of the group (0 if the group did not
+ * participate in the match)
+ *
+ * @return `true` if the regexp has such a group, `false` otherwise
+ */
+typedef bool_t (*regexp_match_span_fn)(match_t *this, int index, int *start, int *length);
+
+/**
+ * Find the named group without copying it, as
+ * [span](@ref regexp_match_span_fn) does.
+ *
+ * @param[in] this the target match
+ * @param[in] name the name of the group
+ * @param[out] start the offset of the group in the matched string
+ * @param[out] length the length of the group (0 if the group did not
+ * participate in the match)
+ *
+ * @return `true` if the regexp has such a group, `false` otherwise
+ */
+typedef bool_t (*regexp_match_named_span_fn)(match_t *this, const char *name, int *start, int *length);
+
+/**
+ * Tell if the last match gave up on a [limit](@ref regexp_limit_fn)
+ * instead of failing: the string may match or not.
+ *
+ * @param[in] this the target match
+ *
+ * @return `true` if the match gave up, `false` otherwise
+ */
+typedef bool_t (*regexp_match_limited_fn)(match_t *this);
+
 /**
  * Free the match
  *
@@ -137,7 +258,11 @@ typedef const char *(*regexp_match_named_substring_fn)(match_t *this, const char
  */
 typedef void (*regexp_match_free_fn)(match_t *this);
 
-struct match_s {
+/**
+ * The operations of a match; all the matches of the same kind share one
+ * table.
+ */
+typedef struct {
      /**
       * @see regexp_match_substring_fn
       */
@@ -146,23 +271,272 @@ struct match_s {
       * @see regexp_match_named_substring_fn
       */
      regexp_match_named_substring_fn named_substring;
+     /**
+      * @see regexp_match_span_fn
+      */
+     regexp_match_span_fn span;
+     /**
+      * @see regexp_match_named_span_fn
+      */
+     regexp_match_named_span_fn named_span;
+     /**
+      * @see regexp_match_limited_fn
+      */
+     regexp_match_limited_fn limited;
      /**
       * @see regexp_match_free_fn
       */
      regexp_match_free_fn free;
+} match_ops_t;
+
+struct match_s {
+     /**
+      * The operations of the match
+      */
+     const match_ops_t *ops;
 };
 
 /**
- * Create a new regular expression.
+ * What to do with a line on which a regexp gives up on a
+ * [limit](@ref regexp_limit_fn).
+ */
+typedef enum {
+     /** as if the regexp did not match: the next regexps are tried */
+     limit_skip=0,
+     /** keep the line raw: no other regexp is tried */
+     limit_raw=1
+} limit_action_t;
+
+/**
+ * The limits given to the regexps of the factories and filters.
+ */
+typedef struct {
+     /** the match limit; 0 for the default of PCRE2 */
+     uint32_t match;
+     /** the depth limit; 0 for the default of PCRE2 */
+     uint32_t depth;
+     /** what to do with a line when a regexp gives up */
+     limit_action_t action;
+} regexp_limits_t;
+
+/**
+ * The regexp engine interface: another way to run a pattern that PCRE2
+ * compiled. An engine only accepts the patterns it runs exactly as
+ * PCRE2 would (same matches, same groups); the others are run by
+ * PCRE2.
+ */
+typedef struct regexp_engine_s regexp_engine_t;
+
+/**
+ * Working memory of an engine, kept by a match from one
+ * [exec](@ref regexp_exec_fn) to the next. The engine grows it as
+ * needed.
+ */
+typedef struct {
+     /**
+      * The memory, or `null`
+      */
+     void *buffer;
+     /**
+      * The size of the memory
+      */
+     size_t size;
+} regexp_workspace_t;
+
+/**
+ * Try to match the pattern, as pcre2_match() would.
+ *
+ * The engine is not changed: it may be used by many threads at once,
+ * each with its own workspace.
+ *
+ * @param[in] this the target engine
+ * @param[in] string the string to match
+ * @param[in] start the start of the string to match
+ * @param[in] length the length of the string to match
+ * @param[in] pcre_flags PCRE2 options for regexp execution; only
+ * `PCRE2_NOTEMPTY_ATSTART` is supported
+ * @param[out] ovector the offsets of the groups, as pcre2_match() sets
+ * them
+ * @param[in,out] workspace the working memory
+ *
+ * @return as pcre2_match(): the number of the highest group set plus
+ * one, or `PCRE2_ERROR_NOMATCH`
+ */
+typedef int (*regexp_engine_exec_fn)(regexp_engine_t *this, const char *string, int start, int length, int pcre_flags, PCRE2_SIZE *ovector, regexp_workspace_t *workspace);
+
+/**
+ * The name of the engine.
+ *
+ * @param[in] this the target engine
+ *
+ * @return the name
+ */
+typedef const char *(*regexp_engine_name_fn)(regexp_engine_t *this);
+
+/**
+ * Free the engine
+ *
+ * @param[in] this the target engine
+ */
+typedef void (*regexp_engine_free_fn)(regexp_engine_t *this);
+
+struct regexp_engine_s {
+     /**
+      * @see regexp_engine_name_fn
+      */
+     regexp_engine_name_fn name;
+     /**
+      * @see regexp_engine_exec_fn
+      */
+     regexp_engine_exec_fn exec;
+     /**
+      * @see regexp_engine_free_fn
+      */
+     regexp_engine_free_fn free;
+};
+
+/**
+ * Create an engine for the given pattern.
+ *
+ * @param[in] log the logger
+ * @param[in] regex the regular expression
+ * @param[in] pcre_flags PCRE2 options for regexp compilation
+ * @param[in] groups the number of groups of the pattern, as PCRE2
+ * counts them
+ *
+ * @return the engine, or `null` if the engine does not accept the
+ * pattern
+ */
+typedef regexp_engine_t *(*regexp_engine_new_fn)(logger_t log, const char *regex, int pcre_flags, int groups);
+
+/**
+ * Create a linear-time engine (a Pike VM): the time to match a string
+ * is proportional to its length times the size of the pattern, even
+ * for patterns that would make PCRE2 backtrack a lot.
+ *
+ * Backreferences, lookarounds, lazy and possessive quantifiers,
+ * options, and unbounded repetitions of what may match the empty
+ * string are not accepted.
+ *
+ * @see regexp_engine_new_fn
+ */
+regexp_engine_t *new_linear_engine(logger_t log, const char *regex, int pcre_flags, int groups);
+
+/**
+ * The regexp set interface: a prefilter that tells, in one scan of a
+ * string, which of many regexps may match it.
+ */
+typedef struct regexp_set_s regexp_set_t;
+
+/**
+ * Add a regexp to the set. The regexp is not owned by the set and
+ * must outlive it.
+ *
+ * @param[in] this the target regexp set
+ * @param[in] regexp the regexp to add
+ *
+ * @return the index of the regexp in the set
+ */
+typedef int (*regexp_set_add_fn)(regexp_set_t *this, regexp_t *regexp);
+
+/**
+ * The number of regexps in the set.
+ *
+ * @param[in] this the target regexp set
+ *
+ * @return the number of regexps
+ */
+typedef int (*regexp_set_count_fn)(regexp_set_t *this);
+
+/**
+ * Tell which regexps may match the string: each *candidates* entry is
+ * set to a non-zero value if the regexp with that index may match,
+ * and to zero if it certainly does not. A regexp is discarded if the
+ * string does not contain a literal that every match contains, or if
+ * the regexp is anchored and cannot start with the first byte of the
+ * string.
+ *
+ * The set is not changed: it may be used by many threads at once.
+ *
+ * @param[in] this the target regexp set
+ * @param[in] string the string to check
+ * @param[in] length the length of the string
+ * @param[out] candidates the array to fill, of at least
+ * [count](@ref regexp_set_count_fn) entries
+ */
+typedef void (*regexp_set_candidates_fn)(regexp_set_t *this, const char *string, int length, char *candidates);
+
+/**
+ * Free the regexp set (but not its regexps)
+ *
+ * @param[in] this the target regexp set
+ */
+typedef void (*regexp_set_free_fn)(regexp_set_t *this);
+
+struct regexp_set_s {
+     /**
+      * @see regexp_set_add_fn
+      */
+     regexp_set_add_fn add;
+     /**
+      * @see regexp_set_count_fn
+      */
+     regexp_set_count_fn count;
+     /**
+      * @see regexp_set_candidates_fn
+      */
+     regexp_set_candidates_fn candidates;
+     /**
+      * @see regexp_set_free_fn
+      */
+     regexp_set_free_fn free;
+};
+
+/**
+ * Create a new regular expression. It is run by the first engine that
+ * accepts it (see new_linear_engine()), or by PCRE2.
  *
  * @param[in] log the logger
  * @param[in] regex the regular expression
- * @param[in] pcre_flags PCRE flags for regexp compilation
+ * @param[in] pcre_flags PCRE2 options for regexp compilation
  *
  * @return the compiled regexp
  */
 regexp_t *new_regexp(logger_t log, const char *regex, int pcre_flags);
 
+/**
+ * Create a new match, to be filled by [exec](@ref regexp_exec_fn)
+ * again and again. A match must not be used by two threads at once.
+ *
+ * @return the match
+ */
+match_t *new_match(void);
+
+/**
+ * Count, for each regexp created from now on, its matches, the time
+ * they take, and the limits they hit. It costs two clock readings per
+ * match.
+ */
+void start_regexp_stats(void);
+
+/**
+ * Log the counts of the regexps (see start_regexp_stats()), the
+ * slowest first. Regexps that never ran are not logged.
+ *
+ * @param[in] log the logger
+ * @param[in] level the level to log at
+ */
+void log_regexp_stats(logger_t log, level_t level);
+
+/**
+ * Create a new, empty, regexp set.
+ *
+ * @param[in] log the logger
+ *
+ * @return the regexp set
+ */
+regexp_set_t *new_regexp_set(logger_t log);
+
 /**
  * @}
  */
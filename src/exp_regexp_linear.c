@@ -0,0 +1,1356 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @ingroup exp
+ * @file
+ *
+ * This file contains the implementation of the linear-time regexp
+ * engine: the pattern is parsed to a tree, compiled to a program, and
+ * run by a Pike VM. All the threads of the VM advance together, one
+ * character at a time, in the order of priority a backtracking engine
+ * would try them; hence the same match and the same groups as PCRE2.
+ * Most patterns are first searched by DFAs, which the VM only
+ * completes with the groups.
+ *
+ * Anything not understood is not accepted, and left to PCRE2.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "exp_log.h"
+#include "exp_regexp.h"
+
+#define MAX_NODES 1024
+#define MAX_PROGRAM 4096
+#define MAX_REPEAT 255
+#define UNBOUNDED -1
+
+/*
+ * Byte sets
+ */
+
+typedef struct {
+     unsigned char bits[32];
+} byteset_t;
+
+static void set_add(byteset_t *set, int c) {
+     set->bits[c >> 3] |= 1 << (c & 7);
+}
+
+static void set_add_range(byteset_t *set, int from, int to) {
+     int c;
+     for (c = from; c <= to; c++) {
+          set_add(set, c);
+     }
+}
+
+static void set_add_set(byteset_t *set, const byteset_t *other, bool_t negate) {
+     int i;
+     for (i = 0; i < 32; i++) {
+          set->bits[i] |= negate ? ~other->bits[i] : other->bits[i];
+     }
+}
+
+static void set_negate(byteset_t *set) {
+     int i;
+     for (i = 0; i < 32; i++) {
+          set->bits[i] = ~set->bits[i];
+     }
+}
+
+static bool_t set_has(const byteset_t *set, int c) {
+     return (set->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+/*
+ * The classes of the default PCRE2 character tables (the "C" locale):
+ * no byte above 127 belongs to any of them.
+ */
+static bool_t posix_class(const char *name, int length, byteset_t *set) {
+     memset(set, 0, sizeof(byteset_t));
+#define IS(n) (length == (int)strlen(n) && !strncmp(name, n, length))
+     if (IS("alpha")) {
+          set_add_range(set, 'a', 'z'); set_add_range(set, 'A', 'Z');
+     } else if (IS("digit")) {
+          set_add_range(set, '0', '9');
+     } else if (IS("alnum")) {
+          set_add_range(set, 'a', 'z'); set_add_range(set, 'A', 'Z'); set_add_range(set, '0', '9');
+     } else if (IS("word")) {
+          set_add_range(set, 'a', 'z'); set_add_range(set, 'A', 'Z'); set_add_range(set, '0', '9'); set_add(set, '_');
+     } else if (IS("space")) {
+          set_add_range(set, '\t', '\r'); set_add(set, ' ');
+     } else if (IS("blank")) {
+          set_add(set, '\t'); set_add(set, ' ');
+     } else if (IS("upper")) {
+          set_add_range(set, 'A', 'Z');
+     } else if (IS("lower")) {
+          set_add_range(set, 'a', 'z');
+     } else if (IS("xdigit")) {
+          set_add_range(set, '0', '9'); set_add_range(set, 'a', 'f'); set_add_range(set, 'A', 'F');
+     } else if (IS("punct")) {
+          set_add_range(set, '!', '/'); set_add_range(set, ':', '@'); set_add_range(set, '[', '`'); set_add_range(set, '{', '~');
+     } else if (IS("cntrl")) {
+          set_add_range(set, 0, 31); set_add(set, 127);
+     } else if (IS("graph")) {
+          set_add_range(set, '!', '~');
+     } else if (IS("print")) {
+          set_add_range(set, ' ', '~');
+     } else {
+          return false;
+     }
+#undef IS
+     return true;
+}
+
+static bool_t is_word(int c) {
+     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static int hex_value(char c) {
+     if (c >= '0' && c <= '9') return c - '0';
+     if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+     if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+     return -1;
+}
+
+/*
+ * The parse tree
+ */
+
+typedef enum {
+     node_empty,
+     node_char,
+     node_class,
+     node_any,
+     node_assert,
+     node_cat,
+     node_alt,
+     node_group,
+     node_repeat,
+} node_kind_t;
+
+typedef enum {
+     assert_bol,
+     assert_eol,
+     assert_word,
+     assert_not_word,
+} assert_kind_t;
+
+typedef struct node_s node_t;
+struct node_s {
+     node_kind_t kind;
+     int value; /* char, class, assertion, group (-1 if not capturing), or minimum */
+     int max;
+     node_t *left;
+     node_t *right;
+};
+
+typedef struct {
+     const char *p;
+     bool_t ok;
+     int groups;
+     node_t nodes[MAX_NODES];
+     int count;
+     byteset_t *classes;
+     int classes_count;
+} parser_t;
+
+static node_t *new_node(parser_t *this, node_kind_t kind, int value, node_t *left, node_t *right) {
+     node_t *result;
+     if (this->count == MAX_NODES) {
+          this->ok = false;
+          return NULL;
+     }
+     result = this->nodes + this->count++;
+     result->kind = kind;
+     result->value = value;
+     result->max = 0;
+     result->left = left;
+     result->right = right;
+     return result;
+}
+
+static int new_class(parser_t *this, const byteset_t *set) {
+     this->classes = realloc(this->classes, (this->classes_count + 1) * sizeof(byteset_t));
+     this->classes[this->classes_count] = *set;
+     return this->classes_count++;
+}
+
+static node_t *parse_alt(parser_t *this);
+
+/*
+ * The escapes that stand for a set: \d \D \s \S \w \W
+ */
+static bool_t escape_set(char c, byteset_t *set) {
+     byteset_t base;
+     bool_t negate = c >= 'A' && c <= 'Z';
+     switch (c) {
+     case 'd': case 'D': posix_class("digit", 5, &base); break;
+     case 's': case 'S': posix_class("space", 5, &base); break;
+     case 'w': case 'W': posix_class("word",  4, &base); break;
+     default: return false;
+     }
+     memset(set, 0, sizeof(byteset_t));
+     set_add_set(set, &base, negate);
+     return true;
+}
+
+/*
+ * The escapes that stand for one character; *p* is after the
+ * backslash and is moved after the escape. Returns -1 if not
+ * understood.
+ */
+static int escape_char(const char **p, bool_t in_class) {
+     char c = **p;
+     int h1, h2;
+     switch (c) {
+     case 't': (*p)++; return '\t';
+     case 'n': (*p)++; return '\n';
+     case 'r': (*p)++; return '\r';
+     case 'f': (*p)++; return '\f';
+     case 'e': (*p)++; return 0x1b;
+     case 'a': (*p)++; return 0x07;
+     case 'b':
+          if (in_class) {
+               (*p)++;
+               return 0x08;
+          }
+          return -1;
+     case 'x':
+          h1 = hex_value((*p)[1]);
+          h2 = h1 < 0 ? -1 : hex_value((*p)[2]);
+          if (h2 < 0) {
+               return -1;
+          }
+          *p += 3;
+          return h1 * 16 + h2;
+     }
+     if (c == '\0' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c & 0x80)) {
+          return -1;
+     }
+     (*p)++;
+     return (unsigned char)c;
+}
+
+static node_t *parse_class(parser_t *this) {
+     byteset_t set, other;
+     const char *p = this->p, *end;
+     bool_t negate = false, first = true;
+     int c, to;
+
+     memset(&set, 0, sizeof(byteset_t));
+     if (*p == '^') {
+          negate = true;
+          p++;
+     }
+     while (this->ok && (first || *p != ']')) {
+          first = false;
+          if (*p == '\0') {
+               this->ok = false;
+          } else if (*p == '[' && p[1] == ':') {
+               end = strstr(p + 2, ":]");
+               if (end == NULL || !posix_class(p + 2, end - p - 2, &other)) {
+                    this->ok = false;
+               } else {
+                    set_add_set(&set, &other, false);
+                    p = end + 2;
+               }
+          } else if (*p == '[' && (p[1] == '.' || p[1] == '=')) {
+               this->ok = false;
+          } else {
+               if (*p == '\\' && escape_set(p[1], &other)) {
+                    set_add_set(&set, &other, false);
+                    p += 2;
+                    if (*p == '-' && p[1] != ']') {
+                         /* not a range, but not read the same by all PCRE2 versions */
+                         this->ok = false;
+                    }
+                    continue;
+               }
+               if (*p == '\\') {
+                    p++;
+                    c = escape_char(&p, true);
+               } else {
+                    c = (unsigned char)*p++;
+               }
+               if (c < 0) {
+                    this->ok = false;
+               } else if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+                    p++;
+                    if (*p == '[') {
+                         /* a class or a POSIX name cannot end a range */
+                         to = -1;
+                    } else if (*p == '\\') {
+                         p++;
+                         to = escape_char(&p, true);
+                    } else {
+                         to = (unsigned char)*p++;
+                    }
+                    if (to < c) {
+                         this->ok = false;
+                    } else {
+                         set_add_range(&set, c, to);
+                    }
+               } else {
+                    set_add(&set, c);
+               }
+          }
+     }
+     if (!this->ok) {
+          return NULL;
+     }
+     this->p = p + 1;
+     if (negate) {
+          set_negate(&set);
+     }
+     return new_node(this, node_class, new_class(this, &set), NULL, NULL);
+}
+
+static node_t *parse_group(parser_t *this) {
+     const char *p = this->p;
+     int group = -1;
+     node_t *child;
+     char close;
+
+     if (*p == '?') {
+          p++;
+          if (*p == ':') {
+               p++;
+          } else if ((*p == '<' && p[1] != '=' && p[1] != '!') || *p == '\'' || (*p == 'P' && p[1] == '<')) {
+               if (*p == 'P') {
+                    p++;
+               }
+               close = *p++ == '<' ? '>' : '\'';
+               if (!is_word(*p) || (*p >= '0' && *p <= '9')) {
+                    this->ok = false;
+                    return NULL;
+               }
+               while (is_word(*p)) {
+                    p++;
+               }
+               if (*p != close) {
+                    this->ok = false;
+                    return NULL;
+               }
+               p++;
+               group = ++this->groups;
+          } else {
+               this->ok = false;
+               return NULL;
+          }
+     } else if (*p == '*') {
+          this->ok = false;
+          return NULL;
+     } else {
+          group = ++this->groups;
+     }
+     this->p = p;
+     child = parse_alt(this);
+     if (!this->ok || *this->p != ')') {
+          this->ok = false;
+          return NULL;
+     }
+     this->p++;
+     return new_node(this, node_group, group, child, NULL);
+}
+
+static node_t *parse_atom(parser_t *this) {
+     byteset_t set;
+     const char *p;
+     char c = *this->p++;
+     int e;
+
+     switch (c) {
+     case '(':
+          return parse_group(this);
+     case '[':
+          return parse_class(this);
+     case '.':
+          return new_node(this, node_any, 0, NULL, NULL);
+     case '^':
+          return new_node(this, node_assert, assert_bol, NULL, NULL);
+     case '$':
+          return new_node(this, node_assert, assert_eol, NULL, NULL);
+     case '*': case '+': case '?': case '{':
+          this->ok = false;
+          return NULL;
+     case '\\':
+          c = *this->p;
+          if (escape_set(c, &set)) {
+               this->p++;
+               return new_node(this, node_class, new_class(this, &set), NULL, NULL);
+          }
+          if (c == 'b' || c == 'B') {
+               this->p++;
+               return new_node(this, node_assert, c == 'b' ? assert_word : assert_not_word, NULL, NULL);
+          }
+          p = this->p;
+          e = escape_char(&p, false);
+          if (e < 0) {
+               this->ok = false;
+               return NULL;
+          }
+          this->p = p;
+          return new_node(this, node_char, e, NULL, NULL);
+     }
+     if (c & 0x80) {
+          /* may be UTF-8 in a pattern that will be compiled so some day */
+          this->ok = false;
+          return NULL;
+     }
+     return new_node(this, node_char, (unsigned char)c, NULL, NULL);
+}
+
+static int parse_number(const char **p) {
+     int result = 0;
+     if (**p < '0' || **p > '9') {
+          return -1;
+     }
+     while (**p >= '0' && **p <= '9') {
+          if (result <= MAX_REPEAT) {
+               result = result * 10 + **p - '0';
+          }
+          (*p)++;
+     }
+     return result;
+}
+
+/*
+ * Only greedy quantifiers; {n}, {n,} and {n,m} are the only counted
+ * forms accepted (other forms are read differently by PCRE2 versions).
+ */
+static bool_t parse_quantifier(parser_t *this, int *min, int *max) {
+     const char *p = this->p;
+     switch (*p) {
+     case '*': *min = 0; *max = UNBOUNDED; p++; break;
+     case '+': *min = 1; *max = UNBOUNDED; p++; break;
+     case '?': *min = 0; *max = 1; p++; break;
+     case '{':
+          p++;
+          *min = parse_number(&p);
+          if (*min < 0) {
+               this->ok = false;
+               return false;
+          }
+          *max = *min;
+          if (*p == ',') {
+               p++;
+               if (*p == '}') {
+                    *max = UNBOUNDED;
+               } else {
+                    *max = parse_number(&p);
+                    if (*max < *min) {
+                         this->ok = false;
+                         return false;
+                    }
+               }
+          }
+          if (*p != '}' || *min > MAX_REPEAT || *max > MAX_REPEAT) {
+               this->ok = false;
+               return false;
+          }
+          p++;
+          break;
+     default:
+          return false;
+     }
+     if (*p == '?' || *p == '+' || *p == '*' || *p == '{') {
+          this->ok = false;
+          return false;
+     }
+     this->p = p;
+     return true;
+}
+
+static bool_t nullable(node_t *node) {
+     switch (node->kind) {
+     case node_empty:
+     case node_assert:
+          return true;
+     case node_char:
+     case node_class:
+     case node_any:
+          return false;
+     case node_cat:
+          return nullable(node->left) && nullable(node->right);
+     case node_alt:
+          return nullable(node->left) || nullable(node->right);
+     case node_group:
+          return nullable(node->left);
+     case node_repeat:
+          return node->value == 0 || nullable(node->left);
+     }
+     return true;
+}
+
+static node_t *parse_repeat(parser_t *this) {
+     node_t *result = parse_atom(this);
+     int min, max;
+     if (this->ok && parse_quantifier(this, &min, &max)) {
+          if (result->kind == node_assert || (max == UNBOUNDED && nullable(result))) {
+               this->ok = false;
+               return NULL;
+          }
+          result = new_node(this, node_repeat, min, result, NULL);
+          if (result != NULL) {
+               result->max = max;
+          }
+     }
+     return result;
+}
+
+static node_t *parse_cat(parser_t *this) {
+     node_t *result = new_node(this, node_empty, 0, NULL, NULL);
+     node_t *node;
+     while (this->ok && *this->p != '\0' && *this->p != '|' && *this->p != ')') {
+          node = parse_repeat(this);
+          if (this->ok) {
+               result = new_node(this, node_cat, 0, result, node);
+          }
+     }
+     return result;
+}
+
+static node_t *parse_alt(parser_t *this) {
+     node_t *result = parse_cat(this);
+     while (this->ok && *this->p == '|') {
+          this->p++;
+          result = new_node(this, node_alt, 0, result, parse_cat(this));
+     }
+     return result;
+}
+
+/*
+ * The program
+ */
+
+typedef enum {
+     op_char,
+     op_class,
+     op_any,
+     op_match,
+     op_jmp,
+     op_split,
+     op_save,
+     op_assert,
+} op_t;
+
+typedef struct {
+     op_t op;
+     int x; /* char, class, slot, assertion, or first target */
+     int y; /* second target of a split */
+} inst_t;
+
+typedef struct {
+     regexp_engine_t fn;
+     logger_t log;
+     int groups;
+     int slots;
+     int length;
+     inst_t *program;
+     byteset_t *classes;
+     char first[256];
+     bool_t empty;
+     char *prefix;
+     int prefix_length;
+     unsigned char map[256]; /* byte -> byte class, for the DFAs */
+     int bytes;
+     struct dfa_s *forward;
+     struct dfa_s *backward;
+} linear_engine_t;
+
+typedef struct {
+     inst_t *program;
+     int length;
+     bool_t ok;
+     bool_t reverse; /* for the search of the start of a match */
+} compiler_t;
+
+/*
+ * The program has one more instruction than it may use, written to
+ * when it is full.
+ */
+static int emit(compiler_t *this, op_t op, int x, int y) {
+     if (this->length == MAX_PROGRAM) {
+          this->ok = false;
+          this->program[MAX_PROGRAM].op = op;
+          return MAX_PROGRAM;
+     }
+     this->program[this->length].op = op;
+     this->program[this->length].x = x;
+     this->program[this->length].y = y;
+     return this->length++;
+}
+
+/*
+ * In a split, x is tried first: that is the priority order.
+ */
+static void compile_node(compiler_t *this, node_t *node) {
+     int i, split, loop, *splits;
+     if (!this->ok) {
+          return;
+     }
+     switch (node->kind) {
+     case node_empty:
+          break;
+     case node_char:
+          emit(this, op_char, node->value, 0);
+          break;
+     case node_class:
+          emit(this, op_class, node->value, 0);
+          break;
+     case node_any:
+          emit(this, op_any, 0, 0);
+          break;
+     case node_assert:
+          emit(this, op_assert, node->value, 0);
+          break;
+     case node_cat:
+          compile_node(this, this->reverse ? node->right : node->left);
+          compile_node(this, this->reverse ? node->left : node->right);
+          break;
+     case node_alt:
+          split = emit(this, op_split, 0, 0);
+          this->program[split].x = this->length;
+          compile_node(this, node->left);
+          loop = emit(this, op_jmp, 0, 0);
+          this->program[split].y = this->length;
+          compile_node(this, node->right);
+          this->program[loop].x = this->length;
+          break;
+     case node_group:
+          if (node->value >= 0) {
+               emit(this, op_save, 2 * node->value, 0);
+          }
+          compile_node(this, node->left);
+          if (node->value >= 0) {
+               emit(this, op_save, 2 * node->value + 1, 0);
+          }
+          break;
+     case node_repeat:
+          for (i = 0; i < node->value; i++) {
+               compile_node(this, node->left);
+          }
+          if (node->max == UNBOUNDED) {
+               loop = emit(this, op_split, 0, 0);
+               this->program[loop].x = this->length;
+               compile_node(this, node->left);
+               emit(this, op_jmp, loop, 0);
+               this->program[loop].y = this->length;
+          } else if (node->max > node->value) {
+               splits = malloc((node->max - node->value) * sizeof(int));
+               for (i = 0; i < node->max - node->value; i++) {
+                    splits[i] = emit(this, op_split, 0, 0);
+                    this->program[splits[i]].x = this->length;
+                    compile_node(this, node->left);
+               }
+               for (i = 0; i < node->max - node->value; i++) {
+                    this->program[splits[i]].y = this->length;
+               }
+               free(splits);
+          }
+          break;
+     }
+}
+
+/*
+ * The bytes that may start a match: a thread is started only on one
+ * of them, unless the pattern may match the empty string. Assertions
+ * are crossed as if they hold.
+ */
+static void first_bytes(linear_engine_t *this) {
+     char *seen = calloc(this->length, 1);
+     int *stack = malloc(2 * this->length * sizeof(int));
+     int n = 0, pc, c;
+     inst_t *inst;
+
+     memset(this->first, 0, 256);
+     this->empty = false;
+     stack[n++] = 0;
+     while (n > 0) {
+          pc = stack[--n];
+          if (seen[pc]) {
+               continue;
+          }
+          seen[pc] = 1;
+          inst = this->program + pc;
+          switch (inst->op) {
+          case op_char:
+               this->first[inst->x] = 1;
+               break;
+          case op_class:
+               for (c = 0; c < 256; c++) {
+                    if (set_has(this->classes + inst->x, c)) {
+                         this->first[c] = 1;
+                    }
+               }
+               break;
+          case op_any:
+               memset(this->first, 1, 256);
+               break;
+          case op_match:
+               memset(this->first, 1, 256);
+               this->empty = true;
+               break;
+          case op_jmp:
+               stack[n++] = inst->x;
+               break;
+          case op_split:
+               stack[n++] = inst->x;
+               stack[n++] = inst->y;
+               break;
+          case op_save:
+          case op_assert:
+               stack[n++] = pc + 1;
+               break;
+          }
+     }
+     free(stack);
+     free(seen);
+}
+
+/*
+ * The characters that every match starts with: a thread runs through
+ * the first characters of the program before any jump.
+ */
+static void literal_prefix(linear_engine_t *this) {
+     int n;
+     for (n = 0; this->program[n + 1].op == op_char; n++);
+     this->prefix_length = n;
+     this->prefix = malloc(n + 1);
+     for (n = 0; n < this->prefix_length; n++) {
+          this->prefix[n] = (char)this->program[n + 1].x;
+     }
+}
+
+/*
+ * The next position where a match may start, or *length* if there is
+ * none.
+ */
+static int next_start(linear_engine_t *this, const char *string, int pos, int length) {
+     const char *found;
+     if (this->prefix_length == 0) {
+          while (pos < length && !this->first[(unsigned char)string[pos]]) {
+               pos++;
+          }
+          return pos;
+     }
+     while (length - pos >= this->prefix_length) {
+          found = memchr(string + pos, this->prefix[0], length - pos - this->prefix_length + 1);
+          if (found == NULL) {
+               break;
+          }
+          pos = found - string;
+          if (!memcmp(found + 1, this->prefix + 1, this->prefix_length - 1)) {
+               return pos;
+          }
+          pos++;
+     }
+     return length;
+}
+
+/*
+ * The VM
+ */
+
+typedef struct {
+     int count;
+     int *pcs;
+     int *sparse; /* index in pcs, for the "is the pc in the list" test */
+     PCRE2_SIZE *slots;
+} thread_list_t;
+
+typedef struct {
+     int kind; /* pc, or -1 - slot to restore */
+     PCRE2_SIZE value;
+} stack_item_t;
+
+typedef struct {
+     const char *string;
+     int length;
+     stack_item_t *stack;
+} vm_t;
+
+/*
+ * The sparse array is never cleared: any value may be found there.
+ */
+static bool_t list_has(thread_list_t *list, int pc) {
+     unsigned int i = list->sparse[pc];
+     return i < (unsigned int)list->count && list->pcs[i] == pc;
+}
+
+static bool_t assertion(vm_t *vm, int kind, int pos) {
+     switch (kind) {
+     case assert_bol:
+          return pos == 0;
+     case assert_eol:
+          return pos == vm->length || (pos == vm->length - 1 && vm->string[pos] == '\n');
+     case assert_word:
+     case assert_not_word:
+          return ((pos > 0 && is_word((unsigned char)vm->string[pos - 1])) != (pos < vm->length && is_word((unsigned char)vm->string[pos]))) == (kind == assert_word);
+     }
+     return false;
+}
+
+/*
+ * Follows the empty transitions from *pc*, depth first in priority
+ * order, and adds the threads that wait for a character (or that
+ * match) to the list. The slots are restored on the way back.
+ */
+static void add_thread(linear_engine_t *this, vm_t *vm, thread_list_t *list, int pc, int pos, PCRE2_SIZE *slots) {
+     stack_item_t *stack = vm->stack;
+     int n = 0, i;
+     inst_t *inst;
+
+     stack[n].kind = pc;
+     n++;
+     while (n > 0) {
+          n--;
+          if (stack[n].kind < 0) {
+               slots[-1 - stack[n].kind] = stack[n].value;
+               continue;
+          }
+          pc = stack[n].kind;
+          if (list_has(list, pc)) {
+               continue;
+          }
+          i = list->count++;
+          list->pcs[i] = pc;
+          list->sparse[pc] = i;
+          inst = this->program + pc;
+          switch (inst->op) {
+          case op_jmp:
+               stack[n++].kind = inst->x;
+               break;
+          case op_split:
+               stack[n++].kind = inst->y;
+               stack[n++].kind = inst->x;
+               break;
+          case op_save:
+               stack[n].kind = -1 - inst->x;
+               stack[n++].value = slots[inst->x];
+               slots[inst->x] = pos;
+               stack[n++].kind = pc + 1;
+               break;
+          case op_assert:
+               if (assertion(vm, inst->x, pos)) {
+                    stack[n++].kind = pc + 1;
+               }
+               break;
+          default:
+               memcpy(list->slots + i * this->slots, slots, this->slots * sizeof(PCRE2_SIZE));
+               break;
+          }
+     }
+}
+
+/*
+ * The workspace holds two thread lists, the slots of a new thread,
+ * and the stack of add_thread().
+ */
+static size_t workspace_size(linear_engine_t *this) {
+     size_t list = this->length * (2 * sizeof(int) + this->slots * sizeof(PCRE2_SIZE));
+     return 2 * list + this->slots * sizeof(PCRE2_SIZE) + (2 * this->length + 1) * sizeof(stack_item_t);
+}
+
+static void workspace_lists(linear_engine_t *this, regexp_workspace_t *workspace, thread_list_t *lists, PCRE2_SIZE **slots, stack_item_t **stack) {
+     size_t size = workspace_size(this);
+     char *p;
+     int i;
+     if (workspace->size < size) {
+          free(workspace->buffer);
+          workspace->buffer = malloc(size);
+          workspace->size = size;
+     }
+     p = workspace->buffer;
+     *stack = (stack_item_t *)p;
+     p += (2 * this->length + 1) * sizeof(stack_item_t);
+     for (i = 0; i < 2; i++) {
+          lists[i].count = 0;
+          lists[i].slots = (PCRE2_SIZE *)p;
+          p += this->length * this->slots * sizeof(PCRE2_SIZE);
+          lists[i].pcs = (int *)p;
+          p += this->length * sizeof(int);
+          lists[i].sparse = (int *)p;
+          p += this->length * sizeof(int);
+     }
+     *slots = (PCRE2_SIZE *)p;
+}
+
+static int vm_exec(linear_engine_t *this, const char *string, int start, int length, int pcre_flags, PCRE2_SIZE *ovector, regexp_workspace_t *workspace) {
+     thread_list_t lists[2], *current = lists, *next = lists + 1, *swap;
+     bool_t not_empty = (pcre_flags & PCRE2_NOTEMPTY_ATSTART) != 0;
+     bool_t matched = false;
+     PCRE2_SIZE *slots, *thread;
+     vm_t vm = { string, length, NULL };
+     int pos = start, i, c, result;
+     inst_t *inst;
+
+     workspace_lists(this, workspace, lists, &slots, &(vm.stack));
+     for (;;) {
+          if (!matched) {
+               if (current->count == 0) {
+                    pos = next_start(this, string, pos, length);
+                    if (pos == length && !this->empty) {
+                         break;
+                    }
+               }
+               if (this->empty || (pos < length && this->first[(unsigned char)string[pos]])) {
+                    for (i = 0; i < this->slots; i++) {
+                         slots[i] = PCRE2_UNSET;
+                    }
+                    add_thread(this, &vm, current, 0, pos, slots);
+               }
+          }
+          if (current->count == 0) {
+               break;
+          }
+          c = pos < length ? (unsigned char)string[pos] : -1;
+          next->count = 0;
+          for (i = 0; i < current->count; i++) {
+               inst = this->program + current->pcs[i];
+               thread = current->slots + i * this->slots;
+               switch (inst->op) {
+               case op_char:
+                    if (c == inst->x) {
+                         add_thread(this, &vm, next, current->pcs[i] + 1, pos + 1, thread);
+                    }
+                    break;
+               case op_class:
+                    if (c >= 0 && set_has(this->classes + inst->x, c)) {
+                         add_thread(this, &vm, next, current->pcs[i] + 1, pos + 1, thread);
+                    }
+                    break;
+               case op_any:
+                    if (c >= 0 && c != '\n') {
+                         add_thread(this, &vm, next, current->pcs[i] + 1, pos + 1, thread);
+                    }
+                    break;
+               case op_match:
+                    if (!not_empty || thread[0] != (PCRE2_SIZE)start || thread[1] != (PCRE2_SIZE)start) {
+                         /* the threads after this one have a lower priority */
+                         memcpy(ovector, thread, this->slots * sizeof(PCRE2_SIZE));
+                         matched = true;
+                         i = current->count;
+                    }
+                    break;
+               default:
+                    break;
+               }
+          }
+          if (pos == length) {
+               break;
+          }
+          swap = current;
+          current = next;
+          next = swap;
+          pos++;
+     }
+
+     if (!matched) {
+          return PCRE2_ERROR_NOMATCH;
+     }
+     for (result = this->groups + 1; result > 1 && ovector[2 * result - 2] == PCRE2_UNSET; result--);
+     return result;
+}
+
+/*
+ * The DFAs
+ *
+ * Patterns without assertions that cannot match the empty string are
+ * first searched by two DFAs, built with the engine: the forward one
+ * finds where the match ends, the backward one, run from there on the
+ * reversed pattern, finds where it starts. The VM is then only needed
+ * for the groups.
+ *
+ * A state of the forward DFA is a list of threads in priority order,
+ * cut after a match as in the VM, and whether a match was seen (no
+ * thread is started after that). The backward DFA looks for the
+ * longest match, i.e. the leftmost start: no cut.
+ */
+
+#define MAX_STATES 256
+#define DEAD_STATE -1
+
+typedef struct dfa_s {
+     int states;
+     short *next; /* states x byte classes */
+     char *match; /* does the state end a match */
+} dfa_t;
+
+typedef struct {
+     const linear_engine_t *engine;
+     const inst_t *program;
+     int length;
+     bool_t forward;
+     int *pcs; /* the lists of all the states, one after the other */
+     int pcs_count;
+     int pcs_capacity;
+     int offset[MAX_STATES];
+     int count[MAX_STATES];
+     bool_t matched[MAX_STATES];
+     int states;
+     char *seen;
+     int *stack;
+} dfa_builder_t;
+
+static void byte_classes(linear_engine_t *this) {
+     char bound[257] = { 0 };
+     inst_t *inst;
+     int pc, c;
+     for (pc = 0; pc < this->length; pc++) {
+          inst = this->program + pc;
+          switch (inst->op) {
+          case op_char:
+               bound[inst->x] = bound[inst->x + 1] = 1;
+               break;
+          case op_class:
+               for (c = 1; c < 256; c++) {
+                    if (set_has(this->classes + inst->x, c) != set_has(this->classes + inst->x, c - 1)) {
+                         bound[c] = 1;
+                    }
+               }
+               break;
+          case op_any:
+               bound['\n'] = bound['\n' + 1] = 1;
+               break;
+          default:
+               break;
+          }
+     }
+     this->map[0] = 0;
+     for (c = 1; c < 256; c++) {
+          this->map[c] = this->map[c - 1] + bound[c];
+     }
+     this->bytes = this->map[255] + 1;
+}
+
+/*
+ * Appends the threads that follow *pc* to the list, in priority order
+ * (as add_thread() does).
+ */
+static void dfa_closure(dfa_builder_t *this, int pc, int *list, int *n) {
+     const inst_t *inst;
+     int sp = 0;
+     this->stack[sp++] = pc;
+     while (sp > 0) {
+          pc = this->stack[--sp];
+          if (this->seen[pc]) {
+               continue;
+          }
+          this->seen[pc] = 1;
+          inst = this->program + pc;
+          switch (inst->op) {
+          case op_jmp:
+               this->stack[sp++] = inst->x;
+               break;
+          case op_split:
+               this->stack[sp++] = inst->y;
+               this->stack[sp++] = inst->x;
+               break;
+          case op_save:
+               this->stack[sp++] = pc + 1;
+               break;
+          default:
+               list[(*n)++] = pc;
+               break;
+          }
+     }
+}
+
+/*
+ * Returns the state of the list, new if needed; MAX_STATES if there
+ * are too many states.
+ */
+static int dfa_state(dfa_builder_t *this, const int *list, int n, bool_t matched) {
+     int i;
+     if (n == 0) {
+          return DEAD_STATE;
+     }
+     for (i = 0; i < this->states; i++) {
+          if (this->count[i] == n && this->matched[i] == matched && !memcmp(this->pcs + this->offset[i], list, n * sizeof(int))) {
+               return i;
+          }
+     }
+     if (this->states == MAX_STATES) {
+          return MAX_STATES;
+     }
+     if (this->pcs_count + n > this->pcs_capacity) {
+          this->pcs_capacity = 2 * (this->pcs_count + n);
+          this->pcs = realloc(this->pcs, this->pcs_capacity * sizeof(int));
+     }
+     memcpy(this->pcs + this->pcs_count, list, n * sizeof(int));
+     this->offset[this->states] = this->pcs_count;
+     this->count[this->states] = n;
+     this->matched[this->states] = matched;
+     this->pcs_count += n;
+     return this->states++;
+}
+
+static int dfa_step(dfa_builder_t *this, int state, int c, int *list) {
+     const int *pcs = this->pcs + this->offset[state];
+     bool_t matched = this->matched[state];
+     const inst_t *inst;
+     int i, j, n = 0;
+
+     memset(this->seen, 0, this->length);
+     for (i = 0; i < this->count[state]; i++) {
+          inst = this->program + pcs[i];
+          if ((inst->op == op_char && inst->x == c)
+              || (inst->op == op_class && set_has(this->engine->classes + inst->x, c))
+              || (inst->op == op_any && c != '\n')) {
+               j = n;
+               dfa_closure(this, pcs[i] + 1, list, &n);
+               if (this->forward) {
+                    for (; j < n && this->program[list[j]].op != op_match; j++);
+                    if (j < n) {
+                         n = j + 1;
+                         matched = true;
+                         break;
+                    }
+               }
+          }
+     }
+     if (this->forward && !matched) {
+          dfa_closure(this, 0, list, &n);
+     }
+     return dfa_state(this, list, n, matched);
+}
+
+static void free_dfa(dfa_t *this) {
+     if (this != NULL) {
+          free(this->next);
+          free(this->match);
+          free(this);
+     }
+}
+
+/*
+ * Returns NULL if the DFA has too many states.
+ */
+static dfa_t *new_dfa(const linear_engine_t *engine, const inst_t *program, int length, bool_t forward) {
+     dfa_builder_t *builder = malloc(sizeof(dfa_builder_t));
+     dfa_t *result = malloc(sizeof(dfa_t));
+     int *list = malloc(length * sizeof(int));
+     int state, k, c, n = 0, next = 0;
+
+     builder->engine = engine;
+     builder->program = program;
+     builder->length = length;
+     builder->forward = forward;
+     builder->pcs = NULL;
+     builder->pcs_count = builder->pcs_capacity = 0;
+     builder->states = 0;
+     builder->seen = calloc(length, 1);
+     builder->stack = malloc((2 * length + 1) * sizeof(int));
+     result->next = malloc(MAX_STATES * engine->bytes * sizeof(short));
+     result->match = malloc(MAX_STATES);
+
+     dfa_closure(builder, 0, list, &n);
+     dfa_state(builder, list, n, false);
+     for (state = 0; next != MAX_STATES && state < builder->states; state++) {
+          for (k = 0, c = 0; next != MAX_STATES && k < engine->bytes; k++) {
+               for (; engine->map[c] != k; c++);
+               next = dfa_step(builder, state, c, list);
+               result->next[state * engine->bytes + k] = next;
+          }
+          n = builder->count[state];
+          for (k = 0; k < n && program[builder->pcs[builder->offset[state] + k]].op != op_match; k++);
+          result->match[state] = k < n;
+     }
+
+     if (next == MAX_STATES) {
+          free_dfa(result);
+          result = NULL;
+     } else {
+          result->states = builder->states;
+          result->next = realloc(result->next, result->states * engine->bytes * sizeof(short));
+          result->match = realloc(result->match, result->states);
+     }
+     free(builder->stack);
+     free(builder->seen);
+     free(builder->pcs);
+     free(builder);
+     free(list);
+     return result;
+}
+
+/*
+ * The state 0 of the forward DFA only waits for a match to start: the
+ * bytes that cannot start one are skipped.
+ */
+static int dfa_exec(linear_engine_t *this, const char *string, int start, int length, PCRE2_SIZE *ovector) {
+     const unsigned char *bytes = (const unsigned char *)string, *map = this->map;
+     const short *next = this->forward->next;
+     const char *match = this->forward->match;
+     int state = 0, pos = start, end = -1, width = this->bytes;
+
+     while (pos < length) {
+          if (state == 0) {
+               pos = next_start(this, string, pos, length);
+               if (pos == length) {
+                    break;
+               }
+          }
+          state = next[state * width + map[bytes[pos++]]];
+          if (state == DEAD_STATE) {
+               break;
+          }
+          if (match[state]) {
+               end = pos;
+          }
+     }
+     if (end < 0) {
+          return PCRE2_ERROR_NOMATCH;
+     }
+
+     next = this->backward->next;
+     match = this->backward->match;
+     ovector[1] = end;
+     for (state = 0, pos = end; pos > start; ) {
+          state = next[state * width + map[bytes[--pos]]];
+          if (state == DEAD_STATE) {
+               break;
+          }
+          if (match[state]) {
+               ovector[0] = pos;
+          }
+     }
+     return 1;
+}
+
+static int linear_exec(linear_engine_t *this, const char *string, int start, int length, int pcre_flags, PCRE2_SIZE *ovector, regexp_workspace_t *workspace) {
+     int result;
+     if (this->forward == NULL) {
+          return vm_exec(this, string, start, length, pcre_flags, ovector, workspace);
+     }
+     result = dfa_exec(this, string, start, length, ovector);
+     if (result < 0 || this->groups == 0) {
+          return result;
+     }
+     return vm_exec(this, string, ovector[0], length, pcre_flags, ovector, workspace);
+}
+
+/*
+ * The DFAs do not know the assertions, nor the empty matches (which
+ * PCRE2_NOTEMPTY_ATSTART may forbid).
+ */
+static void new_dfas(linear_engine_t *this, node_t *tree) {
+     compiler_t compiler;
+     int pc;
+
+     this->forward = this->backward = NULL;
+     for (pc = 0; pc < this->length && this->program[pc].op != op_assert; pc++);
+     if (this->empty || pc < this->length) {
+          return;
+     }
+
+     byte_classes(this);
+     this->forward = new_dfa(this, this->program, this->length, true);
+     if (this->forward != NULL) {
+          compiler.program = malloc((MAX_PROGRAM + 1) * sizeof(inst_t));
+          compiler.length = 0;
+          compiler.ok = true;
+          compiler.reverse = true;
+          compile_node(&compiler, tree);
+          emit(&compiler, op_match, 0, 0);
+          this->backward = new_dfa(this, compiler.program, compiler.length, false);
+          free(compiler.program);
+          if (this->backward == NULL) {
+               free_dfa(this->forward);
+               this->forward = NULL;
+          }
+     }
+}
+
+static const char *linear_name(linear_engine_t *this) {
+     return "linear";
+}
+
+static void linear_free(linear_engine_t *this) {
+     free_dfa(this->forward);
+     free_dfa(this->backward);
+     free(this->prefix);
+     free(this->program);
+     free(this->classes);
+     free(this);
+}
+
+static regexp_engine_t linear_engine_fn = {
+     .name = (regexp_engine_name_fn)linear_name,
+     .exec = (regexp_engine_exec_fn)linear_exec,
+     .free = (regexp_engine_free_fn)linear_free,
+};
+
+/*
+ * The groups are counted again, as a check that the pattern is read
+ * as PCRE2 reads it. The dot and the dollar depend on the newline
+ * convention, which must be LF.
+ */
+regexp_engine_t *new_linear_engine(logger_t log, const char *regex, int pcre_flags, int groups) {
+     linear_engine_t *result = NULL;
+     parser_t *parser;
+     compiler_t compiler;
+     uint32_t newline = 0;
+     node_t *tree;
+
+     pcre2_config(PCRE2_CONFIG_NEWLINE, &newline);
+     if (pcre_flags != 0 || newline != PCRE2_NEWLINE_LF) {
+          return NULL;
+     }
+
+     parser = malloc(sizeof(parser_t));
+     parser->p = regex;
+     parser->ok = true;
+     parser->groups = 0;
+     parser->count = 0;
+     parser->classes = NULL;
+     parser->classes_count = 0;
+     tree = parse_alt(parser);
+
+     if (parser->ok && *parser->p == '\0' && parser->groups == groups) {
+          compiler.program = malloc((MAX_PROGRAM + 1) * sizeof(inst_t));
+          compiler.length = 0;
+          compiler.ok = true;
+          compiler.reverse = false;
+          emit(&compiler, op_save, 0, 0);
+          compile_node(&compiler, tree);
+          emit(&compiler, op_save, 1, 0);
+          emit(&compiler, op_match, 0, 0);
+          if (compiler.ok) {
+               result = malloc(sizeof(linear_engine_t));
+               result->fn = linear_engine_fn;
+               result->log = log;
+               result->groups = groups;
+               result->slots = 2 * (groups + 1);
+               result->length = compiler.length;
+               result->program = realloc(compiler.program, compiler.length * sizeof(inst_t));
+               result->classes = parser->classes;
+               parser->classes = NULL;
+               first_bytes(result);
+               literal_prefix(result);
+               new_dfas(result, tree);
+          } else {
+               free(compiler.program);
+          }
+     }
+
+     free(parser->classes);
+     free(parser);
+     return result == NULL ? NULL : &(result->fn);
+}
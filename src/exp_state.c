@@ -0,0 +1,416 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @ingroup exp_input
+ * @file
+ *
+ * This file contains the implementation of the incremental analysis
+ * state.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cad_array.h>
+
+#include "exp_state.h"
+#include "exp_decompress.h"
+
+#define STATE_MAGIC "ExPstate"
+#define STATE_VERSION 1
+#define CHECKSUM_BLOCK_SIZE 4096
+#define MAX_STRING_SIZE (1024 * 1024)
+#define NO_STRING ((uint64_t)-1)
+
+void state_write_number(FILE *out, uint64_t value) {
+     fwrite(&value, sizeof(uint64_t), 1, out);
+}
+
+void state_write_string(FILE *out, const char *value) {
+     size_t length;
+     if (value == NULL) {
+          state_write_number(out, NO_STRING);
+     } else {
+          length = strlen(value);
+          state_write_number(out, length);
+          fwrite(value, 1, length, out);
+     }
+}
+
+bool_t state_read_number(FILE *in, uint64_t *value) {
+     return fread(value, sizeof(uint64_t), 1, in) == 1;
+}
+
+bool_t state_read_string(FILE *in, char **value) {
+     uint64_t length;
+     *value = NULL;
+     if (!state_read_number(in, &length)) {
+          return false;
+     }
+     if (length == NO_STRING) {
+          return true;
+     }
+     if (length > MAX_STRING_SIZE) {
+          return false;
+     }
+     *value = malloc(length + 1);
+     if (fread(*value, 1, length, in) != length) {
+          free(*value);
+          *value = NULL;
+          return false;
+     }
+     (*value)[length] = '\0';
+     return true;
+}
+
+typedef struct {
+     uint64_t dev;
+     uint64_t ino;
+     uint64_t offset;
+     uint64_t checksum;
+     uint64_t entries;
+     char *factory;
+     char *path;
+     bool_t seen;
+} state_file_t;
+
+typedef struct {
+     state_t fn;
+     logger_t log;
+     uint64_t signature;
+     cad_array_t *files;
+     char path[0];
+} state_impl_t;
+
+static void state_file_free(state_file_t *file) {
+     free(file->factory);
+     free(file->path);
+     free(file);
+}
+
+static void clear_files(state_impl_t *this) {
+     int i, n = this->files->count(this->files);
+     for (i = n - 1; i >= 0; i--) {
+          state_file_free(*(state_file_t **)this->files->get(this->files, i));
+          this->files->del(this->files, i);
+     }
+}
+
+static state_file_t *find_file(state_impl_t *this, struct stat *st) {
+     state_file_t *result;
+     int i, n = this->files->count(this->files);
+     for (i = 0; i < n; i++) {
+          result = *(state_file_t **)this->files->get(this->files, i);
+          if (result->dev == (uint64_t)st->st_dev && result->ino == (uint64_t)st->st_ino) {
+               return result;
+          }
+     }
+     return NULL;
+}
+
+/*
+ * The checksum of the block preceding the offset, to tell if the file
+ * was changed other than by appending lines.
+ */
+static bool_t checksum(int fd, size_t offset, uint64_t *result) {
+     char buffer[CHECKSUM_BLOCK_SIZE];
+     size_t length = offset < CHECKSUM_BLOCK_SIZE ? offset : CHECKSUM_BLOCK_SIZE;
+     if (pread(fd, buffer, length, offset - length) != (ssize_t)length) {
+          return false;
+     }
+     *result = hash_bytes(HASH_INIT, buffer, length);
+     return true;
+}
+
+static bool_t open_file(const char *filename, struct stat *st, int *fd) {
+     if (!strcmp("-", filename)) {
+          return false;
+     }
+     *fd = open(filename, O_RDONLY);
+     if (*fd < 0) {
+          return false;
+     }
+     if (fstat(*fd, st) != 0 || !S_ISREG(st->st_mode)) {
+          close(*fd);
+          return false;
+     }
+     return true;
+}
+
+/*
+ * A file read by a previous run can be resumed only if what was read
+ * is unchanged; a compressed file cannot be read from an offset, so it
+ * must be unchanged altogether.
+ */
+static bool_t file_unchanged(state_impl_t *this, const char *filename) {
+     state_file_t *file;
+     struct stat st;
+     uint64_t sum;
+     bool_t result = true;
+     int fd;
+
+     if (!open_file(filename, &st, &fd)) {
+          return true;
+     }
+     file = find_file(this, &st);
+     if (file != NULL) {
+          result = file->offset <= (uint64_t)st.st_size && checksum(fd, file->offset, &sum) && sum == file->checksum
+               && (file->offset == (uint64_t)st.st_size || !is_compressed(fd));
+          if (!result) {
+               this->log(info, "File changed: %s\n", filename);
+          }
+     }
+     close(fd);
+     return result;
+}
+
+static size_t state_resume(state_impl_t *this, const char *filename, const char **factory, size_t *entries) {
+     state_file_t *file;
+     struct stat st;
+     int fd;
+
+     *factory = NULL;
+     *entries = 0;
+     if (!open_file(filename, &st, &fd)) {
+          return 0;
+     }
+
+     file = find_file(this, &st);
+     close(fd);
+     if (file == NULL) {
+          this->log(info, "New file: %s\n", filename);
+          return 0;
+     }
+
+     /* changed files were checked by load */
+     this->log(info, "Resuming file at offset %lu: %s\n", (unsigned long)file->offset, filename);
+     *factory = file->factory;
+     *entries = file->entries;
+     return file->offset;
+}
+
+static void state_update(state_impl_t *this, const char *filename, size_t offset, const char *factory, size_t entries) {
+     state_file_t *file;
+     struct stat st;
+     uint64_t sum;
+     int fd;
+
+     if (!open_file(filename, &st, &fd)) {
+          return;
+     }
+     if (!checksum(fd, offset, &sum)) {
+          this->log(warn, "Could not read file, not recorded: %s\n", filename);
+          close(fd);
+          return;
+     }
+     close(fd);
+
+     file = find_file(this, &st);
+     if (file == NULL) {
+          file = malloc(sizeof(state_file_t));
+          file->dev = st.st_dev;
+          file->ino = st.st_ino;
+          file->factory = NULL;
+          file->path = NULL;
+          this->files->insert(this->files, this->files->count(this->files), &file);
+     }
+     free(file->factory);
+     free(file->path);
+     file->offset = offset;
+     file->checksum = sum;
+     file->entries = entries;
+     file->factory = strdup(factory);
+     file->path = strdup(filename);
+     file->seen = true;
+}
+
+static bool_t read_files(state_impl_t *this, FILE *in) {
+     state_file_t *file;
+     uint64_t i, n;
+     bool_t ok;
+
+     if (!state_read_number(in, &n)) {
+          return false;
+     }
+     for (i = 0; i < n; i++) {
+          file = malloc(sizeof(state_file_t));
+          file->seen = false;
+          file->factory = file->path = NULL;
+          ok = state_read_number(in, &(file->dev))
+               && state_read_number(in, &(file->ino))
+               && state_read_number(in, &(file->offset))
+               && state_read_number(in, &(file->checksum))
+               && state_read_number(in, &(file->entries))
+               && state_read_string(in, &(file->factory)) && file->factory != NULL
+               && state_read_string(in, &(file->path)) && file->path != NULL;
+          if (!ok) {
+               state_file_free(file);
+               return false;
+          }
+          this->files->insert(this->files, this->files->count(this->files), &file);
+     }
+     return true;
+}
+
+static bool_t files_unchanged(state_impl_t *this, int count, const char * const *filenames) {
+     bool_t result = true;
+     int i;
+     for (i = 0; i < count; i++) {
+          result = file_unchanged(this, filenames[i]) && result;
+     }
+     return result;
+}
+
+static bool_t state_load(state_impl_t *this, int count, const char * const *filenames, state_reader_fn reader, void *data) {
+     FILE *in = fopen(this->path, "r");
+     char magic[8];
+     uint64_t version, signature;
+     bool_t result;
+
+     if (in == NULL) {
+          if (errno != ENOENT) {
+               this->log(warn, "Could not read state %s: %s\n", this->path, strerror(errno));
+          } else {
+               this->log(info, "No state yet: %s\n", this->path);
+          }
+          return false;
+     }
+
+     result = fread(magic, 8, 1, in) == 1 && !memcmp(magic, STATE_MAGIC, 8)
+          && state_read_number(in, &version) && version == STATE_VERSION
+          && state_read_number(in, &signature) && signature == this->signature;
+     if (!result) {
+          this->log(warn, "Ignoring incompatible state: %s\n", this->path);
+     } else if (!read_files(this, in)) {
+          this->log(warn, "Ignoring unusable state: %s\n", this->path);
+          clear_files(this);
+          result = false;
+     } else if (!files_unchanged(this, count, filenames)) {
+          /* the aggregated data holds the lines of the changed files: it cannot be kept */
+          this->log(info, "Ignoring state, reading all the files from the start: %s\n", this->path);
+          clear_files(this);
+          result = false;
+     } else {
+          result = reader(data, in);
+          if (!result) {
+               this->log(warn, "Ignoring unusable state: %s\n", this->path);
+               clear_files(this);
+          }
+     }
+
+     fclose(in);
+     if (result) {
+          this->log(info, "Restored state: %s\n", this->path);
+     }
+     return result;
+}
+
+/*
+ * Files that were not read during this run are kept as long as they
+ * still exist: they may be given again later.
+ */
+static bool_t keep_file(state_file_t *file) {
+     struct stat st;
+     return file->seen || (stat(file->path, &st) == 0 && (uint64_t)st.st_dev == file->dev && (uint64_t)st.st_ino == file->ino);
+}
+
+static void write_files(state_impl_t *this, FILE *out) {
+     state_file_t *file;
+     int i, n = this->files->count(this->files);
+     uint64_t count = 0;
+     for (i = 0; i < n; i++) {
+          if (keep_file(*(state_file_t **)this->files->get(this->files, i))) {
+               count++;
+          }
+     }
+     state_write_number(out, count);
+     for (i = 0; i < n; i++) {
+          file = *(state_file_t **)this->files->get(this->files, i);
+          if (keep_file(file)) {
+               state_write_number(out, file->dev);
+               state_write_number(out, file->ino);
+               state_write_number(out, file->offset);
+               state_write_number(out, file->checksum);
+               state_write_number(out, file->entries);
+               state_write_string(out, file->factory);
+               state_write_string(out, file->path);
+          }
+     }
+}
+
+static bool_t state_save(state_impl_t *this, state_writer_fn writer, void *data) {
+     char *tmp = malloc(strlen(this->path) + 8);
+     bool_t result = false;
+     FILE *out;
+     int fd;
+
+     /* written aside then renamed, so that the previous state is kept on error */
+     sprintf(tmp, "%s.XXXXXX", this->path);
+     fd = mkstemp(tmp);
+     if (fd < 0) {
+          this->log(warn, "Could not write state %s: %s\n", this->path, strerror(errno));
+          free(tmp);
+          return false;
+     }
+
+     out = fdopen(fd, "w");
+     fwrite(STATE_MAGIC, 8, 1, out);
+     state_write_number(out, STATE_VERSION);
+     state_write_number(out, this->signature);
+     write_files(this, out);
+     writer(data, out);
+     result = !ferror(out);
+     result = fclose(out) == 0 && result;
+
+     if (result && rename(tmp, this->path) == 0) {
+          this->log(info, "Saved state: %s\n", this->path);
+     } else {
+          this->log(warn, "Could not write state %s: %s\n", this->path, strerror(errno));
+          unlink(tmp);
+          result = false;
+     }
+
+     free(tmp);
+     return result;
+}
+
+static void state_free(state_impl_t *this) {
+     clear_files(this);
+     this->files->free(this->files);
+     free(this);
+}
+
+static state_t state_impl_fn = {
+     .load = (state_load_fn)state_load,
+     .resume = (state_resume_fn)state_resume,
+     .update = (state_update_fn)state_update,
+     .save = (state_save_fn)state_save,
+     .free = (state_free_fn)state_free,
+};
+
+state_t *new_state(logger_t log, const char *path, uint64_t signature) {
+     state_impl_t *result = malloc(sizeof(state_impl_t) + strlen(path) + 1);
+     result->fn = state_impl_fn;
+     result->log = log;
+     result->signature = signature;
+     result->files = cad_new_array(stdlib_memory, sizeof(state_file_t *));
+     strcpy(result->path, path);
+     return &(result->fn);
+}
@@ -0,0 +1,199 @@
+/*
+  This file is part of ExP.
+
+  ExP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, version 3 of the License.
+
+  ExP is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ExP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __EXP_STATE_H__
+#define __EXP_STATE_H__
+
+/**
+ * @file
+ * The header for the incremental analysis state.
+ */
+
+#include <stdio.h>
+
+#include "exp.h"
+#include "exp_log.h"
+
+/**
+ * @addtogroup exp_input
+ * @{
+ */
+
+/**
+ * The state interface.
+ *
+ * The state remembers, for each scanned file, the offset it was read
+ * up to, along with a checksum of the block preceding that offset; and
+ * the data aggregated by the output. A later run restores the
+ * aggregated data and only reads what was appended to the files since.
+ *
+ * Files are known by their device and inode: a rotated file is a new
+ * file, read from its start. If one of the files is shorter than its
+ * offset, or its checksum does not match (e.g. truncated and written
+ * again), or it is compressed and changed at all, the aggregated data
+ * cannot be kept: the state is ignored and all the files are read from
+ * their start.
+ */
+typedef struct state_s state_t;
+
+/**
+ * Called by [load](@ref state_load_fn) to restore the aggregated data.
+ *
+ * @param[in] data the data given to `load`
+ * @param[in] in the state file
+ *
+ * @return `true` if the data was restored, `false` otherwise
+ */
+typedef bool_t (*state_reader_fn)(void *data, FILE *in);
+
+/**
+ * Called by [save](@ref state_save_fn) to save the aggregated data.
+ *
+ * @param[in] data the data given to `save`
+ * @param[in] out the state file
+ */
+typedef void (*state_writer_fn)(void *data, FILE *out);
+
+/**
+ * Restore the state saved by a previous run, if any, and if none of the
+ * files to read changed since.
+ *
+ * @param[in] this the target state
+ * @param[in] count the number of files to read
+ * @param[in] filenames the names of the files to read
+ * @param[in] reader the function that restores the aggregated data
+ * @param[in] data the data given to the reader (usually the output)
+ *
+ * @return `true` if a state was restored, `false` otherwise
+ */
+typedef bool_t (*state_load_fn)(state_t *this, int count, const char * const *filenames, state_reader_fn reader, void *data);
+
+/**
+ * Get where to resume reading a file.
+ *
+ * @param[in] this the target state
+ * @param[in] filename the name of the file
+ * @param[out] factory the name of the factory the file was parsed with, or `null` if the file must be read from its start
+ * @param[out] entries the number of entries already read from the file
+ *
+ * @return the offset to resume at (0 to read the whole file)
+ */
+typedef size_t (*state_resume_fn)(state_t *this, const char *filename, const char **factory, size_t *entries);
+
+/**
+ * Record how far a file was read.
+ *
+ * @param[in] this the target state
+ * @param[in] filename the name of the file
+ * @param[in] offset the offset to resume at next time
+ * @param[in] factory the name of the factory the file was parsed with
+ * @param[in] entries the number of entries read from the file, including the ones of previous runs
+ */
+typedef void (*state_update_fn)(state_t *this, const char *filename, size_t offset, const char *factory, size_t entries);
+
+/**
+ * Save the state, for the next run.
+ *
+ * @param[in] this the target state
+ * @param[in] writer the function that saves the aggregated data
+ * @param[in] data the data given to the writer (usually the output)
+ *
+ * @return `true` if the state was saved, `false` otherwise
+ */
+typedef bool_t (*state_save_fn)(state_t *this, state_writer_fn writer, void *data);
+
+/**
+ * Free the state.
+ *
+ * @param[in] this the target state
+ */
+typedef void (*state_free_fn)(state_t *this);
+
+struct state_s {
+     /**
+      * @see state_load_fn
+      */
+     state_load_fn load;
+     /**
+      * @see state_resume_fn
+      */
+     state_resume_fn resume;
+     /**
+      * @see state_update_fn
+      */
+     state_update_fn update;
+     /**
+      * @see state_save_fn
+      */
+     state_save_fn save;
+     /**
+      * @see state_free_fn
+      */
+     state_free_fn free;
+};
+
+/**
+ * Create a new state.
+ *
+ * @param[in] log the logger
+ * @param[in] path the path of the state file
+ * @param[in] signature the signature of the entry factories; a state saved with other factories is not restored
+ *
+ * @return the new state
+ */
+state_t *new_state(logger_t log, const char *path, uint64_t signature);
+
+/**
+ * Write a number to a state file.
+ *
+ * @param[in] out the state file
+ * @param[in] value the number to write
+ */
+void state_write_number(FILE *out, uint64_t value);
+
+/**
+ * Write a string to a state file.
+ *
+ * @param[in] out the state file
+ * @param[in] value the string to write; may be `null`
+ */
+void state_write_string(FILE *out, const char *value);
+
+/**
+ * Read a number from a state file.
+ *
+ * @param[in] in the state file
+ * @param[out] value the number read
+ *
+ * @return `true` if the number was read, `false` otherwise
+ */
+bool_t state_read_number(FILE *in, uint64_t *value);
+
+/**
+ * Read a string from a state file.
+ *
+ * @param[in] in the state file
+ * @param[out] value the string read (to be freed by the caller); may be `null`
+ *
+ * @return `true` if the string was read, `false` otherwise
+ */
+bool_t state_read_string(FILE *in, char **value);
+
+/**
+ * @}
+ */
+
+#endif /* __EXP_STATE_H__ */
@@ -35,6 +35,7 @@
 #include "exp_regexp.h"
 #include "exp_entry.h"
 #include "exp_entry_factory.h"
+#include "exp_arena.h"
 
 #define THIS_YEAR 0
 
@@ -48,15 +49,83 @@ static const char *dirs[] = {
      NULL
 };
 
+#define BSD_SYSLOG_PATTERN "^(?<date>(?<strmonth>[A-Z][a-z]{2})[[:space:]]+(?<day>[0-9][0-9]?)[[:space:]]+(?<hour>[0-9]{2}):(?<minute>[0-9]{2}):(?<second>[0-9]{2}))[[:space:]]+(?<host>[^[:space:]]+)[[:space:]]+(?<daemon>[^[:space:]]+)[[:space:]]+(?<log>.*?)[[:space:]]*$"
+#define APACHE_ACCESS_PATTERN "^(?<ip>[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}\\.[0-9]{1,3}) (?<rhost>[^[:space:]]+) - ((?<user>[^[:space:]]*) - )?\\[(?<date>(?<day>[0-9][0-9]?)/+(?<strmonth>[A-Z][a-z]{2})/(?<year>[0-9]{4}):(?<hour>[0-9]{2}):(?<minute>[0-9]{2}):(?<second>[0-9]{2})[[:space:]]+[-+][0-9]{4})\\][[:space:]]+\\\"(?<query>[A-Z]+[[:space:]]+(?<host>(?<log>[^\\\"]+?))[[:space:]]+HTTP/[12]\\.[01])\\\"[[:space:]]+(?<status>[0-9]{3})[[:space:]]+(?<contentlength>([0-9]+|-)).*?[[:space:]]*$"
+
+/*
+ * A part of a line; the start of a missing part is NULL. Entries also
+ * use spans for `\0`-terminated strings (see syslog_entry_t).
+ */
+typedef struct {
+     const char *start;
+     int length;
+} span_t;
+
+#define STRING_SPAN -1 /* a constant string */
+#define OWNED_SPAN  -2 /* a string owned by the entry */
+
+/*
+ * The fields of a line, as found either by a pattern or by a native
+ * parser.
+ */
+typedef struct {
+     int year  ;
+     int month ;
+     int day   ;
+     int hour  ;
+     int minute;
+     int second;
+     span_t host;
+     span_t daemon;
+     span_t log;
+} syslog_fields_t;
+
+/*
+ * A native parser gives exactly the fields its pattern would give, in
+ * one pass and without copying. It may decline a line it is not sure
+ * about, which is then given to the pattern. The year is preset to the
+ * default year.
+ */
+typedef struct {
+     const char *pattern;
+     bool_t (*parse)(const char *buffer, int length, syslog_fields_t *fields);
+} native_parser_t;
+
+/*
+ * A pattern of the factory, with the numbers of its groups (-1 if the
+ * pattern does not have the group), found once when it is read.
+ */
+typedef struct {
+     int year  ;
+     int month ;
+     int strmonth;
+     int day   ;
+     int hour  ;
+     int minute;
+     int second;
+     int host  ;
+     int daemon;
+     int log   ;
+} syslog_groups_t;
+
+typedef struct {
+     regexp_t *regexp;
+     syslog_groups_t groups;
+} syslog_pattern_t;
+
 typedef struct syslog_entry_factory_s syslog_entry_factory_t;
 
-typedef bool_t (*extra_is_type_fn)(syslog_entry_factory_t *this, match_t *match);
+typedef bool_t (*extra_is_type_fn)(syslog_entry_factory_t *this, syslog_fields_t *fields);
 
 struct syslog_entry_factory_s {
      entry_factory_t fn;
      logger_t log;
-     cad_array_t *regexps;
-     regexp_t *regexp;
+     cad_array_t *patterns;
+     const native_parser_t *native;
+     bool_t use_native;
+     regexp_t *raw;
+     int raw_log;
+     regexp_t *space;
      const char *name;
      extra_is_type_fn extra_is_type;
      int priority;
@@ -65,28 +134,23 @@ struct syslog_entry_factory_s {
      const char *default_logline;
      int default_year;
      const char * const*extradirs;
+     regexp_limits_t limits;
 };
 
-static regexp_t *raw_regexp(logger_t log) {
-     static regexp_t *result = NULL;
+static regexp_t *builtin_regexp(logger_t log, const char *pattern) {
+     regexp_t *result = new_regexp(log, pattern, 0);
      if (result == NULL) {
-          result = new_regexp(log, "^(?<log>.*?)[[:space:]]*$", 0);
-          if (result == NULL) {
-               exit(1);
-          }
+          exit(1);
      }
      return result;
 }
 
+static regexp_t *raw_regexp(logger_t log) {
+     return builtin_regexp(log, "^(?<log>.*?)[[:space:]]*$");
+}
+
 static regexp_t *space_regexp(logger_t log) {
-     static regexp_t *result = NULL;
-     if (result == NULL) {
-          result = new_regexp(log, "[[:space:]]+", 0);
-          if (result == NULL) {
-               exit(1);
-          }
-     }
-     return result;
+     return builtin_regexp(log, "[[:space:]]+");
 }
 
 static const char *syslog_factory_get_name(syslog_entry_factory_t *this) {
@@ -109,32 +173,271 @@ static bool_t securelog_tally_logic(syslog_entry_factory_t *this, size_t tally,
      return result;
 }
 
-static bool_t securelog_extra_is_type(syslog_entry_factory_t *this, match_t *match) {
-     bool_t result = false;
-     const char *string;
-     string = match->named_substring(match, "daemon");
-     if (strlen(string) >= 5 && !strncmp("sshd[", string, 5)) {
-          result = true;
-     } else {
-          string = match->named_substring(match, "log");
-          if (strlen(string) >= 4 && !strncmp("pam_", string, 4)) {
-               result = true;
-          }
+static bool_t span_starts_with(span_t span, const char *prefix) {
+     size_t length = strlen(prefix);
+     return span.start != NULL && (size_t)span.length >= length && !strncmp(prefix, span.start, length);
+}
+
+static bool_t securelog_extra_is_type(syslog_entry_factory_t *this, syslog_fields_t *fields) {
+     return span_starts_with(fields->daemon, "sshd[") || span_starts_with(fields->log, "pam_");
+}
+
+static bool_t syslog_extra_is_type(syslog_entry_factory_t *this, syslog_fields_t *fields) {
+     return !securelog_extra_is_type(this, fields);
+}
+
+static bool_t default_extra_is_type(syslog_entry_factory_t *this, syslog_fields_t *fields) {
+     return true;
+}
+
+/*
+ * The native parser of BSD_SYSLOG_PATTERN: "Mmm dd hh:mm:ss host daemon log"
+ */
+
+#define IS_SPACE(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+#define IS_UPPER(c) ((c) >= 'A' && (c) <= 'Z')
+#define IS_LOWER(c) ((c) >= 'a' && (c) <= 'z')
+#define DIGITS2(p) (((p)[0] - '0') * 10 + (p)[1] - '0')
+
+static const char *skip_spaces(const char *p, const char *end) {
+     while (p < end && IS_SPACE(*p)) {
+          p++;
      }
-     return result;
+     return p;
 }
 
-static bool_t syslog_extra_is_type(syslog_entry_factory_t *this, match_t *match) {
-     return !securelog_extra_is_type(this, match);
+static const char *skip_word(const char *p, const char *end) {
+     while (p < end && !IS_SPACE(*p)) {
+          p++;
+     }
+     return p;
 }
 
-static bool_t default_extra_is_type(syslog_entry_factory_t *this, match_t *match) {
+static bool_t bsd_syslog_parse(const char *buffer, int length, syslog_fields_t *fields) {
+     const char *p = buffer, *q, *end = buffer + length;
+     char month[4];
+
+     /* a newline would change the meaning of '.' and '$' */
+     if (length < 16 || memchr(buffer, '\n', length) != NULL) {
+          return false;
+     }
+
+     if (!IS_UPPER(p[0]) || !IS_LOWER(p[1]) || !IS_LOWER(p[2])) {
+          return false;
+     }
+     memcpy(month, p, 3);
+     month[3] = '\0';
+     fields->month = month_of(month);
+     q = skip_spaces(p + 3, end);
+     if (q == p + 3 || q == end || !IS_DIGIT(*q)) {
+          return false;
+     }
+     p = q;
+     fields->day = *p++ - '0';
+     if (p < end && IS_DIGIT(*p)) {
+          fields->day = fields->day * 10 + *p++ - '0';
+     }
+     q = skip_spaces(p, end);
+     if (q == p || end - q < 8
+         || !IS_DIGIT(q[0]) || !IS_DIGIT(q[1]) || q[2] != ':'
+         || !IS_DIGIT(q[3]) || !IS_DIGIT(q[4]) || q[5] != ':'
+         || !IS_DIGIT(q[6]) || !IS_DIGIT(q[7])) {
+          return false;
+     }
+     fields->hour = DIGITS2(q);
+     fields->minute = DIGITS2(q + 3);
+     fields->second = DIGITS2(q + 6);
+     p = q + 8;
+
+     q = skip_spaces(p, end);
+     if (q == p || q == end) {
+          return false;
+     }
+     p = skip_word(q, end);
+     fields->host.start = q;
+     fields->host.length = p - q;
+     q = skip_spaces(p, end);
+     if (q == p || q == end) {
+          return false;
+     }
+     p = skip_word(q, end);
+     fields->daemon.start = q;
+     fields->daemon.length = p - q;
+     q = skip_spaces(p, end);
+     if (q == p) {
+          return false;
+     }
+
+     /* the log is lazy: trailing spaces are left out */
+     while (end > q && IS_SPACE(end[-1])) {
+          end--;
+     }
+     fields->log.start = q;
+     fields->log.length = end - q;
      return true;
 }
 
-static bool_t read_regexps_(syslog_entry_factory_t *this, const char *dir, const char *filename, cad_array_t *regexps) {
+static const native_parser_t bsd_syslog_parser = {
+     .pattern = BSD_SYSLOG_PATTERN,
+     .parse = bsd_syslog_parse,
+};
+
+/*
+ * The native parser of APACHE_ACCESS_PATTERN (common and combined log
+ * formats): 'ip rhost - [user - ][dd/Mmm/yyyy:hh:mm:ss +zzzz] "METHOD url HTTP/x.y" status length ...'
+ */
+
+static const char *skip_digits(const char *p, const char *end, int min, int max) {
+     const char *start = p;
+     while (p < end && p - start < max && IS_DIGIT(*p)) {
+          p++;
+     }
+     return p - start < min ? NULL : p;
+}
+
+static bool_t is_protocol(const char *p, const char *end) {
+     return end - p >= 9 && !memcmp(p, "HTTP/", 5)
+          && (p[5] == '1' || p[5] == '2') && p[6] == '.' && (p[7] == '0' || p[7] == '1') && p[8] == '"';
+}
+
+static bool_t apache_access_parse(const char *buffer, int length, syslog_fields_t *fields) {
+     const char *p = buffer, *q, *url, *end = buffer + length;
+     char month[4];
+     int i;
+
+     if (memchr(buffer, '\n', length) != NULL) {
+          return false;
+     }
+
+     for (i = 0; i < 4; i++) {
+          p = skip_digits(p, end, 1, 3);
+          if (p == NULL || p == end || *p != (i < 3 ? '.' : ' ')) {
+               return false;
+          }
+          p++;
+     }
+
+     /* rhost, then the optional user (tried first, as the pattern does) */
+     q = skip_word(p, end);
+     if (q == p || end - q < 3 || memcmp(q, " - ", 3)) {
+          return false;
+     }
+     p = skip_word(q + 3, end);
+     if (end - p >= 4 && !memcmp(p, " - [", 4)) {
+          p += 4;
+     } else if (q + 3 < end && q[3] == '[') {
+          p = q + 4;
+     } else {
+          return false;
+     }
+
+     q = skip_digits(p, end, 1, 2);
+     if (q == NULL || q == end || *q != '/') {
+          return false;
+     }
+     fields->day = q - p == 1 ? p[0] - '0' : DIGITS2(p);
+     while (q < end && *q == '/') {
+          q++;
+     }
+     p = q;
+     if (end - p < 21
+         || !IS_UPPER(p[0]) || !IS_LOWER(p[1]) || !IS_LOWER(p[2]) || p[3] != '/'
+         || !IS_DIGIT(p[4]) || !IS_DIGIT(p[5]) || !IS_DIGIT(p[6]) || !IS_DIGIT(p[7]) || p[8] != ':'
+         || !IS_DIGIT(p[9]) || !IS_DIGIT(p[10]) || p[11] != ':'
+         || !IS_DIGIT(p[12]) || !IS_DIGIT(p[13]) || p[14] != ':'
+         || !IS_DIGIT(p[15]) || !IS_DIGIT(p[16]) || !IS_SPACE(p[17])) {
+          return false;
+     }
+     memcpy(month, p, 3);
+     month[3] = '\0';
+     fields->month = month_of(month);
+     fields->year = DIGITS2(p + 4) * 100 + DIGITS2(p + 6);
+     fields->hour = DIGITS2(p + 9);
+     fields->minute = DIGITS2(p + 12);
+     fields->second = DIGITS2(p + 15);
+
+     p = skip_spaces(p + 17, end);
+     if (end - p < 6 || (*p != '-' && *p != '+')
+         || !IS_DIGIT(p[1]) || !IS_DIGIT(p[2]) || !IS_DIGIT(p[3]) || !IS_DIGIT(p[4]) || p[5] != ']') {
+          return false;
+     }
+     q = skip_spaces(p + 6, end);
+     if (q == p + 6 || q == end || *q != '"') {
+          return false;
+     }
+
+     /* the method, then the url: the shortest one followed by the protocol */
+     p = q + 1;
+     q = p;
+     while (q < end && IS_UPPER(*q)) {
+          q++;
+     }
+     url = skip_spaces(q, end);
+     if (q == p || url == q || url == end || *url == '"') {
+          return false;
+     }
+     p = url;
+     q = p + 1;
+     for (;;) {
+          while (q < end && !IS_SPACE(*q)) {
+               if (*q == '"') {
+                    return false;
+               }
+               q++;
+          }
+          if (q == end) {
+               return false;
+          }
+          p = skip_spaces(q, end);
+          if (is_protocol(p, end)) {
+               break;
+          }
+          q = p;
+     }
+     fields->host.start = fields->log.start = url;
+     fields->host.length = fields->log.length = q - url;
+     fields->daemon.start = NULL;
+     fields->daemon.length = 0;
+
+     /* the status and the content length; the rest is free */
+     q = skip_spaces(p + 9, end);
+     if (q == p + 9) {
+          return false;
+     }
+     p = skip_digits(q, end, 3, 3);
+     if (p == NULL) {
+          return false;
+     }
+     q = skip_spaces(p, end);
+     return q != p && q < end && (*q == '-' || IS_DIGIT(*q));
+}
+
+static const native_parser_t apache_access_parser = {
+     .pattern = APACHE_ACCESS_PATTERN,
+     .parse = apache_access_parse,
+};
+
+static void add_pattern(cad_array_t *patterns, regexp_t *regexp) {
+     syslog_pattern_t pattern;
+     pattern.regexp = regexp;
+     pattern.groups.year     = regexp->group(regexp, "year");
+     pattern.groups.month    = regexp->group(regexp, "month");
+     pattern.groups.strmonth = regexp->group(regexp, "strmonth");
+     pattern.groups.day      = regexp->group(regexp, "day");
+     pattern.groups.hour     = regexp->group(regexp, "hour");
+     pattern.groups.minute   = regexp->group(regexp, "minute");
+     pattern.groups.second   = regexp->group(regexp, "second");
+     pattern.groups.host     = regexp->group(regexp, "host");
+     pattern.groups.daemon   = regexp->group(regexp, "daemon");
+     pattern.groups.log      = regexp->group(regexp, "log");
+     patterns->insert(patterns, patterns->count(patterns), &pattern);
+}
+
+static bool_t read_regexps_(syslog_entry_factory_t *this, const char *dir, const char *filename, cad_array_t *patterns) {
      bool_t result = false;
      char *path = malloc(strlen(dir) + strlen(filename) + 1);
+     char pattern[MAX_LINE_SIZE];
      file_t *file;
      line_t *line;
      regexp_t *regexp;
@@ -144,21 +447,29 @@ static bool_t read_regexps_(syslog_entry_factory_t *this, const char *dir, const
      file = new_file(this->log, debug, path);
      if (file != NULL) {
           result = true;
-          n = file->lines_count(file);
+          n = file->ops->lines_count(file);
           for (i = 0; i < n; i++) {
-               line = file->line(file, i);
-               regexp = new_regexp(this->log, line->buffer, 0);
-               regexps->insert(regexps, regexps->count(regexps), &regexp);
+               line = file->ops->line(file, i);
+               memcpy(pattern, line->buffer, line->length);
+               pattern[line->length] = '\0';
+               regexp = new_regexp(this->log, pattern, 0);
+               /* a pattern that does not compile was already reported: ignored */
+               if (regexp != NULL) {
+                    regexp->limit(regexp, this->limits.match, this->limits.depth);
+                    add_pattern(patterns, regexp);
+               }
           }
+          file->ops->free(file);
      }
+     free(path);
 
      return result;
 }
 
 static cad_array_t *read_regexps(syslog_entry_factory_t *this) {
-     cad_array_t *result = cad_new_array(stdlib_memory, sizeof(regexp_t *));
+     cad_array_t *result = cad_new_array(stdlib_memory, sizeof(syslog_pattern_t));
      bool_t found = false, f;
-     static char filename[MAX_LINE_SIZE];
+     char filename[MAX_LINE_SIZE];
      const char *dir;
      int i;
 
@@ -181,34 +492,162 @@ static cad_array_t *read_regexps(syslog_entry_factory_t *this) {
      return result;
 }
 
-static bool_t syslog_is_type(syslog_entry_factory_t *this, line_t *line) {
-     bool_t result = false;
-     cad_array_t *regexps = this->regexps;
-     regexp_t *regexp;
-     match_t *match;
-     int i, n;
+/*
+ * The native parser is used only if it knows the first pattern of the
+ * factory: a customized pattern always wins.
+ */
+static void load_regexps(syslog_entry_factory_t *this) {
+     regexp_t *first;
+     this->patterns = read_regexps(this);
+     if (this->native != NULL && this->patterns->count(this->patterns) > 0) {
+          first = ((syslog_pattern_t *)this->patterns->get(this->patterns, 0))->regexp;
+          this->use_native = !strcmp(first->pattern(first), this->native->pattern);
+          this->log(debug, "%s native parser: %s\n", this->name, this->use_native ? "yes" : "no");
+     }
+}
+
+static cad_array_t *syslog_patterns(syslog_entry_factory_t *this) {
+     if (this->patterns == NULL) {
+          load_regexps(this);
+     }
+     return this->patterns;
+}
+
+static syslog_pattern_t *syslog_pattern(cad_array_t *patterns, int index) {
+     return (syslog_pattern_t *)patterns->get(patterns, index);
+}
+
+/*
+ * With limit_raw, a pattern that gave up on a line stops the search:
+ * the line is raw.
+ */
+static bool_t gave_up(syslog_entry_factory_t *this, match_t *match) {
+     return this->limits.action == limit_raw && match->ops->limited(match);
+}
 
-     if (regexps == NULL) {
-          regexps = this->regexps = read_regexps(this);
+static span_t match_span(match_t *match, line_t *line, int group) {
+     span_t result = { NULL, 0 };
+     int start, length;
+     if (match->ops->span(match, group, &start, &length)) {
+          result.start = line->buffer + start;
+          result.length = length;
      }
-     this->regexp = NULL;
+     return result;
+}
 
-     n = regexps->count(regexps);
-     for (i = 0; !result && i < n; i++) {
-          regexp = *(regexp_t **)regexps->get(regexps, i);
-          match = regexp->match(regexp, line->buffer, 0, line->length, 0);
-          if (match != NULL) {
-               result = this->extra_is_type(this, match);
-               if (result) {
-                    this->regexp = regexp;
+/*
+ * Like atoi() on the span; the default is used if the span is missing.
+ */
+static int span_int(span_t span, int deflt) {
+     char buffer[16];
+     int length = span.length < 15 ? span.length : 15;
+     if (span.start == NULL) {
+          return deflt;
+     }
+     memcpy(buffer, span.start, length);
+     buffer[length] = '\0';
+     return atoi(buffer);
+}
+
+static void match_fields(syslog_entry_factory_t *this, match_t *match, const syslog_groups_t *groups, line_t *line, syslog_fields_t *fields) {
+     span_t month, strmonth;
+     char buffer[16];
+     int length;
+
+     fields->year   = span_int(match_span(match, line, groups->year),   this->default_year);
+     fields->day    = span_int(match_span(match, line, groups->day),    1);
+     fields->hour   = span_int(match_span(match, line, groups->hour),   1);
+     fields->minute = span_int(match_span(match, line, groups->minute), 1);
+     fields->second = span_int(match_span(match, line, groups->second), 1);
+     fields->host   = match_span(match, line, groups->host);
+     fields->daemon = match_span(match, line, groups->daemon);
+     fields->log    = match_span(match, line, groups->log);
+
+     month = match_span(match, line, groups->month);
+     if (month.start != NULL) {
+          fields->month = span_int(month, 0);
+     } else {
+          strmonth = match_span(match, line, groups->strmonth);
+          if (strmonth.start == NULL) {
+               fields->month = 1;
+          } else {
+               length = strmonth.length < 15 ? strmonth.length : 15;
+               memcpy(buffer, strmonth.start, length);
+               buffer[length] = '\0';
+               fields->month = month_of(buffer);
+          }
+     }
+}
+
+static bool_t native_fields(syslog_entry_factory_t *this, line_t *line, syslog_fields_t *fields) {
+     fields->year = this->default_year;
+     return this->native->parse(line->buffer, line->length, fields);
+}
+
+static int syslog_is_type(syslog_entry_factory_t *this, line_t *line, const char *candidates, entry_scratch_t *scratch) {
+     int result = -1;
+     cad_array_t *patterns = syslog_patterns(this);
+     syslog_fields_t fields;
+     syslog_pattern_t *pattern;
+     match_t *match = scratch->match;
+     int i = 0, n;
+
+     n = patterns->count(patterns);
+     if (this->use_native && (candidates == NULL || candidates[0]) && native_fields(this, line, &fields)) {
+          if (this->extra_is_type(this, &fields)) {
+               result = 0;
+          }
+          i = 1;
+     }
+     for (; result < 0 && i < n; i++) {
+          if (candidates != NULL && !candidates[i]) {
+               continue;
+          }
+          pattern = syslog_pattern(patterns, i);
+          if (pattern->regexp->exec(pattern->regexp, match, line->buffer, 0, line->length, 0)) {
+               match_fields(this, match, &(pattern->groups), line, &fields);
+               if (this->extra_is_type(this, &fields)) {
+                    result = i;
                }
-               match->free(match);
+          } else if (gave_up(this, match)) {
+               break;
           }
      }
 
      return result;
 }
 
+/*
+ * The entry is parsed by the given pattern, or by the first one that
+ * matches the line; returns the groups of that pattern, or NULL if
+ * none matches.
+ */
+static const syslog_groups_t *syslog_match(syslog_entry_factory_t *this, line_t *line, int pattern, match_t *match) {
+     cad_array_t *patterns = syslog_patterns(this);
+     syslog_pattern_t *p;
+     int i, n;
+
+     if (pattern >= 0) {
+          p = syslog_pattern(patterns, pattern);
+          if (p->regexp->exec(p->regexp, match, line->buffer, 0, line->length, 0)) {
+               return &(p->groups);
+          }
+     } else {
+          n = patterns->count(patterns);
+          for (i = 0; i < n; i++) {
+               p = syslog_pattern(patterns, i);
+               if (p->regexp->exec(p->regexp, match, line->buffer, 0, line->length, 0)) {
+                    return &(p->groups);
+               }
+               if (gave_up(this, match)) {
+                    break;
+               }
+          }
+     }
+
+     return NULL;
+}
+
 typedef struct {
      entry_t fn;
      int year  ;
@@ -217,13 +656,33 @@ typedef struct {
      int hour  ;
      int minute;
      int second;
-     const char *host;
-     const char *daemon;
-     const char *logline;
+     span_t host;
+     span_t daemon;
+     span_t logline;
      logger_t log;
      const char *name;
+     cad_memory_t *memory;
 } syslog_entry_t;
 
+/*
+ * The strings of an entry are spans of its line, which lives at least
+ * as long as the entry; they are copied to a buffer of the thread when
+ * accessed. Only the strings that had to be rewritten are kept as
+ * strings.
+ */
+static __thread char host_buffer[MAX_LINE_SIZE];
+static __thread char daemon_buffer[MAX_LINE_SIZE];
+static __thread char logline_buffer[MAX_LINE_SIZE];
+
+static const char *span_string(span_t span, char *buffer) {
+     if (span.start == NULL || span.length < 0) {
+          return span.start;
+     }
+     memcpy(buffer, span.start, span.length);
+     buffer[span.length] = '\0';
+     return buffer;
+}
+
 static const char *syslog_get_name(syslog_entry_t *this) {
      return this->name;
 }
@@ -253,18 +712,32 @@ static int syslog_entry_second(syslog_entry_t *this) {
 }
 
 static const char *syslog_entry_host(syslog_entry_t *this) {
-     return this->host;
+     return span_string(this->host, host_buffer);
 }
 
 static const char *syslog_entry_daemon(syslog_entry_t *this) {
-     return this->daemon;
+     return span_string(this->daemon, daemon_buffer);
 }
 
 static const char *syslog_entry_logline(syslog_entry_t *this) {
-     return this->logline;
+     return span_string(this->logline, logline_buffer);
 }
 
-static entry_t syslog_entry_fn = {
+static void span_free(cad_memory_t *memory, span_t span) {
+     if (span.length == OWNED_SPAN) {
+          memory->free((char*)span.start);
+     }
+}
+
+static void syslog_entry_free(syslog_entry_t *this) {
+     cad_memory_t *memory = this->memory;
+     span_free(memory, this->host);
+     span_free(memory, this->daemon);
+     span_free(memory, this->logline);
+     memory->free(this);
+}
+
+static const entry_ops_t syslog_entry_ops = {
      .get_name = (entry_get_name_fn)syslog_get_name     ,
      .year     = (entry_year_fn    )syslog_entry_year   ,
      .month    = (entry_month_fn   )syslog_entry_month  ,
@@ -275,102 +748,187 @@ static entry_t syslog_entry_fn = {
      .host     = (entry_host_fn    )syslog_entry_host   ,
      .daemon   = (entry_daemon_fn  )syslog_entry_daemon ,
      .logline  = (entry_logline_fn )syslog_entry_logline,
+     .free     = (entry_free_fn    )syslog_entry_free   ,
 };
 
-static int string_2_int(syslog_entry_factory_t *this, match_t *match, const char *field, int (*deflt)(syslog_entry_factory_t*,match_t*)) {
-     int result;
-     const char *value = match->named_substring(match, field);
-     if (value == NULL) {
-          result = deflt(this, match);
-     } else {
-          result = atoi(value);
-     }
+static span_t string_span(const char *string) {
+     span_t result = { string, STRING_SPAN };
      return result;
 }
 
-static int one(syslog_entry_factory_t *this, match_t *match) {
-     return 1;
-}
-
-static int default_year(syslog_entry_factory_t *this, match_t *match) {
-     return this->default_year;
+/*
+ * The span as its string would be: up to the first `\0`.
+ */
+static span_t string_length(span_t span) {
+     const char *nul = memchr(span.start, '\0', span.length);
+     if (nul != NULL) {
+          span.length = nul - span.start;
+     }
+     return span;
 }
 
-static int str_month(syslog_entry_factory_t *this, match_t *match) {
-     int result;
-     const char *strmonth = match->named_substring(match, "strmonth");
-     if (strmonth == NULL) {
-          result = 1;
+static span_t entry_span(cad_memory_t *memory, span_t span, const char *def) {
+     span_t result;
+     if (span.start == NULL) {
+          result = string_span(def);
      } else {
-          result = month_of(strmonth);
+          result = string_length(span);
+          if (result.length >= MAX_LINE_SIZE) {
+               /* too long for the access buffers */
+               result.start = memory_strndup(memory, result.start, result.length);
+               result.length = OWNED_SPAN;
+          }
      }
      return result;
 }
 
-static char *string_clone(const char *string, const char *def) {
-     char *result;
-     if (string == NULL) {
-          result = def == NULL ? NULL : strdup(def);
-     } else {
-          result = strdup(string);
+static bool_t needs_collapse(span_t span) {
+     int i;
+     for (i = 0; i < span.length; i++) {
+          if (IS_SPACE(span.start[i]) && (span.start[i] != ' ' || (i + 1 < span.length && IS_SPACE(span.start[i + 1])))) {
+               return true;
+          }
+     }
+     return false;
+}
+
+/*
+ * The logline is truncated to MAX_LINE_SIZE, and its spaces are
+ * collapsed; it is copied only if there are spaces to collapse.
+ */
+static span_t logline_span(syslog_entry_factory_t *this, cad_memory_t *memory, span_t span, entry_scratch_t *scratch) {
+     span_t result = string_length(span);
+     int length;
+     if (result.length >= MAX_LINE_SIZE) {
+          result.length = MAX_LINE_SIZE - 1;
+     }
+     if (needs_collapse(result)) {
+          /* collapsed in the scratch buffer, so that only the final length is allocated */
+          length = this->space->replace_all(this->space, " ", result.start, result.length, scratch->buffer, MAX_LINE_SIZE);
+          if (length < 0) {
+               length = strlen(scratch->buffer);
+          }
+          result.start = memory_strndup(memory, scratch->buffer, length);
+          result.length = OWNED_SPAN;
      }
      return result;
 }
 
-static entry_t *syslog_new_entry(syslog_entry_factory_t *this, line_t *line) {
-     syslog_entry_t *result = malloc(sizeof(syslog_entry_t));
+/*
+ * The fields are given by the native parser if it can (and if the
+ * pattern is the one it knows), else by the pattern.
+ */
+static bool_t syslog_fields(syslog_entry_factory_t *this, line_t *line, int pattern, syslog_fields_t *fields, match_t *match) {
+     const syslog_groups_t *groups;
+     if (pattern == NO_PATTERN) {
+          return false;
+     }
+     if (this->use_native && pattern <= 0 && native_fields(this, line, fields)) {
+          return true;
+     }
+     groups = syslog_match(this, line, pattern, match);
+     if (groups == NULL) {
+          return false;
+     }
+     match_fields(this, match, groups, line, fields);
+     return true;
+}
 
-     regexp_t *re_sp = space_regexp(this->log);
-     regexp_t *re_raw = raw_regexp(this->log);
-     match_t *match = NULL;
-     char *logline = NULL;
+static entry_t *syslog_new_entry(syslog_entry_factory_t *this, line_t *line, int pattern, entry_scratch_t *scratch) {
+     cad_memory_t *memory = current_memory();
+     syslog_entry_t *result = memory->malloc(sizeof(syslog_entry_t));
 
-     result->fn = syslog_entry_fn;
+     syslog_fields_t fields;
+     match_t *match = scratch->match;
+     span_t log = { NULL, 0 };
+
+     result->fn.ops = &syslog_entry_ops;
      result->name    = this->name;
      result->log     = this->log;
-
-     if (this->regexp == NULL && !syslog_is_type(this, line)) {
-          this->log(warn, "Incompatible factory %s | %.*s\n", this->name, (int)line->length, line->buffer);
-     } else {
-          match = this->regexp->match(this->regexp, line->buffer, 0, line->length, 0);
-     }
-
-     if (match != NULL) {
-          result->year    = string_2_int(this, match, "year",   default_year);
-          result->month   = string_2_int(this, match, "month",  str_month);
-          result->day     = string_2_int(this, match, "day",    one);
-          result->hour    = string_2_int(this, match, "hour",   one);
-          result->minute  = string_2_int(this, match, "minute", one);
-          result->second  = string_2_int(this, match, "second", one);
-          result->host    = string_clone(match->named_substring(match, "host"), this->default_host);
-          result->daemon  = string_clone(match->named_substring(match, "daemon"), this->default_daemon);
-          logline         = string_clone(match->named_substring(match, "log"), NULL);
-          match->free(match);
+     result->memory  = memory;
+
+     if (syslog_fields(this, line, pattern, &fields, match)) {
+          result->year    = fields.year;
+          result->month   = fields.month;
+          result->day     = fields.day;
+          result->hour    = fields.hour;
+          result->minute  = fields.minute;
+          result->second  = fields.second;
+          result->host    = entry_span(memory, fields.host, this->default_host);
+          result->daemon  = entry_span(memory, fields.daemon, this->default_daemon);
+          log = fields.log;
      } else {
           result->year = 1900;
           result->day = result->month = result->hour = result->minute = result->second = 1;
-          result->host = result->daemon = "#";
+          result->host = string_span("#");
+          result->daemon = string_span("#");
           if (line->length > 0) {
-               match = re_raw->match(re_raw, line->buffer, 0, line->length, 0);
-               if (match != NULL) {
-                    logline = string_clone(match->named_substring(match, "log"), NULL);
-                    match->free(match);
+               if (this->raw->exec(this->raw, match, line->buffer, 0, line->length, 0)) {
+                    log = match_span(match, line, this->raw_log);
                } else {
-                    logline = string_clone(line->buffer, NULL);
+                    log.start = line->buffer;
+                    log.length = line->length;
                }
           }
      }
-     if (logline == NULL) {
-          result->logline = this->default_logline;
+     if (log.start == NULL) {
+          result->logline = string_span(this->default_logline);
      } else {
-          re_sp->replace_all(re_sp, " ", logline);
-          result->logline = logline;
+          result->logline = logline_span(this, memory, log, scratch);
      }
      return &(result->fn);
 }
 
 static void syslog_set_extradirs(syslog_entry_factory_t *this, const char * const*extradirs) {
      this->extradirs = extradirs;
+     if (this->patterns == NULL) {
+          /* read now, before files may be parsed in parallel */
+          load_regexps(this);
+     }
+}
+
+static void syslog_set_limits(syslog_entry_factory_t *this, regexp_limits_t limits) {
+     syslog_pattern_t *pattern;
+     int i, n;
+     this->limits = limits;
+     this->raw->limit(this->raw, limits.match, limits.depth);
+     this->space->limit(this->space, limits.match, limits.depth);
+     if (this->patterns != NULL) {
+          n = this->patterns->count(this->patterns);
+          for (i = 0; i < n; i++) {
+               pattern = syslog_pattern(this->patterns, i);
+               if (pattern->regexp != this->raw) {
+                    pattern->regexp->limit(pattern->regexp, limits.match, limits.depth);
+               }
+          }
+     }
+}
+
+static uint64_t syslog_signature(syslog_entry_factory_t *this) {
+     cad_array_t *patterns = syslog_patterns(this);
+     regexp_t *regexp;
+     const char *pattern;
+     uint64_t result = hash_bytes(HASH_INIT, this->name, strlen(this->name) + 1);
+     int i, n = patterns->count(patterns);
+     for (i = 0; i < n; i++) {
+          regexp = syslog_pattern(patterns, i)->regexp;
+          pattern = regexp->pattern(regexp);
+          result = hash_bytes(result, pattern, strlen(pattern) + 1);
+     }
+     /* a line a pattern gives up on is parsed otherwise */
+     result = hash_bytes(result, &(this->limits.match), sizeof(uint32_t));
+     result = hash_bytes(result, &(this->limits.depth), sizeof(uint32_t));
+     result = hash_bytes(result, &(this->limits.action), sizeof(limit_action_t));
+     return result;
+}
+
+static int syslog_add_regexps(syslog_entry_factory_t *this, regexp_set_t *set) {
+     cad_array_t *patterns = syslog_patterns(this);
+     int i, n = patterns->count(patterns);
+     for (i = 0; i < n; i++) {
+          set->add(set, syslog_pattern(patterns, i)->regexp);
+     }
+     return n;
 }
 
 static entry_factory_t syslog_entry_factory_fn = {
@@ -380,119 +938,72 @@ static entry_factory_t syslog_entry_factory_fn = {
      .is_type = (entry_factory_is_type_fn)syslog_is_type,
      .new_entry = (entry_factory_new_entry_fn)syslog_new_entry,
      .set_extradirs = (entry_factory_set_extradirs_fn)syslog_set_extradirs,
+     .set_limits = (entry_factory_set_limits_fn)syslog_set_limits,
+     .signature = (entry_factory_signature_fn)syslog_signature,
+     .add_regexps = (entry_factory_add_regexps_fn)syslog_add_regexps,
 };
 
-entry_factory_t *new_syslog_entry_factory(logger_t log) {
+static syslog_entry_factory_t *new_factory(logger_t log, const char *name, extra_is_type_fn extra_is_type, int priority) {
      syslog_entry_factory_t *result = malloc(sizeof(syslog_entry_factory_t));
      result->fn = syslog_entry_factory_fn;
      result->log = log;
-     result->regexps = NULL;
-     result->regexp = NULL;
-     result->name = "syslog";
-     result->extra_is_type = syslog_extra_is_type;
-     result->priority = 1;
+     result->patterns = NULL;
+     result->native = NULL;
+     result->use_native = false;
+     result->raw = raw_regexp(log);
+     result->raw_log = result->raw->group(result->raw, "log");
+     result->space = space_regexp(log);
+     result->name = name;
+     result->extra_is_type = extra_is_type;
+     result->priority = priority;
      result->default_host = "";
      result->default_daemon = "";
      result->default_logline = "#";
      result->default_year = THIS_YEAR;
+     result->extradirs = NULL;
+     result->limits.match = result->limits.depth = 0;
+     result->limits.action = limit_skip;
+     return result;
+}
+
+entry_factory_t *new_syslog_entry_factory(logger_t log) {
+     syslog_entry_factory_t *result = new_factory(log, "syslog", syslog_extra_is_type, 1);
+     result->native = &bsd_syslog_parser;
      return &(result->fn);
 }
 
 entry_factory_t *new_rsyslog_entry_factory(logger_t log) {
-     syslog_entry_factory_t *result = malloc(sizeof(syslog_entry_factory_t));
-     result->fn = syslog_entry_factory_fn;
-     result->log = log;
-     result->regexps = NULL;
-     result->regexp = NULL;
-     result->name = "rsyslog";
-     result->extra_is_type = default_extra_is_type;
-     result->priority = 1;
-     result->default_host = "";
-     result->default_daemon = "";
-     result->default_logline = "#";
-     result->default_year = THIS_YEAR;
+     syslog_entry_factory_t *result = new_factory(log, "rsyslog", default_extra_is_type, 1);
      return &(result->fn);
 }
 
 entry_factory_t *new_apache_access_entry_factory(logger_t log) {
-     syslog_entry_factory_t *result = malloc(sizeof(syslog_entry_factory_t));
-     result->fn = syslog_entry_factory_fn;
-     result->log = log;
-     result->regexps = NULL;
-     result->regexp = NULL;
-     result->name = "apache_access";
-     result->extra_is_type = default_extra_is_type;
-     result->priority = 0;
-     result->default_host = "";
-     result->default_daemon = "";
-     result->default_logline = "#";
-     result->default_year = THIS_YEAR;
+     syslog_entry_factory_t *result = new_factory(log, "apache_access", default_extra_is_type, 0);
+     result->native = &apache_access_parser;
      return &(result->fn);
 }
 
 entry_factory_t *new_apache_error_entry_factory(logger_t log) {
-     syslog_entry_factory_t *result = malloc(sizeof(syslog_entry_factory_t));
-     result->fn = syslog_entry_factory_fn;
-     result->log = log;
-     result->regexps = NULL;
-     result->regexp = NULL;
-     result->name = "apache_error";
-     result->extra_is_type = default_extra_is_type;
-     result->priority = 0;
-     result->default_host = "";
-     result->default_daemon = "";
-     result->default_logline = "#";
-     result->default_year = THIS_YEAR;
+     syslog_entry_factory_t *result = new_factory(log, "apache_error", default_extra_is_type, 0);
      return &(result->fn);
 }
 
 entry_factory_t *new_securelog_entry_factory(logger_t log) {
-     syslog_entry_factory_t *result = malloc(sizeof(syslog_entry_factory_t));
-     result->fn = syslog_entry_factory_fn;
+     syslog_entry_factory_t *result = new_factory(log, "securelog", securelog_extra_is_type, 2);
+     result->native = &bsd_syslog_parser;
      result->fn.tally_logic = (entry_factory_tally_logic_fn)securelog_tally_logic;
-     result->log = log;
-     result->regexps = NULL;
-     result->regexp = NULL;
-     result->name = "securelog";
-     result->extra_is_type = securelog_extra_is_type;
-     result->priority = 2;
-     result->default_host = "";
-     result->default_daemon = "";
-     result->default_logline = "#";
-     result->default_year = THIS_YEAR;
      return &(result->fn);
 }
 
 entry_factory_t *new_snort_entry_factory(logger_t log) {
-     syslog_entry_factory_t *result = malloc(sizeof(syslog_entry_factory_t));
-     result->fn = syslog_entry_factory_fn;
-     result->log = log;
-     result->regexps = NULL;
-     result->regexp = NULL;
-     result->name = "snort";
-     result->extra_is_type = default_extra_is_type;
-     result->priority = 0;
-     result->default_host = "";
-     result->default_daemon = "";
-     result->default_logline = "#";
-     result->default_year = THIS_YEAR;
+     syslog_entry_factory_t *result = new_factory(log, "snort", default_extra_is_type, 0);
      return &(result->fn);
 }
 
 entry_factory_t *new_raw_entry_factory(logger_t log) { /* is it used? */
-     syslog_entry_factory_t *result = malloc(sizeof(syslog_entry_factory_t));
-     regexp_t *regexp = raw_regexp(log);
-     result->fn = syslog_entry_factory_fn;
-     result->log = log;
-     result->regexps = cad_new_array(stdlib_memory, sizeof(regexp_t *));
-     result->regexps->insert(result->regexps, 0, &regexp);
-     result->regexp = NULL;
-     result->name = "raw";
-     result->extra_is_type = default_extra_is_type;
-     result->priority = -1;
-     result->default_host = "";
-     result->default_daemon = "";
-     result->default_logline = "#";
+     syslog_entry_factory_t *result = new_factory(log, "raw", default_extra_is_type, -1);
+     result->patterns = cad_new_array(stdlib_memory, sizeof(syslog_pattern_t));
+     add_pattern(result->patterns, result->raw);
      result->default_year = 1900;
      return &(result->fn);
 }
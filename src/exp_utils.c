@@ -52,3 +52,12 @@ int month_of(const char *month) {
      }
      return result;
 }
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t length) {
+     const unsigned char *bytes = data;
+     size_t i;
+     for (i = 0; i < length; i++) {
+          hash = (hash ^ bytes[i]) * 1099511628211ULL;
+     }
+     return hash;
+}
@@ -16,6 +16,8 @@ fingerprintdir1=$(cd ../data/fingerprints; pwd)/
 fingerprintdir2=$(cd ../data/fingerprint_library; pwd)/
 filterdir=$(cd ../data/filters; pwd)/
 factorydir=$(cd ../data/factories; pwd)/
+testfilterdir=$(cd filters; pwd)/
+testfactorydir=$(cd factories; pwd)/
 petit() {
     ../target/exp \
         -vv \
@@ -47,6 +49,14 @@ esac
 declare -a errors=()
 nbtests=0
 
+# Scratch directory for the files made by the tests themselves
+tmpdir=$(mktemp -d)
+trap 'rm -rf $tmpdir' EXIT
+
+# Extra arguments given to petit by run_test, and the name they add to the output file
+variant=
+variantargs=
+
 # This function runs one test
 function run_test() {
     local tst=$1
@@ -55,29 +65,38 @@ function run_test() {
 
     local funarg=--$fun
     local optarg=${opt:+--$opt}
-    local filename=$tst-$fun${opt:+-$opt}
+    local filename=$tst-$fun${variant:+-$variant}${opt:+-$opt}
 
     nbtests=$(($nbtests + 1))
 
     # Update files?
     if $update; then
-        echo "Updating: petit $funarg $optarg $tst.log: "
-        petit $funarg $optarg data/$tst.log >output/$filename.output 2>/dev/null
+        echo "Updating: petit ${variantargs:+$variantargs }$funarg $optarg $tst.log: "
+        petit $variantargs $funarg $optarg data/$tst.log >output/$filename.output 2>/dev/null
     fi
 
     # Run test
-    echo -n "Testing: petit $funarg $optarg $tst.log: "
-    petit $funarg $optarg data/$tst.log >$filename.tmp 2>$filename.log
+    echo -n "Testing: petit ${variantargs:+$variantargs }$funarg $optarg $tst.log: "
+    petit $variantargs $funarg $optarg data/$tst.log >$filename.tmp 2>$filename.log
+
+    check_test $filename output/$filename.output "petit ${variantargs:+$variantargs }$funarg $optarg $tst.log"
+}
+
+# This function checks the output of one test against the expected output
+function check_test() {
+    local filename=$1
+    local expected=$2
+    local label=$3
 
-    if diff -q output/$filename.output $filename.tmp >/dev/null; then
+    if diff -q $expected $filename.tmp >/dev/null; then
         rm -f $filename.{tmp,log,diff}
         echo " Passed"
     else
         echo " FAILED"
-        diff -u output/$filename.output $filename.tmp > $filename.diff
+        diff -u $expected $filename.tmp > $filename.diff
         # Leave data in place to inspect on failure #
         if $all; then
-            errors=("${errors[@]}" "petit $funarg $optarg $tst.log")
+            errors=("${errors[@]}" "$label")
         else
             cat $filename.diff
             exit 1
@@ -85,6 +104,139 @@ function run_test() {
     fi
 }
 
+# This function runs one test of the statistics; they are printed on
+# stderr, among the log lines (which are dropped)
+function run_stats_test() {
+    local tst=$1
+    local fun=$2
+    local opt=$3
+
+    local funarg=--$fun
+    local optarg=${opt:+--$opt}
+    local filename=$tst-$fun-stats${opt:+-$opt}
+    local logline='^[0-9]\{4\}/[0-9][0-9]/[0-9][0-9] '
+
+    nbtests=$(($nbtests + 1))
+
+    # Update files?
+    if $update; then
+        echo "Updating: petit $funarg --stats $optarg $tst.log: "
+        petit $funarg --stats $optarg data/$tst.log 2>&1 >/dev/null | grep -v "$logline" >output/$filename.output
+    fi
+
+    # Run test
+    echo -n "Testing: petit $funarg --stats $optarg $tst.log: "
+    petit $funarg --stats $optarg data/$tst.log 2>&1 >/dev/null | grep -v "$logline" >$filename.tmp
+
+    check_test $filename output/$filename.output "petit $funarg --stats $optarg $tst.log"
+}
+
+# This function runs one test that must give the same output as the
+# plain run of the same function on the same file: the given command
+# is run instead of petit
+function run_same_test() {
+    local tst=$1
+    local fun=$2
+    local name=$3
+    shift 3
+
+    local filename=$tst-$fun-$name
+
+    nbtests=$(($nbtests + 1))
+
+    # Run test
+    echo -n "Testing: $name $tst.log ($fun, same as plain run): "
+    "$@" >$filename.tmp 2>$filename.log
+
+    check_test $filename output/$tst-$fun.output "$name --$fun $tst.log"
+}
+
+# This function runs petit with --cache and complains on stdout if the
+# cache was not read
+function cached() {
+    petit --cache "$@" 2>$tmpdir/cached.log
+    grep -q 'Using cache for' $tmpdir/cached.log || echo "Cache not used"
+}
+
+# This function runs petit with --state on a copy of the given file
+# written in two halves: the second half is appended after a first run;
+# it complains on stdout if the second run did not resume the file
+function resumed() {
+    local funarg=$1
+    local test=$2
+    local size=$(wc -c <$test)
+
+    rm -f $tmpdir/resumed.state
+    head -c $(($size / 2)) $test >$tmpdir/resumed.log
+    petit $funarg --state=$tmpdir/resumed.state $tmpdir/resumed.log >/dev/null 2>&1
+    tail -c +$(($size / 2 + 1)) $test >>$tmpdir/resumed.log
+    petit $funarg --state=$tmpdir/resumed.state $tmpdir/resumed.log 2>$tmpdir/resumed.err
+    grep -q 'Resuming file at offset' $tmpdir/resumed.err || echo "File not resumed"
+}
+
+# This function runs petit with --state on a file holding the first
+# given file, then again once it was overwritten in place with the
+# second one; the other files are given to both runs, unchanged. The
+# second run must ignore the state: it complains on stdout otherwise
+function rewritten() {
+    local funarg=$1
+    local first=$2
+    local second=$3
+    shift 3
+
+    rm -f $tmpdir/rewritten.state
+    cat $first >$tmpdir/rewritten.log
+    petit $funarg --state=$tmpdir/rewritten.state $tmpdir/rewritten.log "$@" >/dev/null 2>&1
+    cat $second >$tmpdir/rewritten.log
+    petit $funarg --state=$tmpdir/rewritten.state $tmpdir/rewritten.log "$@" 2>$tmpdir/rewritten.err
+    grep -q 'Ignoring state' $tmpdir/rewritten.err || echo "State not ignored"
+}
+
+# This function follows a copy of the given file written in two halves:
+# the second half is appended while petit follows the file; petit is
+# then interrupted, and only its last report is printed (as long as the
+# report of a plain run)
+function followed() {
+    local funarg=$1
+    local test=$2
+    local size=$(wc -c <$test)
+    local length=$(petit $funarg $test 2>/dev/null | wc -l)
+    local pid
+
+    head -c $(($size / 2)) $test >$tmpdir/followed.log
+    petit $funarg --follow --interval=1 $tmpdir/followed.log >$tmpdir/followed.out 2>/dev/null &
+    pid=$!
+    sleep 1
+    tail -c +$(($size / 2 + 1)) $test >>$tmpdir/followed.log
+    sleep 2
+    # petit is a function: signal the program, not the subshell
+    pkill -INT -P $pid
+    wait $pid
+    tail -n $length $tmpdir/followed.out
+}
+
+# This function runs one test that must give the same output as the
+# plain run of the same function on the same files; the plain run is
+# made first, there is no expected file
+function run_plain_test() {
+    local name=$1
+    local fun=$2
+    local optarg=$3
+    shift 3
+
+    local filename=$name-$fun-${optarg#--}
+
+    nbtests=$(($nbtests + 1))
+
+    petit --$fun "$@" >$tmpdir/$name-$fun.output 2>/dev/null
+
+    # Run test
+    echo -n "Testing: petit $optarg --$fun $name (same as plain run): "
+    petit $optarg --$fun "$@" >$filename.tmp 2>$filename.log
+
+    check_test $filename $tmpdir/$name-$fun.output "petit $optarg --$fun $name"
+}
+
 # First test with no input, should print version
 if petit; then
     echo " Passed: Default with no input"
@@ -110,7 +262,7 @@ else
             done
         done
     done <<EOF
-hash fingerprint nosample nofilter dev1 dev2
+hash fingerprint nosample allsample nofilter dev1 dev2
 wordcount
 host
 daemon
@@ -122,6 +274,172 @@ mograph exp_mode wide tick=+
 ygraph  exp_mode wide tick=+
 EOF
 
+    # Then some options on chosen files only (see the list in the here-document below)
+    while read tst fun options; do
+        for opt in $options; do
+            run_test $tst $fun $opt
+        done
+    done <<EOF
+test14 hash    mixed
+test14 host    mixed
+test14 daemon  mixed
+test14 mgraph  mixed
+EOF
+
+    # Stopwords that need the linear regexp engine, and replacements
+    # longer than what they replace (see filters/linear)
+    variant=linear
+    variantargs="--filterdir ${testfilterdir}linear/"
+    run_test test15 hash
+    run_test test15 hash nosample
+
+    # Stopwords that hit the PCRE limits (see filters/limits)
+    variant=limits
+    variantargs="--filterdir ${testfilterdir}limits/ --nosample --matchlimit=100000"
+    run_test test15 hash
+    run_test test15 hash limitaction=raw
+
+    # A stopword that gives up on a line after replacing its first
+    # matches: skipped, it leaves the line unchanged (see filters/skip)
+    variant=skip
+    variantargs="--filterdir ${testfilterdir}skip/ --nosample --matchlimit=100000"
+    run_test test18 hash
+    run_test test18 hash limitaction=raw
+
+    # Factory patterns that hit the PCRE limits (see factories/limits):
+    # the line is parsed by the next pattern, or kept raw
+    variant=limits
+    variantargs="--factorydir ${testfactorydir}limits/ --matchlimit=100000"
+    for fun in hash host; do
+        run_test test18 $fun
+        run_test test18 $fun limitaction=skip
+        run_test test18 $fun limitaction=raw
+    done
+
+    variant=
+    variantargs=
+
+    # The statistics: how the factory of each file was selected, on
+    # files shorter than a full sample, and when the patterns give up on
+    # every sampled line of every round (the "raw" fallback)
+    while read tst fun options; do
+        run_stats_test $tst $fun
+        for opt in $options; do
+            run_stats_test $tst $fun $opt
+        done
+    done <<EOF
+test01 hash    mixed
+test02 hash    matchlimit=1
+test11 hash
+test14 hash    mixed
+test16 hash
+EOF
+
+    # Options that must not change the output
+    for fun in host daemon; do
+        run_same_test test01 $fun mixed petit --$fun --mixed data/test01.log
+    done
+    for test in data/*.log; do
+        tst=$(basename $test .log)
+        for fun in hash wordcount host daemon mgraph; do
+            run_same_test $tst $fun stream petit --$fun --stream $test
+            run_same_test $tst $fun jobs petit --$fun --jobs=4 $test
+        done
+    done
+    # A second run with --cache must read the cache (empty files are not
+    # cached)
+    export XDG_CACHE_HOME=$tmpdir/cache
+    for test in data/*.log; do
+        [ -s $test ] || continue
+        tst=$(basename $test .log)
+        petit --hash --cache $test >/dev/null 2>&1
+        for fun in hash wordcount host daemon mgraph; do
+            run_same_test $tst $fun cache cached --$fun $test
+        done
+    done
+    # ... but not a cache written with other limits
+    petit --host --cache --factorydir ${testfactorydir}limits/ data/test18.log >/dev/null 2>&1
+    run_same_test test18 host-limits-limitaction=raw cache petit --host --cache --factorydir ${testfactorydir}limits/ --matchlimit=100000 --limitaction=raw data/test18.log
+    # A factory line that does not compile is ignored (see
+    # factories/broken), by the dispatcher and by the cache signature
+    run_same_test test18 host broken-mixed petit --host --mixed --factorydir ${testfactorydir}broken/ data/test18.log
+    run_same_test test18 host broken-cache petit --host --cache --factorydir ${testfactorydir}broken/ data/test18.log
+    # A file read again with --state after lines were appended (empty
+    # files are not recorded)
+    for test in data/*.log; do
+        [ -s $test ] || continue
+        tst=$(basename $test .log)
+        for fun in hash wordcount host daemon mgraph; do
+            run_same_test $tst $fun state resumed --$fun $test
+        done
+    done
+    # A file rewritten in place, longer or shorter than what was read,
+    # is read again from its start with the other files; the state is
+    # not kept since it holds the old lines
+    for fun in hash wordcount host daemon mgraph; do
+        run_same_test test05 $fun rewrite rewritten --$fun data/test01.log data/test05.log
+        run_same_test test01 $fun truncate rewritten --$fun data/test05.log data/test01.log
+    done
+    for fun in hash host; do
+        petit --$fun data/test05.log data/test14.log >$tmpdir/rewrite-$fun.output 2>/dev/null
+        nbtests=$(($nbtests + 1))
+        echo -n "Testing: rewrite test05.log test14.log ($fun, same as plain run): "
+        rewritten --$fun data/test01.log data/test05.log data/test14.log >rewrite-$fun.tmp 2>rewrite-$fun.log
+        check_test rewrite-$fun $tmpdir/rewrite-$fun.output "rewrite --$fun test05.log test14.log"
+    done
+    # A compressed file cannot be resumed: once it changed, it is read
+    # again from its start
+    if type -p gzip >/dev/null; then
+        size=$(wc -c <data/test01.log)
+        head -c $(($size / 2)) data/test01.log | gzip >$tmpdir/test01-half.log.gz
+        gzip -c data/test01.log >$tmpdir/test01-full.log.gz
+        for fun in hash wordcount host daemon mgraph; do
+            run_same_test test01 $fun gz-rewrite rewritten --$fun $tmpdir/test01-half.log.gz $tmpdir/test01-full.log.gz
+        done
+    fi
+    # A file followed while lines are appended (slow: a few files only)
+    for tst in test01 test05 test14; do
+        for fun in hash host; do
+            run_same_test $tst $fun follow followed --$fun data/$tst.log
+        done
+    done
+    # Compressed copies; skipped if the tool is missing or if petit was
+    # built without the library
+    while read ext tool; do
+        if ! type -p $tool >/dev/null; then
+            echo "Skipping $ext: $tool not found"
+            continue
+        fi
+        $tool -c data/test01.log >$tmpdir/test01.log.$ext
+        if petit --hash $tmpdir/test01.log.$ext 2>&1 >/dev/null | grep -q 'compression is not supported'; then
+            echo "Skipping $ext: not supported by petit"
+            continue
+        fi
+        for test in data/*.log; do
+            tst=$(basename $test .log)
+            $tool -c $test >$tmpdir/$tst.log.$ext
+            for fun in hash wordcount host; do
+                run_same_test $tst $fun $ext petit --$fun $tmpdir/$tst.log.$ext
+            done
+        done
+    done <<EOF
+gz  gzip
+bz2 bzip2
+xz  xz
+zst zstd
+EOF
+    for fun in hash wordcount host daemon mgraph; do
+        run_plain_test all $fun --jobs=4 data/*.log
+    done
+
+    # A file big enough to be split in line ranges parsed in parallel
+    for i in $(seq 10); do
+        cat data/*.log
+    done >$tmpdir/big.log
+    for fun in hash wordcount host daemon mgraph; do
+        run_plain_test big $fun --jobs=4 $tmpdir/big.log
+    done
+
     errcount=${#errors[@]}
     echo "$errcount failed out of $nbtests tests ($((100 * ($nbtests - $errcount) / $nbtests))% success)"
     if [ $errcount -gt 0 ]; then